@@ -13,6 +13,7 @@ const build_wakaama = @import("build_wakaama.zig");
 const build_mqtt = @import("build_mqtt.zig");
 const build_picohttpparser = @import("build_picohttpparser.zig");
 const build_mcuboot = @import("build_mcuboot.zig");
+const build_host = @import("build_host.zig");
 const builtin = @import("builtin");
 
 pub fn build(b: *std.Build) !void {
@@ -36,11 +37,13 @@ pub fn build(b: *std.Build) !void {
         // Board (support) package
         "csrc/board/src/system_efm32gg.c",
         "csrc/board/src/board.c",
+        "csrc/board/src/flash_hal.c",
         "csrc/board/src/board_leds.c",
         "csrc/board/src/board_buttons.c",
         "csrc/board/src/board_watchdog.c",
         "csrc/board/src/board_sd_card.c",
         "csrc/board/src/sdmm.c",
+        "csrc/board/src/disk_cache.c",
         "csrc/board/src/board_i2c_sensors.c",
         "csrc/board/src/board_bma280.c",
         "csrc/board/src/board_bme280.c",
@@ -64,6 +67,9 @@ pub fn build(b: *std.Build) !void {
 
     const optimize = b.standardOptimizeOption(.{});
 
+    // Comb table of the CONFIG.PUB key in flash, from `inv trusted-key-table`
+    const trusted_key_table = b.option([]const u8, "trusted_key_table", "Generated comb table of the trusted key") orelse "csrc/src/trusted_key_table.c";
+
     const bootloader_target = .{
         .name = "boot",
         .target = .{
@@ -109,6 +115,7 @@ pub fn build(b: *std.Build) !void {
     for (src_paths) |path| {
         bootloader.addCSourceFile(.{ .file = .{ .path = path }, .flags = &c_flags_boot });
     }
+    bootloader.addCSourceFile(.{ .file = .{ .path = trusted_key_table }, .flags = &c_flags_boot });
 
     build_ff.build_ff(bootloader);
     build_gecko_sdk.aggregate(bootloader);
@@ -134,6 +141,7 @@ pub fn build(b: *std.Build) !void {
     for (src_paths) |path| {
         application.addCSourceFile(.{ .file = .{ .path = path }, .flags = &c_flags });
     }
+    application.addCSourceFile(.{ .file = .{ .path = trusted_key_table }, .flags = &c_flags });
 
     build_ff.build_ff(application);
     build_gecko_sdk.aggregate(application);
@@ -159,6 +167,7 @@ pub fn build(b: *std.Build) !void {
     for (src_paths) |path| {
         mqtt_app.addCSourceFile(.{ .file = .{ .path = path }, .flags = &c_flags });
     }
+    mqtt_app.addCSourceFile(.{ .file = .{ .path = trusted_key_table }, .flags = &c_flags });
 
     build_ff.build_ff(mqtt_app);
     build_gecko_sdk.aggregate(mqtt_app);
@@ -179,4 +188,6 @@ pub fn build(b: *std.Build) !void {
 
     microzig.installFirmware(b, mqtt_app, .{ .format = .elf });
     microzig.installFirmware(b, mqtt_app, .{ .format = .bin });
+
+    build_host.addSteps(b, optimize);
 }
@@ -0,0 +1,143 @@
+const std = @import("std");
+const build_mbedtls = @import("build_mbedtls.zig");
+const build_mcuboot = @import("build_mcuboot.zig");
+
+// Host stand-ins come first, so board.h resolves to csrc/host/board.h
+const include_path = [_][]const u8{
+    "csrc/host",
+    "csrc/config",
+    "csrc/board/inc",
+    "csrc/system/ff15/source",
+};
+
+// FatFs and the sector cache on top of a disk image
+const fs_source_path = [_][]const u8{
+    "csrc/system/ff15/source/ff.c",
+    "csrc/system/ff15/source/ffunicode.c",
+    "csrc/host/ffsystem.c",
+    "csrc/board/src/disk_cache.c",
+    "csrc/host/sdmm_image.c",
+};
+
+// The update code: configuration, mcuboot and mbedTLS, NVM3 and the flash HAL
+const update_include_path = [_][]const u8{
+    "csrc/inc",
+    "csrc/utils/jsmn",
+};
+
+const update_source_path = [_][]const u8{
+    "csrc/src/config.c",
+    "csrc/src/trusted_key_table.c",
+    "csrc/host/freertos_host.c",
+    "csrc/host/flash_sim.c",
+    "csrc/host/nvm3_sim.c",
+};
+
+const c_flags = [_][]const u8{"-O2"};
+
+// Unused functions are dropped as on the target, mcuboot's loader is never linked
+const lib_c_flags = [_][]const u8{ "-O2", "-fdata-sections", "-ffunction-sections" };
+
+fn addHostExecutable(b: *std.Build, name: []const u8, root: []const u8, optimize: std.builtin.OptimizeMode) *std.Build.Step.Compile {
+    const exe = b.addExecutable(.{
+        .name = name,
+        .root_source_file = .{ .path = root },
+        .optimize = optimize,
+    });
+
+    addHostSources(exe);
+
+    return exe;
+}
+
+/// Tests run as host executables with the same sources
+fn addHostTest(b: *std.Build, root: []const u8, optimize: std.builtin.OptimizeMode) *std.Build.Step.Compile {
+    const exe = b.addTest(.{
+        .root_source_file = .{ .path = root },
+        .optimize = optimize,
+    });
+
+    addHostSources(exe);
+
+    return exe;
+}
+
+/// C library, host stand-ins, FatFs and the sector cache
+fn addHostSources(exe: *std.Build.Step.Compile) void {
+    exe.linkLibC();
+    // Host benchmarks format their disk images
+    exe.defineCMacro("FF_USE_MKFS", "1");
+
+    for (include_path) |path| {
+        exe.addIncludePath(.{ .path = path });
+    }
+
+    for (fs_source_path) |path| {
+        exe.addCSourceFile(.{ .file = .{ .path = path }, .flags = &c_flags });
+    }
+}
+
+fn addRunStep(b: *std.Build, exe: *std.Build.Step.Compile, name: []const u8, description: []const u8) void {
+    const run = b.addRunArtifact(exe);
+
+    if (b.args) |args| {
+        run.addArgs(args);
+    }
+
+    b.step(name, description).dependOn(&run.step);
+}
+
+/// Add mbedTLS with the host configuration from csrc/host
+fn addMbedtlsSources(exe: *std.Build.Step.Compile) void {
+    // For the C sources and the Zig imports alike
+    exe.defineCMacro("MBEDTLS_CONFIG_FILE", "\"miso_mbedtls_config.h\"");
+    exe.link_gc_sections = true;
+
+    for (update_include_path ++ build_mbedtls.include_path) |path| {
+        exe.addIncludePath(.{ .path = path });
+    }
+
+    // The FreeRTOS adapters of the target are left out
+    for (build_mbedtls.source_path) |path| {
+        if (!std.mem.startsWith(u8, path, build_mbedtls.base_src_path)) continue;
+
+        exe.addCSourceFile(.{ .file = .{ .path = path }, .flags = &lib_c_flags });
+    }
+}
+
+/// Add the sources of the update state machine (src/boot/app.zig)
+fn addUpdateSources(exe: *std.Build.Step.Compile) void {
+    addMbedtlsSources(exe);
+
+    for (build_mcuboot.include_path) |path| {
+        exe.addIncludePath(.{ .path = path });
+    }
+
+    for (update_source_path ++ build_mcuboot.source_path) |path| {
+        exe.addCSourceFile(.{ .file = .{ .path = path }, .flags = &lib_c_flags });
+    }
+}
+
+/// Benchmarks and tests that run on the build host, not part of the default install
+pub fn addSteps(b: *std.Build, optimize: std.builtin.OptimizeMode) void {
+    const host_test = addHostTest(b, "src/host_test.zig", optimize);
+    addUpdateSources(host_test);
+
+    b.step("host-test", "Run the tests on the host").dependOn(&b.addRunArtifact(host_test).step);
+
+    const fs_bench = addHostExecutable(b, "fs-bench", "src/host_fs_bench.zig", optimize);
+
+    addRunStep(b, fs_bench, "host-fs-bench", "Run the file system benchmark on the host");
+
+    const update_bench = addHostExecutable(b, "update-bench", "src/host_update_bench.zig", optimize);
+    addUpdateSources(update_bench);
+
+    addRunStep(b, update_bench, "host-update-bench", "Run the firmware update benchmark on the host");
+
+    const verify_bench = addHostExecutable(b, "verify-bench", "src/host_verify_bench.zig", optimize);
+    addMbedtlsSources(verify_bench);
+    // Comb table of the benchmark key, generated by `inv trusted-key-table`
+    verify_bench.addCSourceFile(.{ .file = .{ .path = "csrc/host/trusted_key_table_bench.c" }, .flags = &lib_c_flags });
+
+    addRunStep(b, verify_bench, "host-verify-bench", "Run the signature verification benchmark on the host");
+}
@@ -1,14 +1,14 @@
 const std = @import("std");
 const microzig = @import("microzig");
 
-const include_path = [_][]const u8{
+pub const include_path = [_][]const u8{
     "csrc/crypto/mbedtls/include",
     // "csrc/crypto/mbedtls/include/mbedtls",
 };
 
-const base_src_path = "csrc/crypto/mbedtls/library/";
+pub const base_src_path = "csrc/crypto/mbedtls/library/";
 
-const source_path = [_][]const u8{
+pub const source_path = [_][]const u8{
     base_src_path ++ "aes.c",
     //base_src_path ++ "aesni.c",
     //base_src_path ++ "aria.c",
@@ -1,12 +1,12 @@
 const std = @import("std");
 const microzig = @import("microzig");
 
-const include_path = [_][]const u8{
+pub const include_path = [_][]const u8{
     "csrc/mcuboot/boot/bootutil/include",
     "csrc/mcuboot/boot/zig-freertos",
 };
 
-const source_path = [_][]const u8{
+pub const source_path = [_][]const u8{
     "csrc/mcuboot/boot/bootutil/src/boot_record.c",
     "csrc/mcuboot/boot/bootutil/src/bootutil_misc.c",
     "csrc/mcuboot/boot/bootutil/src/bootutil_public.c",
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * disk_cache.h
+ *
+ * Sector cache between FatFs and the SD card driver.
+ *
+ * - Single sector accesses are cached write-back with LRU eviction. Data is
+ *   written to the card on eviction and on CTRL_SYNC (f_sync, f_close).
+ * - Sectors in the metadata range (FAT and fixed root directory) are pinned
+ *   and only displaced by other metadata sectors.
+ * - Sequential single sector reads are detected and served from a read-ahead
+ *   window filled with one multiple block read.
+ * - Multiple sector transfers bypass the cache.
+ */
+
+#ifndef DISK_CACHE_H_
+#define DISK_CACHE_H_
+
+#include <stdint.h>
+
+// clang-format off
+#include "ff.h"
+#include "diskio.h"
+// clang-format on
+
+/* Number of cached sectors */
+#ifndef DISK_CACHE_LINES
+#define DISK_CACHE_LINES (8)
+#endif
+
+/* Maximum number of lines holding pinned metadata sectors */
+#ifndef DISK_CACHE_PINNED_LINES
+#define DISK_CACHE_PINNED_LINES (DISK_CACHE_LINES / 2)
+#endif
+
+/* Sectors fetched by one read-ahead (0 disables read-ahead) */
+#ifndef DISK_CACHE_READ_AHEAD
+#define DISK_CACHE_READ_AHEAD (4)
+#endif
+
+/* Sequential reads needed before read-ahead starts */
+#ifndef DISK_CACHE_SEQUENTIAL_THRESHOLD
+#define DISK_CACHE_SEQUENTIAL_THRESHOLD (2)
+#endif
+
+typedef struct
+{
+    uint32_t hits;          /* Sectors served from the cache */
+    uint32_t misses;        /* Single sector reads going to the card */
+    uint32_t read_ahead;    /* Sectors served from the read-ahead window */
+    uint32_t write_backs;   /* Dirty sectors written to the card */
+    uint32_t transactions;  /* Read and write commands issued to the card */
+} disk_cache_stats_t;
+
+/* Set the sector range [start, end) holding file system metadata */
+void disk_cache_set_metadata(LBA_t start, LBA_t end);
+
+/* Write all dirty sectors to the card */
+DRESULT disk_cache_flush(BYTE drv);
+
+/* Drop all cached sectors without writing them */
+void disk_cache_invalidate(void);
+
+/* Copy the cache statistics */
+void disk_cache_get_stats(disk_cache_stats_t *stats);
+
+#endif /* DISK_CACHE_H_ */
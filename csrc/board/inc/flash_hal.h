@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * flash_hal.h
+ *
+ * Internal flash access for the bootloader, the firmware staging and NVM3.
+ * Addresses are absolute flash addresses. The EFM32 implementation is
+ * flash_hal.c, the host simulator is csrc/host/flash_sim.c
+ * (built with FLASH_HAL_HOST, without NVM3).
+ *
+ * On the EFM32 the flash is memory mapped and may be read directly,
+ * flash_hal_read is the portable way.
+ */
+
+#ifndef FLASH_HAL_H_
+#define FLASH_HAL_H_
+
+#include <stdint.h>
+
+#if !defined(FLASH_HAL_HOST)
+#include "nvm3.h"
+#endif
+
+/* Erase unit */
+#define FLASH_HAL_PAGE_SIZE (4096u)
+
+/* Program unit */
+#define FLASH_HAL_WORD_SIZE (4u)
+
+typedef enum
+{
+    FLASH_HAL_OK = 0,
+    FLASH_HAL_ERR_ADDRESS, /* Outside the flash or not aligned */
+    FLASH_HAL_ERR_LOCKED,  /* Inside the locked range */
+    FLASH_HAL_ERR_TIMEOUT, /* The flash controller did not finish */
+    FLASH_HAL_ERR_FAILED,  /* Erase or program failed */
+} flash_hal_status_t;
+
+#if !defined(FLASH_HAL_HOST)
+/* NVM3 HAL on top of this one, valid after flash_hal_init */
+extern nvm3_HalHandle_t flash_hal_nvm3_handle;
+#endif
+
+/* Set up the NVM3 HAL. Call after MSC_Init and before nvm3_open. */
+void flash_hal_init(void);
+
+/* Erase the page starting at the page aligned `address` */
+flash_hal_status_t flash_hal_erase_page(uint32_t address);
+
+/* Program `len` bytes, a multiple of the word size, at the word aligned `address` */
+flash_hal_status_t flash_hal_write_words(uint32_t address, const void *data, uint32_t len);
+
+/* Read `len` bytes at `address` */
+flash_hal_status_t flash_hal_read(uint32_t address, void *data, uint32_t len);
+
+/* Reject erase and program inside [address, address + len). One range, replaces the previous one. */
+void flash_hal_lock(uint32_t address, uint32_t len);
+
+/* Remove the locked range */
+void flash_hal_unlock(void);
+
+#endif /* FLASH_HAL_H_ */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * sdmm.h
+ *
+ * MMC/SD card driver (SPI mode). The FatFs diskio entry points are provided by
+ * the sector cache in disk_cache.c, which uses these functions to access the card.
+ */
+
+#ifndef SDMM_H_
+#define SDMM_H_
+
+// clang-format off
+#include "ff.h"
+#include "diskio.h"
+// clang-format on
+
+DSTATUS mmc_disk_status(BYTE drv);
+DSTATUS mmc_disk_initialize(BYTE drv);
+DRESULT mmc_disk_read(BYTE drv, BYTE *buff, LBA_t sector, UINT count);
+DRESULT mmc_disk_write(BYTE drv, const BYTE *buff, LBA_t sector, UINT count);
+DRESULT mmc_disk_ioctl(BYTE drv, BYTE ctrl, void *buff);
+
+#endif /* SDMM_H_ */
@@ -46,6 +46,7 @@
 // #include "simplelink.h"
 
 #include "board_sd_card.h"
+#include "flash_hal.h"
 
 /* Silicon Labs Drivers */
 #include "sl_debug_swo.h"
@@ -125,6 +126,7 @@ void BOARD_Init(void)
     sl_device_init_lfxo();
     sl_device_init_emu();
 
+    flash_hal_init();
     (void)nvm3_open(miso_nvm3_handle, miso_nvm3_init_handle);
 
     NVIC_SetPriorityGrouping((uint32_t)3); /* Set priority grouping to group 4*/
@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * disk_cache.c
+ *
+ * FatFs diskio layer with a sector cache in front of the SD card driver (sdmm.c).
+ */
+#include "disk_cache.h"
+
+#include <string.h>
+
+#include "sdmm.h"
+
+_Static_assert(DISK_CACHE_LINES > 0, "The cache needs at least one line");
+_Static_assert(DISK_CACHE_PINNED_LINES < DISK_CACHE_LINES, "At least one line must remain unpinned");
+
+typedef struct
+{
+    LBA_t sector;      /* Cached sector */
+    uint32_t last_use; /* LRU stamp */
+    uint8_t valid;     /* Line holds a sector */
+    uint8_t dirty;     /* Line differs from the card */
+    uint8_t pinned;    /* Line holds a metadata sector */
+} cache_line_t;
+
+static BYTE cache_data[DISK_CACHE_LINES][FF_MAX_SS] __attribute__((aligned(4)));
+static cache_line_t cache_lines[DISK_CACHE_LINES];
+static uint32_t use_counter;
+
+/* Metadata range [meta_start, meta_end) */
+static LBA_t meta_start;
+static LBA_t meta_end;
+
+#if (DISK_CACHE_READ_AHEAD > 0)
+static BYTE ra_data[DISK_CACHE_READ_AHEAD][FF_MAX_SS] __attribute__((aligned(4)));
+static LBA_t ra_start;
+static UINT ra_count;
+#endif
+
+/* Sequential read detection */
+static LBA_t last_read;
+static UINT sequential;
+
+static disk_cache_stats_t cache_stats;
+
+/*-----------------------------------------------------------------------*/
+/* Card access                                                           */
+/*-----------------------------------------------------------------------*/
+
+static DRESULT card_read(BYTE drv, BYTE *buff, LBA_t sector, UINT count)
+{
+    cache_stats.transactions++;
+    return mmc_disk_read(drv, buff, sector, count);
+}
+
+static DRESULT card_write(BYTE drv, const BYTE *buff, LBA_t sector, UINT count)
+{
+    cache_stats.transactions++;
+    return mmc_disk_write(drv, buff, sector, count);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Read-ahead window                                                     */
+/*-----------------------------------------------------------------------*/
+
+static void ra_invalidate(LBA_t sector, UINT count)
+{
+#if (DISK_CACHE_READ_AHEAD > 0)
+    if ((ra_count != 0) && (sector < (ra_start + ra_count)) && (ra_start < (sector + count)))
+    {
+        ra_count = 0;
+    }
+#else
+    (void)sector;
+    (void)count;
+#endif
+}
+
+static int ra_lookup(BYTE *buff, LBA_t sector)
+{
+#if (DISK_CACHE_READ_AHEAD > 0)
+    if ((ra_count != 0) && (sector >= ra_start) && (sector < (ra_start + ra_count)))
+    {
+        memcpy(buff, ra_data[sector - ra_start], FF_MAX_SS);
+        return 1;
+    }
+#else
+    (void)buff;
+    (void)sector;
+#endif
+    return 0;
+}
+
+static DRESULT ra_fill(BYTE drv, LBA_t sector)
+{
+#if (DISK_CACHE_READ_AHEAD > 0)
+    DRESULT res;
+
+    ra_count = 0;
+
+    res = card_read(drv, &ra_data[0][0], sector, DISK_CACHE_READ_AHEAD);
+    if (RES_OK == res)
+    {
+        ra_start = sector;
+        ra_count = DISK_CACHE_READ_AHEAD;
+    }
+
+    return res;
+#else
+    (void)drv;
+    (void)sector;
+    return RES_ERROR;
+#endif
+}
+
+/*-----------------------------------------------------------------------*/
+/* Cache lines                                                           */
+/*-----------------------------------------------------------------------*/
+
+static int is_metadata(LBA_t sector) { return (sector >= meta_start) && (sector < meta_end); }
+
+static int find_line(LBA_t sector)
+{
+    for (int i = 0; i < DISK_CACHE_LINES; i++)
+    {
+        if (cache_lines[i].valid && (cache_lines[i].sector == sector))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void touch_line(int idx) { cache_lines[idx].last_use = ++use_counter; }
+
+static DRESULT write_back(BYTE drv, int idx)
+{
+    DRESULT res = RES_OK;
+
+    if (cache_lines[idx].dirty)
+    {
+        res = card_write(drv, cache_data[idx], cache_lines[idx].sector, 1);
+        if (RES_OK == res)
+        {
+            cache_lines[idx].dirty = 0;
+            cache_stats.write_backs++;
+        }
+
+        /* The read-ahead window may hold an older copy */
+        ra_invalidate(cache_lines[idx].sector, 1);
+    }
+
+    return res;
+}
+
+/* Pinned lines are only displaced by other metadata sectors, once the pinned share is exhausted */
+static int select_victim(int pinned)
+{
+    int victim       = -1;
+    int pinned_lines = 0;
+
+    for (int i = 0; i < DISK_CACHE_LINES; i++)
+    {
+        if (!cache_lines[i].valid)
+        {
+            return i;
+        }
+        if (cache_lines[i].pinned)
+        {
+            pinned_lines++;
+        }
+    }
+
+    if (pinned && (pinned_lines < DISK_CACHE_PINNED_LINES))
+    {
+        pinned = 0;
+    }
+
+    for (int i = 0; i < DISK_CACHE_LINES; i++)
+    {
+        if ((!cache_lines[i].pinned == !pinned) &&
+            ((victim < 0) || (cache_lines[i].last_use < cache_lines[victim].last_use)))
+        {
+            victim = i;
+        }
+    }
+
+    /* Every line got pinned by a metadata range update */
+    if (victim < 0)
+    {
+        for (int i = 0; i < DISK_CACHE_LINES; i++)
+        {
+            if ((victim < 0) || (cache_lines[i].last_use < cache_lines[victim].last_use))
+            {
+                victim = i;
+            }
+        }
+    }
+
+    return victim;
+}
+
+static DRESULT alloc_line(BYTE drv, LBA_t sector, int *idx)
+{
+    const int pinned = is_metadata(sector);
+    const int victim = select_victim(pinned);
+    DRESULT res;
+
+    res = write_back(drv, victim);
+    if (RES_OK != res)
+    {
+        return res;
+    }
+
+    cache_lines[victim].sector = sector;
+    cache_lines[victim].valid  = 1;
+    cache_lines[victim].dirty  = 0;
+    cache_lines[victim].pinned = (uint8_t)pinned;
+    touch_line(victim);
+
+    *idx = victim;
+
+    return RES_OK;
+}
+
+static DRESULT flush_range(BYTE drv, LBA_t sector, UINT count)
+{
+    for (int i = 0; i < DISK_CACHE_LINES; i++)
+    {
+        if (cache_lines[i].valid && (cache_lines[i].sector >= sector) && (cache_lines[i].sector < (sector + count)))
+        {
+            DRESULT res = write_back(drv, i);
+            if (RES_OK != res)
+            {
+                return res;
+            }
+        }
+    }
+
+    return RES_OK;
+}
+
+static DRESULT cache_read(BYTE drv, BYTE *buff, LBA_t sector)
+{
+    int idx          = find_line(sector);
+    DRESULT res      = RES_OK;
+    const int stream = (sector == (last_read + 1));
+
+    sequential = stream ? (sequential + 1) : 0;
+    last_read  = sector;
+
+    if (idx >= 0)
+    {
+        memcpy(buff, cache_data[idx], FF_MAX_SS);
+        touch_line(idx);
+        cache_stats.hits++;
+        return RES_OK;
+    }
+
+    if (ra_lookup(buff, sector))
+    {
+        cache_stats.read_ahead++;
+        return RES_OK;
+    }
+
+    /* Streamed data goes through the read-ahead window and leaves the cache lines alone */
+    if ((DISK_CACHE_READ_AHEAD > 0) && !is_metadata(sector) && (sequential >= DISK_CACHE_SEQUENTIAL_THRESHOLD))
+    {
+        if ((RES_OK == ra_fill(drv, sector)) && ra_lookup(buff, sector))
+        {
+            cache_stats.misses++;
+            return RES_OK;
+        }
+        /* Near the end of the card: fall back to a single sector read */
+    }
+
+    cache_stats.misses++;
+
+    res = alloc_line(drv, sector, &idx);
+    if (RES_OK != res)
+    {
+        return res;
+    }
+
+    res = card_read(drv, cache_data[idx], sector, 1);
+    if (RES_OK != res)
+    {
+        cache_lines[idx].valid = 0;
+        return res;
+    }
+
+    memcpy(buff, cache_data[idx], FF_MAX_SS);
+
+    return RES_OK;
+}
+
+static DRESULT cache_write(BYTE drv, const BYTE *buff, LBA_t sector)
+{
+    int idx = find_line(sector);
+
+    if (idx < 0)
+    {
+        /* No write allocation for file data */
+        if (!is_metadata(sector))
+        {
+            return card_write(drv, buff, sector, 1);
+        }
+
+        DRESULT res = alloc_line(drv, sector, &idx);
+        if (RES_OK != res)
+        {
+            return res;
+        }
+    }
+
+    memcpy(cache_data[idx], buff, FF_MAX_SS);
+    cache_lines[idx].dirty = 1;
+    touch_line(idx);
+
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Cache control                                                         */
+/*-----------------------------------------------------------------------*/
+
+void disk_cache_set_metadata(LBA_t start, LBA_t end)
+{
+    meta_start = start;
+    meta_end   = end;
+
+    for (int i = 0; i < DISK_CACHE_LINES; i++)
+    {
+        cache_lines[i].pinned = (uint8_t)(cache_lines[i].valid && is_metadata(cache_lines[i].sector));
+    }
+}
+
+DRESULT disk_cache_flush(BYTE drv)
+{
+    /* Write back in ascending sector order */
+    for (;;)
+    {
+        int next = -1;
+
+        for (int i = 0; i < DISK_CACHE_LINES; i++)
+        {
+            if (cache_lines[i].valid && cache_lines[i].dirty &&
+                ((next < 0) || (cache_lines[i].sector < cache_lines[next].sector)))
+            {
+                next = i;
+            }
+        }
+
+        if (next < 0)
+        {
+            return RES_OK;
+        }
+
+        DRESULT res = write_back(drv, next);
+        if (RES_OK != res)
+        {
+            return res;
+        }
+    }
+}
+
+void disk_cache_invalidate(void)
+{
+    memset(cache_lines, 0, sizeof(cache_lines));
+#if (DISK_CACHE_READ_AHEAD > 0)
+    ra_count = 0;
+#endif
+    sequential = 0;
+}
+
+void disk_cache_get_stats(disk_cache_stats_t *stats) { *stats = cache_stats; }
+
+/*-----------------------------------------------------------------------*/
+/* FatFs diskio interface                                                */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status(BYTE drv) { return mmc_disk_status(drv); }
+
+DSTATUS disk_initialize(BYTE drv)
+{
+    /* A (re-)initialized card may have been swapped */
+    if (mmc_disk_status(drv) & STA_NOINIT)
+    {
+        disk_cache_invalidate();
+    }
+
+    return mmc_disk_initialize(drv);
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, LBA_t sector, UINT count)
+{
+    DRESULT res;
+
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+
+    if (count == 1)
+    {
+        return cache_read(drv, buff, sector);
+    }
+
+    sequential = 0;
+
+    /* The card has to hold the latest data before it is read directly */
+    res = flush_range(drv, sector, count);
+    if (RES_OK == res)
+    {
+        res = card_read(drv, buff, sector, count);
+    }
+
+    return res;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, LBA_t sector, UINT count)
+{
+    DRESULT res;
+
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+
+    ra_invalidate(sector, count);
+
+    if (count == 1)
+    {
+        return cache_write(drv, buff, sector);
+    }
+
+    res = card_write(drv, buff, sector, count);
+
+    /* Keep cached copies in line with the card */
+    for (int i = 0; i < DISK_CACHE_LINES; i++)
+    {
+        if (cache_lines[i].valid && (cache_lines[i].sector >= sector) && (cache_lines[i].sector < (sector + count)))
+        {
+            if (RES_OK == res)
+            {
+                memcpy(cache_data[i], buff + ((cache_lines[i].sector - sector) * FF_MAX_SS), FF_MAX_SS);
+                cache_lines[i].dirty = 0;
+            }
+            else
+            {
+                cache_lines[i].valid = 0;
+            }
+        }
+    }
+
+    return res;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+    if (CTRL_SYNC == ctrl)
+    {
+        DRESULT res = disk_cache_flush(drv);
+        if (RES_OK != res)
+        {
+            return res;
+        }
+    }
+
+    return mmc_disk_ioctl(drv, ctrl, buff);
+}
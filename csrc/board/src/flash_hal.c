@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * flash_hal.c
+ *
+ * Flash HAL for the EFM32 internal flash, using the MSC driver of emlib.
+ * NVM3 gets a copy of the HAL of the Gecko SDK with erase and program
+ * routed through this file, so the locked range applies to it as well.
+ */
+
+#include "flash_hal.h"
+
+#include <string.h>
+
+#include "em_device.h"
+#include "em_msc.h"
+#include "nvm3_hal_flash.h"
+
+nvm3_HalHandle_t flash_hal_nvm3_handle;
+
+static uint32_t locked_start = 0u;
+static uint32_t locked_end = 0u;
+
+static int in_flash(uint32_t address, uint32_t len)
+{
+    /* Below FLASH_BASE wraps around to a large offset */
+    return (len <= FLASH_SIZE) && ((uint32_t)(address - FLASH_BASE) <= (FLASH_SIZE - len));
+}
+
+static int is_locked(uint32_t address, uint32_t len)
+{
+    return (address < locked_end) && ((address + len) > locked_start);
+}
+
+static flash_hal_status_t from_msc(MSC_Status_TypeDef status)
+{
+    switch (status)
+    {
+        case mscReturnOk:
+            return FLASH_HAL_OK;
+        case mscReturnInvalidAddr:
+        case mscReturnUnaligned:
+            return FLASH_HAL_ERR_ADDRESS;
+        case mscReturnLocked:
+            return FLASH_HAL_ERR_LOCKED;
+        case mscReturnTimeOut:
+            return FLASH_HAL_ERR_TIMEOUT;
+        default:
+            return FLASH_HAL_ERR_FAILED;
+    }
+}
+
+flash_hal_status_t flash_hal_erase_page(uint32_t address)
+{
+    if (((address % FLASH_HAL_PAGE_SIZE) != 0u) || !in_flash(address, FLASH_HAL_PAGE_SIZE))
+    {
+        return FLASH_HAL_ERR_ADDRESS;
+    }
+
+    if (is_locked(address, FLASH_HAL_PAGE_SIZE))
+    {
+        return FLASH_HAL_ERR_LOCKED;
+    }
+
+    return from_msc(MSC_ErasePage((uint32_t *)(uintptr_t)address));
+}
+
+flash_hal_status_t flash_hal_write_words(uint32_t address, const void *data, uint32_t len)
+{
+    if (((address % FLASH_HAL_WORD_SIZE) != 0u) || ((len % FLASH_HAL_WORD_SIZE) != 0u) || !in_flash(address, len))
+    {
+        return FLASH_HAL_ERR_ADDRESS;
+    }
+
+    if (is_locked(address, len))
+    {
+        return FLASH_HAL_ERR_LOCKED;
+    }
+
+    return (len == 0u) ? FLASH_HAL_OK : from_msc(MSC_WriteWord((uint32_t *)(uintptr_t)address, data, len));
+}
+
+flash_hal_status_t flash_hal_read(uint32_t address, void *data, uint32_t len)
+{
+    if (!in_flash(address, len))
+    {
+        return FLASH_HAL_ERR_ADDRESS;
+    }
+
+    memcpy(data, (const void *)(uintptr_t)address, len);
+
+    return FLASH_HAL_OK;
+}
+
+void flash_hal_lock(uint32_t address, uint32_t len)
+{
+    locked_start = address;
+    locked_end = address + len;
+}
+
+void flash_hal_unlock(void)
+{
+    locked_start = 0u;
+    locked_end = 0u;
+}
+
+static Ecode_t nvm3_write_words(nvm3_HalPtr_t nvmAdr, void const *src, size_t wordCnt)
+{
+    flash_hal_status_t status = flash_hal_write_words((uint32_t)(uintptr_t)nvmAdr, src, (uint32_t)(wordCnt * FLASH_HAL_WORD_SIZE));
+
+    return (status == FLASH_HAL_OK) ? ECODE_NVM3_OK : ((status == FLASH_HAL_ERR_ADDRESS) ? ECODE_NVM3_ERR_ADDRESS_RANGE : ECODE_NVM3_ERR_WRITE_FAILED);
+}
+
+static Ecode_t nvm3_page_erase(nvm3_HalPtr_t nvmAdr)
+{
+    flash_hal_status_t status = flash_hal_erase_page((uint32_t)(uintptr_t)nvmAdr);
+
+    return (status == FLASH_HAL_OK) ? ECODE_NVM3_OK : ((status == FLASH_HAL_ERR_ADDRESS) ? ECODE_NVM3_ERR_ADDRESS_RANGE : ECODE_NVM3_ERR_ERASE_FAILED);
+}
+
+void flash_hal_init(void)
+{
+    /* Open, close, info and access stay with the SDK */
+    flash_hal_nvm3_handle = nvm3_halFlashHandle;
+    flash_hal_nvm3_handle.writeWords = nvm3_write_words;
+    flash_hal_nvm3_handle.pageErase = nvm3_page_erase;
+}
@@ -16,6 +16,8 @@ MODIFICATIONS:
   MISO, 2022-2024
 
   Modifications to add simplified logic to interface with the board
+  Public functions renamed to mmc_disk_*, the diskio interface is provided
+  by the sector cache (disk_cache.c)
 
 /-------------------------------------------------------------------------*/
 
@@ -23,6 +25,7 @@ MODIFICATIONS:
 #include "ff.h"     /* Obtains integer types for FatFs */
 #include "diskio.h" /* Common include file for FatFs and disk I/O layer */
 // clang-format on
+#include "sdmm.h"
 
 /*-------------------------------------------------------------------------*/
 /* Platform dependent macros and functions needed to be modified           */
@@ -245,7 +248,7 @@ static BYTE send_cmd(          /* Returns command response (bit7==1:Send failed)
 /* Get Disk Status                                                       */
 /*-----------------------------------------------------------------------*/
 
-DSTATUS disk_status(BYTE drv /* Drive number (always 0) */
+DSTATUS mmc_disk_status(BYTE drv /* Drive number (always 0) */
 )
 {
     if (0 != drv)
@@ -269,7 +272,7 @@ DSTATUS disk_status(BYTE drv /* Drive number (always 0) */
 /* Initialize Disk Drive                                                 */
 /*-----------------------------------------------------------------------*/
 
-DSTATUS disk_initialize(BYTE drv /* Physical drive nmuber (0) */
+DSTATUS mmc_disk_initialize(BYTE drv /* Physical drive nmuber (0) */
 )
 {
     BYTE cmd, buf[10];
@@ -279,7 +282,7 @@ DSTATUS disk_initialize(BYTE drv /* Physical drive nmuber (0) */
 
     if (drv) return RES_NOTRDY;
 
-    if (0 == disk_status(drv))
+    if (0 == mmc_disk_status(drv))
     {
         return 0;
     }
@@ -361,14 +364,14 @@ static DSTATUS disk_disable(void)
 
     BOARD_SD_Card_Init();
 
-    return disk_status(0);
+    return mmc_disk_status(0);
 }
 
 /*-----------------------------------------------------------------------*/
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_read(BYTE drv,     /* Physical drive nmuber (0) */
+DRESULT mmc_disk_read(BYTE drv,     /* Physical drive nmuber (0) */
                   BYTE *buff,   /* Pointer to the data buffer to store read data */
                   LBA_t sector, /* Start sector number (LBA) */
                   UINT count    /* Sector count (1..128) */
@@ -377,7 +380,7 @@ DRESULT disk_read(BYTE drv,     /* Physical drive nmuber (0) */
     BYTE cmd;
     DWORD sect = (DWORD)sector;
 
-    if (disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
     if (!(CardType & CT_BLOCK)) sect *= 512; /* Convert LBA to byte address if needed */
 
     cmd = count > 1 ? CMD18 : CMD17; /*  READ_MULTIPLE_BLOCK : READ_SINGLE_BLOCK */
@@ -399,7 +402,7 @@ DRESULT disk_read(BYTE drv,     /* Physical drive nmuber (0) */
 /* Write Sector(s)                                                       */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_write(BYTE drv,         /* Physical drive nmuber (0) */
+DRESULT mmc_disk_write(BYTE drv,         /* Physical drive nmuber (0) */
                    const BYTE *buff, /* Pointer to the data to be written */
                    LBA_t sector,     /* Start sector number (LBA) */
                    UINT count        /* Sector count (1..128) */
@@ -407,7 +410,7 @@ DRESULT disk_write(BYTE drv,         /* Physical drive nmuber (0) */
 {
     DWORD sect = (DWORD)sector;
 
-    if (disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
     if (!(CardType & CT_BLOCK)) sect *= 512; /* Convert LBA to byte address if needed */
 
     if (count == 1)
@@ -439,7 +442,7 @@ DRESULT disk_write(BYTE drv,         /* Physical drive nmuber (0) */
 /* Miscellaneous Functions                                               */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_ioctl(BYTE drv,  /* Physical drive nmuber (0) */
+DRESULT mmc_disk_ioctl(BYTE drv,  /* Physical drive nmuber (0) */
                    BYTE ctrl, /* Control code */
                    void *buff /* Buffer to send/receive control data */
 )
@@ -448,7 +451,7 @@ DRESULT disk_ioctl(BYTE drv,  /* Physical drive nmuber (0) */
     BYTE n, csd[16];
     DWORD cs;
 
-    if (disk_status(drv) & STA_NOINIT) return RES_NOTRDY; /* Check if card is in the socket */
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY; /* Check if card is in the socket */
 
     res = RES_ERROR;
     switch (ctrl)
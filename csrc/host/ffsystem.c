@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * ffsystem.c
+ *
+ * OS dependent functions of FatFs for host builds. The host benchmarks run
+ * in a single thread, so the volume lock always succeeds.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "ff.h"
+
+#if FF_FS_REENTRANT
+int ff_mutex_create(int vol)
+{
+    (void)vol;
+    return 1;
+}
+
+void ff_mutex_delete(int vol) { (void)vol; }
+
+int ff_mutex_take(int vol)
+{
+    (void)vol;
+    return 1;
+}
+
+void ff_mutex_give(int vol) { (void)vol; }
+#endif
+
+DWORD get_fattime(void)
+{
+    struct tm date;
+    time_t now = time(NULL);
+
+    (void)localtime_r(&now, &date);
+
+    return (DWORD)(date.tm_year - 80) << 25 | (DWORD)(date.tm_mon + 1) << 21 | (DWORD)date.tm_mday << 16 |
+           (DWORD)date.tm_hour << 11 | (DWORD)date.tm_min << 5 | (DWORD)date.tm_sec >> 1;
+}
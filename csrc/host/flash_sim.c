@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * flash_sim.c
+ *
+ * Flash HAL backed by a RAM buffer (host builds only).
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "flash_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint8_t *sim_memory = NULL;
+static int sim_memory_owned = 0;
+static uint32_t *sim_page_erases = NULL;
+static flash_sim_model_t sim_model;
+static flash_sim_stats_t sim_stats;
+
+static uint32_t locked_start = 0u;
+static uint32_t locked_end = 0u;
+
+/* Operations left until the power fails, 0 when no failure is pending */
+static uint32_t power_fail_ops = 0u;
+static int power_lost = 0;
+
+/*-----------------------------------------------------------------------*/
+/* Timing model                                                          */
+/*-----------------------------------------------------------------------*/
+
+static void charge(uint64_t us)
+{
+    sim_stats.elapsed_us += us;
+
+    if (sim_model.sleep && us)
+    {
+        struct timespec ts = {.tv_sec = (time_t)(us / 1000000u), .tv_nsec = (long)((us % 1000000u) * 1000u)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int in_flash(uint32_t address, uint32_t len)
+{
+    return (sim_memory != NULL) && (address >= sim_model.base) && (len <= sim_model.size) &&
+           ((address - sim_model.base) <= (sim_model.size - len));
+}
+
+static int is_locked(uint32_t address, uint32_t len) { return (address < locked_end) && ((address + len) > locked_start); }
+
+/* Count an erase or program. Returns 0 if the power fails during it. */
+static int power_check(void)
+{
+    if (power_lost) return 0;
+
+    if (power_fail_ops && (0u == --power_fail_ops))
+    {
+        power_lost = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Flash control                                                         */
+/*-----------------------------------------------------------------------*/
+
+int flash_sim_open(const flash_sim_model_t *model, uint8_t *memory)
+{
+    const flash_sim_model_t defaults = FLASH_SIM_MODEL_DEFAULT;
+
+    flash_sim_close();
+
+    sim_model = model ? *model : defaults;
+    if ((0u == sim_model.size) || (0u != (sim_model.size % FLASH_HAL_PAGE_SIZE)) ||
+        (0u != (sim_model.base % FLASH_HAL_PAGE_SIZE)))
+    {
+        return -1;
+    }
+
+    sim_memory_owned = (NULL == memory);
+    sim_memory       = sim_memory_owned ? malloc(sim_model.size) : memory;
+    sim_page_erases  = calloc(sim_model.size / FLASH_HAL_PAGE_SIZE, sizeof(uint32_t));
+    if ((NULL == sim_memory) || (NULL == sim_page_erases))
+    {
+        flash_sim_close();
+        return -1;
+    }
+
+    memset(sim_memory, 0xFF, sim_model.size);
+
+    flash_sim_power_cycle();
+    flash_sim_power_fail_after(0u);
+    flash_sim_reset_stats();
+
+    return 0;
+}
+
+void flash_sim_close(void)
+{
+    if (sim_memory_owned)
+    {
+        free(sim_memory);
+    }
+    free(sim_page_erases);
+
+    sim_memory       = NULL;
+    sim_memory_owned = 0;
+    sim_page_erases  = NULL;
+}
+
+uint8_t *flash_sim_memory(void) { return sim_memory; }
+
+uint32_t flash_sim_page_erases(uint32_t address)
+{
+    return in_flash(address, 1u) ? sim_page_erases[(address - sim_model.base) / FLASH_HAL_PAGE_SIZE] : 0u;
+}
+
+void flash_sim_power_fail_after(uint32_t ops) { power_fail_ops = ops; }
+
+void flash_sim_power_cycle(void)
+{
+    power_lost = 0;
+    flash_hal_unlock();
+}
+
+void flash_sim_get_stats(flash_sim_stats_t *stats) { *stats = sim_stats; }
+
+void flash_sim_reset_stats(void)
+{
+    flash_sim_stats_t zero = {0};
+    sim_stats              = zero;
+}
+
+/*-----------------------------------------------------------------------*/
+/* flash_hal.h interface                                                 */
+/*-----------------------------------------------------------------------*/
+
+void flash_hal_init(void) {}
+
+flash_hal_status_t flash_hal_erase_page(uint32_t address)
+{
+    uint32_t page;
+    uint8_t *dest;
+
+    if (((address % FLASH_HAL_PAGE_SIZE) != 0u) || !in_flash(address, FLASH_HAL_PAGE_SIZE))
+    {
+        sim_stats.failed++;
+        return FLASH_HAL_ERR_ADDRESS;
+    }
+
+    if (is_locked(address, FLASH_HAL_PAGE_SIZE))
+    {
+        sim_stats.failed++;
+        return FLASH_HAL_ERR_LOCKED;
+    }
+
+    page = (address - sim_model.base) / FLASH_HAL_PAGE_SIZE;
+    dest = &sim_memory[address - sim_model.base];
+
+    if (!power_check())
+    {
+        /* Interrupted erase: only part of the page is erased */
+        memset(dest, 0xFF, FLASH_HAL_PAGE_SIZE / 2u);
+        sim_stats.failed++;
+        return FLASH_HAL_ERR_FAILED;
+    }
+
+    charge(sim_model.page_erase_us);
+    memset(dest, 0xFF, FLASH_HAL_PAGE_SIZE);
+
+    sim_stats.erases++;
+    if (++sim_page_erases[page] > sim_stats.max_page_erases)
+    {
+        sim_stats.max_page_erases = sim_page_erases[page];
+    }
+
+    return FLASH_HAL_OK;
+}
+
+flash_hal_status_t flash_hal_write_words(uint32_t address, const void *data, uint32_t len)
+{
+    const uint8_t *src = data;
+    uint8_t *dest;
+    uint32_t i;
+
+    if (((address % FLASH_HAL_WORD_SIZE) != 0u) || ((len % FLASH_HAL_WORD_SIZE) != 0u) || !in_flash(address, len))
+    {
+        sim_stats.failed++;
+        return FLASH_HAL_ERR_ADDRESS;
+    }
+
+    if (is_locked(address, len))
+    {
+        sim_stats.failed++;
+        return FLASH_HAL_ERR_LOCKED;
+    }
+
+    dest = &sim_memory[address - sim_model.base];
+
+    if (!power_check())
+    {
+        /* Interrupted write: the first half of the words is programmed */
+        len = (len / 2u) & ~(FLASH_HAL_WORD_SIZE - 1u);
+        for (i = 0u; i < len; i++)
+        {
+            dest[i] &= src[i];
+        }
+
+        sim_stats.failed++;
+        return FLASH_HAL_ERR_FAILED;
+    }
+
+    charge((uint64_t)sim_model.word_write_us * (len / FLASH_HAL_WORD_SIZE));
+
+    /* NOR flash: programming only clears bits */
+    for (i = 0u; i < len; i++)
+    {
+        dest[i] &= src[i];
+    }
+
+    sim_stats.words_written += len / FLASH_HAL_WORD_SIZE;
+
+    return FLASH_HAL_OK;
+}
+
+flash_hal_status_t flash_hal_read(uint32_t address, void *data, uint32_t len)
+{
+    if (!in_flash(address, len))
+    {
+        return FLASH_HAL_ERR_ADDRESS;
+    }
+
+    memcpy(data, &sim_memory[address - sim_model.base], len);
+    sim_stats.bytes_read += len;
+
+    return FLASH_HAL_OK;
+}
+
+void flash_hal_lock(uint32_t address, uint32_t len)
+{
+    locked_start = address;
+    locked_end   = address + len;
+}
+
+void flash_hal_unlock(void)
+{
+    locked_start = 0u;
+    locked_end   = 0u;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * flash_sim.h
+ *
+ * Host replacement for the flash HAL (flash_hal.c). The flash is a RAM
+ * buffer with NOR semantics: an erase sets a page to 0xFF, programming can
+ * only clear bits. Build it with FLASH_HAL_HOST.
+ *
+ * Every erase and program is charged with the time the EFM32 flash would
+ * need. The time is accumulated on a virtual clock and optionally slept for
+ * real. Erases are counted per page to follow the wear of a scenario.
+ *
+ * A power loss can be injected after a number of erase and program
+ * operations: that operation is only partly carried out and all further
+ * ones fail until flash_sim_power_cycle.
+ */
+
+#ifndef FLASH_SIM_H_
+#define FLASH_SIM_H_
+
+#include <stdint.h>
+
+#define FLASH_HAL_HOST 1
+#include "flash_hal.h"
+
+typedef struct
+{
+    uint32_t base;          /* Address of the first byte */
+    uint32_t size;          /* Size in bytes, a multiple of the page size */
+    uint32_t page_erase_us; /* Time of a page erase */
+    uint32_t word_write_us; /* Time to program a word */
+    int sleep;              /* Also sleep for the modelled time */
+} flash_sim_model_t;
+
+typedef struct
+{
+    uint32_t erases;          /* Page erases */
+    uint32_t words_written;   /* Words programmed */
+    uint32_t bytes_read;      /* Bytes read through flash_hal_read */
+    uint32_t max_page_erases; /* Erases of the most worn page */
+    uint32_t failed;          /* Rejected or power failed operations */
+    uint64_t elapsed_us;      /* Modelled flash time */
+} flash_sim_stats_t;
+
+/* EFM32GG, 1 MB, typical erase and word write time from the datasheet */
+#define FLASH_SIM_MODEL_DEFAULT {0x00000000u, 0x00100000u, 20000u, 20u, 0}
+
+/* Create an erased flash. Returns 0 on success.
+ * With `memory`, the flash is kept in that buffer of model->size bytes, e.g.
+ * the flash the Zig code reads through flash.region. Otherwise it is
+ * allocated. */
+int flash_sim_open(const flash_sim_model_t *model, uint8_t *memory);
+
+/* Release the flash */
+void flash_sim_close(void);
+
+/* The flash content, for memory mapped reads and to preload images */
+uint8_t *flash_sim_memory(void);
+
+/* Number of erases of the page containing `address` */
+uint32_t flash_sim_page_erases(uint32_t address);
+
+/* Lose power during the `ops`-th erase or program from now on, 0 disables */
+void flash_sim_power_fail_after(uint32_t ops);
+
+/* Restore power after an injected power loss. The locked range is cleared. */
+void flash_sim_power_cycle(void);
+
+/* Copy and reset the statistics. The erase counters per page are kept. */
+void flash_sim_get_stats(flash_sim_stats_t *stats);
+void flash_sim_reset_stats(void);
+
+#endif /* FLASH_SIM_H_ */
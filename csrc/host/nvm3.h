@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * nvm3.h
+ *
+ * Host stand-in for the Silicon Labs NVM3 API (host builds only). Only the
+ * part nvm.zig uses is declared. NVM3 itself ships as an ARM library, the
+ * host implementation keeps the objects in RAM, see nvm3_sim.h.
+ */
+
+#ifndef NVM3_H
+#define NVM3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t Ecode_t;
+
+#define ECODE_NVM3_OK (0u)
+#define ECODE_NVM3_ERR_KEY_INVALID (0xF000000Au)
+#define ECODE_NVM3_ERR_KEY_NOT_FOUND (0xF000000Bu)
+#define ECODE_NVM3_ERR_OBJECT_SIZE_NOT_SUPPORTED (0xF000000Cu)
+#define ECODE_NVM3_ERR_STORAGE_FULL (0xF000000Du)
+#define ECODE_NVM3_ERR_READ_DATA_SIZE (0xF000000Eu)
+#define ECODE_NVM3_ERR_OBJECT_IS_NOT_DATA (0xF000000Fu)
+#define ECODE_NVM3_ERR_OBJECT_IS_NOT_A_COUNTER (0xF0000010u)
+
+#define NVM3_OBJECTTYPE_DATA (0u)
+#define NVM3_OBJECTTYPE_COUNTER (1u)
+
+typedef uint32_t nvm3_ObjectKey_t;
+typedef void *nvm3_HalPtr_t;
+
+typedef struct
+{
+    int unused;
+} nvm3_HalHandle_t;
+
+typedef struct
+{
+    nvm3_ObjectKey_t key;
+    void *ptr;
+} nvm3_CacheEntry_t;
+
+typedef struct
+{
+    nvm3_HalPtr_t nvmAdr;
+    size_t nvmSize;
+    nvm3_CacheEntry_t *cachePtr;
+    size_t cacheEntryCount;
+    size_t maxObjectSize;
+    size_t repackHeadroom;
+    const nvm3_HalHandle_t *halHandle;
+} nvm3_Init_t;
+
+typedef struct
+{
+    int open;
+} nvm3_Handle_t;
+
+Ecode_t nvm3_open(nvm3_Handle_t *h, const nvm3_Init_t *i);
+Ecode_t nvm3_close(nvm3_Handle_t *h);
+Ecode_t nvm3_getObjectInfo(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t *type, size_t *len);
+size_t nvm3_countObjects(nvm3_Handle_t *h);
+Ecode_t nvm3_readData(nvm3_Handle_t *h, nvm3_ObjectKey_t key, void *value, size_t len);
+Ecode_t nvm3_writeData(nvm3_Handle_t *h, nvm3_ObjectKey_t key, const void *value, size_t len);
+Ecode_t nvm3_readCounter(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t *value);
+Ecode_t nvm3_writeCounter(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t value);
+Ecode_t nvm3_incrementCounter(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t *newValue);
+Ecode_t nvm3_deleteObject(nvm3_Handle_t *h, nvm3_ObjectKey_t key);
+Ecode_t nvm3_eraseAll(nvm3_Handle_t *h);
+
+#endif /* NVM3_H */
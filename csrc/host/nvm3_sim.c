@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * nvm3_sim.c
+ *
+ * NVM3 objects in RAM (host builds only).
+ */
+
+#include "nvm3_sim.h"
+
+#include <string.h>
+
+#include "flash_hal.h"
+
+typedef struct
+{
+    int used;
+    nvm3_ObjectKey_t key;
+    uint32_t type;
+    size_t len;
+    uint8_t data[NVM3_SIM_MAX_OBJECT_SIZE];
+} sim_object_t;
+
+/* Referenced by the NVM3 configuration in nvm.zig, unused by the simulation */
+nvm3_HalHandle_t flash_hal_nvm3_handle;
+
+static sim_object_t sim_objects[NVM3_SIM_MAX_OBJECTS];
+static nvm3_sim_stats_t sim_stats;
+static uint32_t sim_word_write_us = 20u;
+
+/* NVM3 keys are 20 bits */
+#define SIM_KEY_MASK (0x000FFFFFu)
+
+/* Object header of two words */
+#define SIM_HEADER_SIZE (8u)
+
+static sim_object_t *find(nvm3_ObjectKey_t key)
+{
+    uint32_t i;
+
+    for (i = 0u; i < NVM3_SIM_MAX_OBJECTS; i++)
+    {
+        if (sim_objects[i].used && (sim_objects[i].key == key))
+        {
+            return &sim_objects[i];
+        }
+    }
+
+    return NULL;
+}
+
+static sim_object_t *find_or_add(nvm3_ObjectKey_t key)
+{
+    sim_object_t *obj = find(key);
+    uint32_t i;
+
+    for (i = 0u; (NULL == obj) && (i < NVM3_SIM_MAX_OBJECTS); i++)
+    {
+        if (!sim_objects[i].used)
+        {
+            obj       = &sim_objects[i];
+            obj->used = 1;
+            obj->key  = key;
+        }
+    }
+
+    return obj;
+}
+
+static void charge_write(size_t len)
+{
+    sim_stats.writes++;
+    sim_stats.elapsed_us += (uint64_t)sim_word_write_us * ((SIM_HEADER_SIZE + len + 3u) / 4u);
+}
+
+void nvm3_sim_set_word_write_us(uint32_t us) { sim_word_write_us = us; }
+
+void nvm3_sim_get_stats(nvm3_sim_stats_t *stats) { *stats = sim_stats; }
+
+void nvm3_sim_reset_stats(void)
+{
+    nvm3_sim_stats_t zero = {0};
+    sim_stats             = zero;
+}
+
+/*-----------------------------------------------------------------------*/
+/* nvm3.h interface                                                      */
+/*-----------------------------------------------------------------------*/
+
+Ecode_t nvm3_open(nvm3_Handle_t *h, const nvm3_Init_t *i)
+{
+    (void)i;
+    h->open = 1;
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_close(nvm3_Handle_t *h)
+{
+    h->open = 0;
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_getObjectInfo(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t *type, size_t *len)
+{
+    const sim_object_t *obj = find(key);
+
+    (void)h;
+
+    if (NULL == obj) return ECODE_NVM3_ERR_KEY_NOT_FOUND;
+
+    *type = obj->type;
+    *len  = obj->len;
+
+    return ECODE_NVM3_OK;
+}
+
+size_t nvm3_countObjects(nvm3_Handle_t *h)
+{
+    size_t count = 0u;
+    uint32_t i;
+
+    (void)h;
+
+    for (i = 0u; i < NVM3_SIM_MAX_OBJECTS; i++)
+    {
+        count += sim_objects[i].used ? 1u : 0u;
+    }
+
+    return count;
+}
+
+Ecode_t nvm3_readData(nvm3_Handle_t *h, nvm3_ObjectKey_t key, void *value, size_t len)
+{
+    const sim_object_t *obj = find(key);
+
+    (void)h;
+
+    if (NULL == obj) return ECODE_NVM3_ERR_KEY_NOT_FOUND;
+    if (NVM3_OBJECTTYPE_DATA != obj->type) return ECODE_NVM3_ERR_OBJECT_IS_NOT_DATA;
+    if (len > obj->len) return ECODE_NVM3_ERR_READ_DATA_SIZE;
+
+    memcpy(value, obj->data, len);
+    sim_stats.reads++;
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_writeData(nvm3_Handle_t *h, nvm3_ObjectKey_t key, const void *value, size_t len)
+{
+    sim_object_t *obj;
+
+    (void)h;
+
+    if (key > SIM_KEY_MASK) return ECODE_NVM3_ERR_KEY_INVALID;
+    if (len > NVM3_SIM_MAX_OBJECT_SIZE) return ECODE_NVM3_ERR_OBJECT_SIZE_NOT_SUPPORTED;
+
+    obj = find_or_add(key);
+    if (NULL == obj) return ECODE_NVM3_ERR_STORAGE_FULL;
+
+    obj->type = NVM3_OBJECTTYPE_DATA;
+    obj->len  = len;
+    memcpy(obj->data, value, len);
+
+    charge_write(len);
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_readCounter(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t *value)
+{
+    const sim_object_t *obj = find(key);
+
+    (void)h;
+
+    if (NULL == obj) return ECODE_NVM3_ERR_KEY_NOT_FOUND;
+    if (NVM3_OBJECTTYPE_COUNTER != obj->type) return ECODE_NVM3_ERR_OBJECT_IS_NOT_A_COUNTER;
+
+    memcpy(value, obj->data, sizeof(*value));
+    sim_stats.reads++;
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_writeCounter(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t value)
+{
+    sim_object_t *obj;
+
+    (void)h;
+
+    if (key > SIM_KEY_MASK) return ECODE_NVM3_ERR_KEY_INVALID;
+
+    obj = find_or_add(key);
+    if (NULL == obj) return ECODE_NVM3_ERR_STORAGE_FULL;
+
+    obj->type = NVM3_OBJECTTYPE_COUNTER;
+    obj->len  = sizeof(value);
+    memcpy(obj->data, &value, sizeof(value));
+
+    charge_write(sizeof(value));
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_incrementCounter(nvm3_Handle_t *h, nvm3_ObjectKey_t key, uint32_t *newValue)
+{
+    uint32_t value = 0u;
+    Ecode_t ecode  = nvm3_readCounter(h, key, &value);
+
+    if (ECODE_NVM3_OK != ecode) return ecode;
+
+    value++;
+    ecode = nvm3_writeCounter(h, key, value);
+
+    if ((ECODE_NVM3_OK == ecode) && (NULL != newValue))
+    {
+        *newValue = value;
+    }
+
+    return ecode;
+}
+
+Ecode_t nvm3_deleteObject(nvm3_Handle_t *h, nvm3_ObjectKey_t key)
+{
+    sim_object_t *obj = find(key);
+
+    (void)h;
+
+    if (NULL == obj) return ECODE_NVM3_ERR_KEY_NOT_FOUND;
+
+    obj->used = 0;
+    sim_stats.deletes++;
+    sim_stats.elapsed_us += (uint64_t)sim_word_write_us * (SIM_HEADER_SIZE / 4u);
+
+    return ECODE_NVM3_OK;
+}
+
+Ecode_t nvm3_eraseAll(nvm3_Handle_t *h)
+{
+    (void)h;
+
+    memset(sim_objects, 0, sizeof(sim_objects));
+
+    return ECODE_NVM3_OK;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * nvm3_sim.h
+ *
+ * NVM3 for host builds. The objects are kept in RAM. Every write and delete
+ * is charged with the word writes NVM3 would program: an object header of
+ * two words plus the data. Page repacks are not modelled.
+ */
+
+#ifndef NVM3_SIM_H_
+#define NVM3_SIM_H_
+
+#include <stdint.h>
+
+#include "nvm3.h"
+
+/* Objects the simulation holds */
+#define NVM3_SIM_MAX_OBJECTS (64u)
+
+/* Largest data object */
+#define NVM3_SIM_MAX_OBJECT_SIZE (256u)
+
+typedef struct
+{
+    uint32_t reads;      /* Objects read */
+    uint32_t writes;     /* Objects written, counters included */
+    uint32_t deletes;    /* Objects deleted */
+    uint64_t elapsed_us; /* Modelled flash time */
+} nvm3_sim_stats_t;
+
+/* Time to program a word, as in flash_sim.h */
+void nvm3_sim_set_word_write_us(uint32_t us);
+
+/* Copy and reset the statistics */
+void nvm3_sim_get_stats(nvm3_sim_stats_t *stats);
+void nvm3_sim_reset_stats(void);
+
+#endif /* NVM3_SIM_H_ */
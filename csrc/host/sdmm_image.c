@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * sdmm_image.c
+ *
+ * SD card driver backed by a disk image file (host builds only).
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "sdmm_image.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static int image_fd = -1;
+static LBA_t image_sectors;
+static sdmm_image_model_t image_model;
+static sdmm_image_stats_t image_stats;
+
+/*-----------------------------------------------------------------------*/
+/* Timing model                                                          */
+/*-----------------------------------------------------------------------*/
+
+static uint64_t transfer_us(UINT count)
+{
+    /* 512 data bytes plus token and CRC per block, 8 clocks per byte */
+    return ((uint64_t)count * (512 + 3) * 8 * 1000000u) / image_model.spi_clock_hz;
+}
+
+static void charge(uint64_t us)
+{
+    image_stats.elapsed_us += us;
+
+    if (image_model.sleep && us)
+    {
+        struct timespec ts = {.tv_sec = (time_t)(us / 1000000u), .tv_nsec = (long)((us % 1000000u) * 1000u)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int in_range(LBA_t sector, UINT count) { return (count != 0) && (sector < image_sectors) && (count <= (image_sectors - sector)); }
+
+/*-----------------------------------------------------------------------*/
+/* Image control                                                         */
+/*-----------------------------------------------------------------------*/
+
+int sdmm_image_open(const char *path, const sdmm_image_model_t *model)
+{
+    const sdmm_image_model_t defaults = SDMM_IMAGE_MODEL_DEFAULT;
+    struct stat st;
+
+    sdmm_image_close();
+
+    image_fd = open(path, O_RDWR);
+    if (image_fd < 0)
+    {
+        return -1;
+    }
+
+    if ((0 != fstat(image_fd, &st)) || (st.st_size < 512))
+    {
+        sdmm_image_close();
+        return -1;
+    }
+
+    image_sectors = (LBA_t)(st.st_size / 512);
+    image_model   = model ? *model : defaults;
+    if (0 == image_model.spi_clock_hz)
+    {
+        image_model.spi_clock_hz = defaults.spi_clock_hz;
+    }
+
+    sdmm_image_reset_stats();
+
+    return 0;
+}
+
+void sdmm_image_close(void)
+{
+    if (image_fd >= 0)
+    {
+        close(image_fd);
+    }
+
+    image_fd      = -1;
+    image_sectors = 0;
+}
+
+void sdmm_image_get_stats(sdmm_image_stats_t *stats) { *stats = image_stats; }
+
+void sdmm_image_reset_stats(void)
+{
+    sdmm_image_stats_t zero = {0};
+    image_stats             = zero;
+}
+
+/*-----------------------------------------------------------------------*/
+/* sdmm.h interface                                                      */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS mmc_disk_status(BYTE drv)
+{
+    if (drv) return STA_NOINIT;
+
+    return (image_fd < 0) ? (STA_NOINIT | STA_NODISK) : 0;
+}
+
+DSTATUS mmc_disk_initialize(BYTE drv) { return mmc_disk_status(drv); }
+
+DRESULT mmc_disk_read(BYTE drv, BYTE *buff, LBA_t sector, UINT count)
+{
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+    if (!in_range(sector, count)) return RES_PARERR;
+
+    image_stats.commands++;
+    charge(image_model.command_us + image_model.read_access_us * (uint64_t)count + transfer_us(count) +
+           ((count > 1) ? image_model.command_us : 0)); /* CMD12 after a multiple block read */
+
+    if ((ssize_t)(count * 512u) != pread(image_fd, buff, count * 512u, (off_t)sector * 512))
+    {
+        return RES_ERROR;
+    }
+
+    image_stats.sectors_read += count;
+
+    return RES_OK;
+}
+
+DRESULT mmc_disk_write(BYTE drv, const BYTE *buff, LBA_t sector, UINT count)
+{
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+    if (!in_range(sector, count)) return RES_PARERR;
+
+    image_stats.commands++;
+    if (count == 1)
+    {
+        charge(image_model.command_us + transfer_us(1) + image_model.write_busy_us);
+    }
+    else
+    {
+        /* ACMD23 and CMD25, then the blocks and the stop token */
+        charge(2 * image_model.command_us + transfer_us(count) +
+               (uint64_t)image_model.multi_write_busy_us * count + image_model.write_busy_us);
+    }
+
+    if ((ssize_t)(count * 512u) != pwrite(image_fd, buff, count * 512u, (off_t)sector * 512))
+    {
+        return RES_ERROR;
+    }
+
+    image_stats.sectors_written += count;
+
+    return RES_OK;
+}
+
+DRESULT mmc_disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+    if (mmc_disk_status(drv) & STA_NOINIT) return RES_NOTRDY;
+
+    switch (ctrl)
+    {
+        case CTRL_SYNC:
+            image_stats.syncs++;
+            charge(image_model.command_us);
+            return (0 == fdatasync(image_fd)) ? RES_OK : RES_ERROR;
+
+        case GET_SECTOR_COUNT:
+            *(LBA_t *)buff = image_sectors;
+            return RES_OK;
+
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = 128;
+            return RES_OK;
+
+        default:
+            return RES_PARERR;
+    }
+}
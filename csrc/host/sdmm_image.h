@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * sdmm_image.h
+ *
+ * Host replacement for the SD card driver (sdmm.c). The card is a raw disk
+ * image file. Link it with ff.c and disk_cache.c to run FatFs and the Zig
+ * wrappers on Linux.
+ *
+ * Every command is charged with the time an SD card in SPI mode would need.
+ * The time is accumulated on a virtual clock and optionally slept for real.
+ */
+
+#ifndef SDMM_IMAGE_H_
+#define SDMM_IMAGE_H_
+
+#include <stdint.h>
+
+#include "sdmm.h"
+
+typedef struct
+{
+    uint32_t spi_clock_hz;        /* SPI clock after initialization */
+    uint32_t command_us;          /* Command, response and chip select overhead */
+    uint32_t read_access_us;      /* Time until a read data block starts (Nac) */
+    uint32_t write_busy_us;       /* Programming time of a single block write */
+    uint32_t multi_write_busy_us; /* Programming time per block of a multiple block write */
+    int sleep;                    /* Also sleep for the modelled time */
+} sdmm_image_model_t;
+
+typedef struct
+{
+    uint32_t commands;        /* Read and write commands */
+    uint32_t sectors_read;    /* Sectors read */
+    uint32_t sectors_written; /* Sectors written */
+    uint32_t syncs;           /* CTRL_SYNC requests */
+    uint64_t elapsed_us;      /* Modelled card time */
+} sdmm_image_stats_t;
+
+/* Typical SPI mode SD card, at BOARD_SD_CARD_BITRATE (10 MHz) */
+#define SDMM_IMAGE_MODEL_DEFAULT {10000000u, 20u, 300u, 800u, 250u, 0}
+
+/* Use the image at `path` as the card. Returns 0 on success. */
+int sdmm_image_open(const char *path, const sdmm_image_model_t *model);
+
+/* Release the image */
+void sdmm_image_close(void);
+
+/* Copy and reset the statistics */
+void sdmm_image_get_stats(sdmm_image_stats_t *stats);
+void sdmm_image_reset_stats(void);
+
+#endif /* SDMM_IMAGE_H_ */
@@ -0,0 +1,70 @@
+/* Generated by `inv trusted-key-table --key verify_bench_key.der`, do not edit. */
+
+#include <trusted_key_table.h>
+
+#if defined(MBEDTLS_HAVE_INT64)
+#define TRUSTED_KEY_LIMB(lo, hi) (((mbedtls_mpi_uint) (hi) << 32) | (lo))
+#else
+#define TRUSTED_KEY_LIMB(lo, hi) (lo), (hi)
+#endif
+
+#define TRUSTED_KEY_MPI(limbs) { .s = 1, .n = sizeof(limbs) / sizeof(mbedtls_mpi_uint), .p = (mbedtls_mpi_uint *) (limbs) }
+
+static const mbedtls_mpi_uint one[] = { 1 };
+
+static const mbedtls_mpi_uint T_0_X[] = { TRUSTED_KEY_LIMB(0x06BD8336, 0xE1ACA60B), TRUSTED_KEY_LIMB(0x96A579DB, 0x59F86E33), TRUSTED_KEY_LIMB(0x88937D99, 0xBC6FA31F), TRUSTED_KEY_LIMB(0x47C8DE4A, 0x665FB8AB) };
+static const mbedtls_mpi_uint T_0_Y[] = { TRUSTED_KEY_LIMB(0xED49130E, 0xC868E2BA), TRUSTED_KEY_LIMB(0xD003C496, 0xACAC69FF), TRUSTED_KEY_LIMB(0xA89860F7, 0x5C02699C), TRUSTED_KEY_LIMB(0xEE6831C7, 0xADC9CD1C) };
+static const mbedtls_mpi_uint T_1_X[] = { TRUSTED_KEY_LIMB(0xC27CED44, 0x27783BE4), TRUSTED_KEY_LIMB(0xA7E1E9B0, 0x5BC28127), TRUSTED_KEY_LIMB(0x973118B5, 0x028CD6A6), TRUSTED_KEY_LIMB(0xC4EFA087, 0x695F3BDA) };
+static const mbedtls_mpi_uint T_1_Y[] = { TRUSTED_KEY_LIMB(0x9D8994DB, 0xDA153864), TRUSTED_KEY_LIMB(0xB6C90E71, 0x8BB6F617), TRUSTED_KEY_LIMB(0xD04290EC, 0x2934C13C), TRUSTED_KEY_LIMB(0xA97ACC9B, 0x2CEA2181) };
+static const mbedtls_mpi_uint T_2_X[] = { TRUSTED_KEY_LIMB(0x948AC6AD, 0x5B1DAF8F), TRUSTED_KEY_LIMB(0xFDCF0DC2, 0x53FF768A), TRUSTED_KEY_LIMB(0x2F3E8903, 0x38C6B921), TRUSTED_KEY_LIMB(0x2B0DB0F4, 0xD724F5F5) };
+static const mbedtls_mpi_uint T_2_Y[] = { TRUSTED_KEY_LIMB(0x7040571C, 0x73C484BE), TRUSTED_KEY_LIMB(0x622F1865, 0x3314715B), TRUSTED_KEY_LIMB(0x8CC7473B, 0xFF79CD45), TRUSTED_KEY_LIMB(0x7E92CE1D, 0x7C0509A5) };
+static const mbedtls_mpi_uint T_3_X[] = { TRUSTED_KEY_LIMB(0xFC134B57, 0x37F908DB), TRUSTED_KEY_LIMB(0xD0B9E846, 0x028B3323), TRUSTED_KEY_LIMB(0xC9B337EA, 0x31011E99), TRUSTED_KEY_LIMB(0x56917548, 0xB00FA9EC) };
+static const mbedtls_mpi_uint T_3_Y[] = { TRUSTED_KEY_LIMB(0x877E9B57, 0x6181E43D), TRUSTED_KEY_LIMB(0x95F683BD, 0x5DAC7BBF), TRUSTED_KEY_LIMB(0xFEA8974F, 0x1DEE7773), TRUSTED_KEY_LIMB(0x89B0E324, 0x148A35E3) };
+static const mbedtls_mpi_uint T_4_X[] = { TRUSTED_KEY_LIMB(0x490FFC01, 0x6F2A9631), TRUSTED_KEY_LIMB(0x84A1F01F, 0xBFA474E3), TRUSTED_KEY_LIMB(0xEAA129DE, 0xCF1C116A), TRUSTED_KEY_LIMB(0x2A733FB5, 0x87225D75) };
+static const mbedtls_mpi_uint T_4_Y[] = { TRUSTED_KEY_LIMB(0x47CFC672, 0xD8AD42F5), TRUSTED_KEY_LIMB(0xB49E3139, 0xFD7EA6F1), TRUSTED_KEY_LIMB(0x36F1413D, 0x1F0191FC), TRUSTED_KEY_LIMB(0xE8B48622, 0xC89F081E) };
+static const mbedtls_mpi_uint T_5_X[] = { TRUSTED_KEY_LIMB(0xB1841948, 0x4E182936), TRUSTED_KEY_LIMB(0x74EDA3CC, 0x782CEF91), TRUSTED_KEY_LIMB(0xCA11F54E, 0x26C4C8D2), TRUSTED_KEY_LIMB(0x7CECBEA3, 0xE74EDA3D) };
+static const mbedtls_mpi_uint T_5_Y[] = { TRUSTED_KEY_LIMB(0x4C6E52F5, 0x4A5F0E23), TRUSTED_KEY_LIMB(0xBA24B9BF, 0x669C6765), TRUSTED_KEY_LIMB(0x41E1AD8E, 0xCF0D1BD4), TRUSTED_KEY_LIMB(0x8C54306A, 0x7FA16B09) };
+static const mbedtls_mpi_uint T_6_X[] = { TRUSTED_KEY_LIMB(0x70E41809, 0x5E7649C7), TRUSTED_KEY_LIMB(0x0E8D71EC, 0x0CCC85D0), TRUSTED_KEY_LIMB(0x4A206327, 0xA0829CC7), TRUSTED_KEY_LIMB(0xA8922904, 0xA42DAE6B) };
+static const mbedtls_mpi_uint T_6_Y[] = { TRUSTED_KEY_LIMB(0x854D5487, 0xAFA06D32), TRUSTED_KEY_LIMB(0x31C89F58, 0x3A3E8AF8), TRUSTED_KEY_LIMB(0xCF94DEE6, 0xFC7F6327), TRUSTED_KEY_LIMB(0xE5D0ECBB, 0x61F7E88D) };
+static const mbedtls_mpi_uint T_7_X[] = { TRUSTED_KEY_LIMB(0x739115BB, 0xBD57904C), TRUSTED_KEY_LIMB(0xA1388893, 0x28841D38), TRUSTED_KEY_LIMB(0xFD6788ED, 0xEB2ABC97), TRUSTED_KEY_LIMB(0xC48D887C, 0xEA93BE75) };
+static const mbedtls_mpi_uint T_7_Y[] = { TRUSTED_KEY_LIMB(0xDCC576FD, 0xAB26FFF7), TRUSTED_KEY_LIMB(0x30C91910, 0x96361E9E), TRUSTED_KEY_LIMB(0x48F2698B, 0x08733D21), TRUSTED_KEY_LIMB(0xA829B2CF, 0x3C13C429) };
+static const mbedtls_mpi_uint T_8_X[] = { TRUSTED_KEY_LIMB(0xC5235CC5, 0x3F54D812), TRUSTED_KEY_LIMB(0x248B55A1, 0xC15007D3), TRUSTED_KEY_LIMB(0x10E242E9, 0x405DC5D8), TRUSTED_KEY_LIMB(0x5D366FB1, 0xF3109406) };
+static const mbedtls_mpi_uint T_8_Y[] = { TRUSTED_KEY_LIMB(0x201E2C41, 0x0AE79A76), TRUSTED_KEY_LIMB(0xC5FE3040, 0x327B836E), TRUSTED_KEY_LIMB(0x2244083D, 0xDC0D4BC3), TRUSTED_KEY_LIMB(0xCF5B4FD0, 0xA34856FA) };
+static const mbedtls_mpi_uint T_9_X[] = { TRUSTED_KEY_LIMB(0x9C3E8DFF, 0x304C5C45), TRUSTED_KEY_LIMB(0x4799DEAD, 0x59585A92), TRUSTED_KEY_LIMB(0x9645E3EF, 0xEC32BF08), TRUSTED_KEY_LIMB(0x4D529F33, 0x061793C5) };
+static const mbedtls_mpi_uint T_9_Y[] = { TRUSTED_KEY_LIMB(0xC4CA0712, 0x2BCAAB5D), TRUSTED_KEY_LIMB(0x984FA8C9, 0x6CC2610C), TRUSTED_KEY_LIMB(0xBFFEE4F1, 0xCC895F78), TRUSTED_KEY_LIMB(0x503EF69D, 0x5A935626) };
+static const mbedtls_mpi_uint T_10_X[] = { TRUSTED_KEY_LIMB(0xD97AD6D5, 0xA47425CB), TRUSTED_KEY_LIMB(0xE08712F3, 0x3EB64E74), TRUSTED_KEY_LIMB(0xEDD271FC, 0xEFEFFE7F), TRUSTED_KEY_LIMB(0x34C5EAF4, 0x10411120) };
+static const mbedtls_mpi_uint T_10_Y[] = { TRUSTED_KEY_LIMB(0x763C1B37, 0xB72E4A91), TRUSTED_KEY_LIMB(0x8483B4DB, 0x5AB4EBCE), TRUSTED_KEY_LIMB(0x691BE4BF, 0x89C72601), TRUSTED_KEY_LIMB(0x1461E9E7, 0xB887232F) };
+static const mbedtls_mpi_uint T_11_X[] = { TRUSTED_KEY_LIMB(0x78F82865, 0x940F7E04), TRUSTED_KEY_LIMB(0xD0A043A2, 0x190967CF), TRUSTED_KEY_LIMB(0xE9702180, 0xB49E1BC6), TRUSTED_KEY_LIMB(0xA498F6AB, 0x36DDB571) };
+static const mbedtls_mpi_uint T_11_Y[] = { TRUSTED_KEY_LIMB(0xF181CBA6, 0xB9364A88), TRUSTED_KEY_LIMB(0x918433D9, 0x855C54C5), TRUSTED_KEY_LIMB(0x546DDFA8, 0x79CAB271), TRUSTED_KEY_LIMB(0x6EC17F4B, 0x5307734D) };
+static const mbedtls_mpi_uint T_12_X[] = { TRUSTED_KEY_LIMB(0x6B8BF989, 0x957CAD0E), TRUSTED_KEY_LIMB(0x8875407B, 0xAE6DE670), TRUSTED_KEY_LIMB(0xE98B5646, 0x0999E162), TRUSTED_KEY_LIMB(0x4644348D, 0xADB9063E) };
+static const mbedtls_mpi_uint T_12_Y[] = { TRUSTED_KEY_LIMB(0x558CC38A, 0x476E3C87), TRUSTED_KEY_LIMB(0x52102F92, 0xE22654E6), TRUSTED_KEY_LIMB(0x95F2A705, 0x9FD7DA7D), TRUSTED_KEY_LIMB(0xBEBAC66B, 0xE3413CD5) };
+static const mbedtls_mpi_uint T_13_X[] = { TRUSTED_KEY_LIMB(0xDE4777AF, 0xE1026D61), TRUSTED_KEY_LIMB(0x03A6CB0A, 0xC032C5A3), TRUSTED_KEY_LIMB(0x2FBC8FEA, 0xD7B6CF74), TRUSTED_KEY_LIMB(0x0869C085, 0x93D5A58C) };
+static const mbedtls_mpi_uint T_13_Y[] = { TRUSTED_KEY_LIMB(0x0576AF01, 0x1B71C81C), TRUSTED_KEY_LIMB(0x02854EA5, 0xA25DA6F3), TRUSTED_KEY_LIMB(0xDEA4D325, 0xE5D67A71), TRUSTED_KEY_LIMB(0x9D9DE5E4, 0x26FC2528) };
+static const mbedtls_mpi_uint T_14_X[] = { TRUSTED_KEY_LIMB(0xE6660919, 0xBE99F79D), TRUSTED_KEY_LIMB(0x8B805702, 0x5814CC3C), TRUSTED_KEY_LIMB(0xF5AFDC88, 0x7E0EFE29), TRUSTED_KEY_LIMB(0x8960FCA0, 0x2343CE47) };
+static const mbedtls_mpi_uint T_14_Y[] = { TRUSTED_KEY_LIMB(0x36C1D1C4, 0xA9B81D0B), TRUSTED_KEY_LIMB(0x5DEECA21, 0xAE2504AC), TRUSTED_KEY_LIMB(0xE42DE64D, 0xF6CA0D43), TRUSTED_KEY_LIMB(0xDCE52D93, 0x59AC2CCD) };
+static const mbedtls_mpi_uint T_15_X[] = { TRUSTED_KEY_LIMB(0x56B79F44, 0x924D6969), TRUSTED_KEY_LIMB(0x5ACE19F2, 0x861FEEE3), TRUSTED_KEY_LIMB(0x7468E5CF, 0xE3BB3885), TRUSTED_KEY_LIMB(0x1FA7DE62, 0x67375D7C) };
+static const mbedtls_mpi_uint T_15_Y[] = { TRUSTED_KEY_LIMB(0x4D941E34, 0x78275257), TRUSTED_KEY_LIMB(0x008A2BFC, 0x7C082F27), TRUSTED_KEY_LIMB(0xF2A53CF2, 0x2A92A534), TRUSTED_KEY_LIMB(0xB8034C0A, 0x445418FB) };
+
+static const mbedtls_ecp_point table[] = {
+    { TRUSTED_KEY_MPI(T_0_X), TRUSTED_KEY_MPI(T_0_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_1_X), TRUSTED_KEY_MPI(T_1_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_2_X), TRUSTED_KEY_MPI(T_2_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_3_X), TRUSTED_KEY_MPI(T_3_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_4_X), TRUSTED_KEY_MPI(T_4_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_5_X), TRUSTED_KEY_MPI(T_5_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_6_X), TRUSTED_KEY_MPI(T_6_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_7_X), TRUSTED_KEY_MPI(T_7_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_8_X), TRUSTED_KEY_MPI(T_8_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_9_X), TRUSTED_KEY_MPI(T_9_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_10_X), TRUSTED_KEY_MPI(T_10_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_11_X), TRUSTED_KEY_MPI(T_11_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_12_X), TRUSTED_KEY_MPI(T_12_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_13_X), TRUSTED_KEY_MPI(T_13_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_14_X), TRUSTED_KEY_MPI(T_14_Y), TRUSTED_KEY_MPI(one) },
+    { TRUSTED_KEY_MPI(T_15_X), TRUSTED_KEY_MPI(T_15_Y), TRUSTED_KEY_MPI(one) },
+};
+
+const mbedtls_ecp_group_id trusted_key_grp_id = MBEDTLS_ECP_DP_SECP256R1;
+const mbedtls_ecp_point *const trusted_key_table = table;
+const size_t trusted_key_table_len = sizeof(table) / sizeof(table[0]);
+const size_t trusted_key_table_size = sizeof(table) + sizeof(one) + 2 * (sizeof(table) / sizeof(table[0])) * sizeof(T_0_X);
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2022-2024 Francisco Llobet-Blandino and the "Miso Project".
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * trusted_key_table.h
+ *
+ * Fixed-point comb table of the trusted verification key (CONFIG.PUB), kept in flash.
+ *
+ * The table is generated at build time by `inv trusted-key-table` and linked with
+ * `zig build -Dtrusted_key_table=keys/trusted_key_table.c`. It has the layout of the
+ * static generator tables of mbedTLS: 2^(w - 1) normalized points for the window w
+ * that mbedTLS picks for a static table of the curve. Without a generated table,
+ * csrc/src/trusted_key_table.c provides none and pk.zig builds the table in RAM.
+ */
+
+#ifndef TRUSTED_KEY_TABLE_H_
+#define TRUSTED_KEY_TABLE_H_
+
+/* Same configuration as pk.zig, it allows the access to the point members */
+#ifndef MBEDTLS_CONFIG_FILE
+#define MBEDTLS_CONFIG_FILE "miso_mbedtls_config.h"
+#endif
+
+#include <mbedtls/ecp.h>
+#include <stddef.h>
+
+/* Curve of the table */
+extern const mbedtls_ecp_group_id trusted_key_grp_id;
+
+/* Table entries, the first one is the trusted key itself. NULL without a table. */
+extern const mbedtls_ecp_point *const trusted_key_table;
+
+/* Number of table entries */
+extern const size_t trusted_key_table_len;
+
+/* Flash taken by the table: points and limbs */
+extern const size_t trusted_key_table_size;
+
+#endif /* TRUSTED_KEY_TABLE_H_ */
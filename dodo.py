@@ -92,3 +92,20 @@ def task_verify_fw_images():
             "file_dep": [PUB_KEY, target_file_name],
             "verbosity": 2,
         }
+
+
+def task_compress_fw_images():
+    """Create compressed signed firmware images"""
+    list = [FW_DIR.joinpath(LWM2M_BIN), FW_DIR.joinpath(MQTT_BIN)]
+    for bin in list:
+        signed_file_name = SIG_FW_DIR.joinpath(bin.stem + "_sig.bin")
+        target_file_name = SIG_FW_DIR.joinpath(bin.stem + "_sig.mfwz")
+
+        yield {
+            "name": f"Compress {signed_file_name} firmware image.",
+            "actions": [f"{PYTHON_EXE} -m invoke compress-fw --image {signed_file_name} --out {target_file_name}"],
+            "file_dep": [signed_file_name],
+            "targets": [target_file_name],
+            "clean": True,
+            "verbosity": 2,
+        }
@@ -43,6 +43,7 @@ const c = @cImport({
 pub const enable_lwm2m = true;
 pub const enable_mqtt = false;
 pub const enable_http = true;
+pub const enable_tls13 = false;
 
 /// Export the NVM3 handle
 pub export const miso_nvm3_handle = &nvm.miso_nvm3;
@@ -43,6 +43,7 @@ const c = @cImport({
 pub const enable_lwm2m = false;
 pub const enable_mqtt = true;
 pub const enable_http = true;
+pub const enable_tls13 = true;
 
 /// Export the NVM3 handle
 pub export const miso_nvm3_handle = &nvm.miso_nvm3;
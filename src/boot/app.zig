@@ -9,7 +9,11 @@ const fatfs = @import("../fatfs.zig");
 const nvm = @import("../nvm.zig");
 const board = @import("microzig").board;
 const firmware = @import("firmware.zig");
+const staging = @import("staging.zig");
+const journal = @import("journal.zig");
+const backup = @import("backup.zig");
 const chips = @import("../chips.zig");
+const flash = @import("../flash.zig");
 
 const c = @cImport({
     @cInclude("board.h");
@@ -19,17 +23,19 @@ const c = @cImport({
 
 const app_start_addr: usize = chips.FLASH_BOOTLOADER_SIZE + 0x80;
 
-const firmware_update_outcome = enum {
+pub const firmware_update_outcome = enum {
     incomplete,
     success,
     backup_restore,
+    /// Neither the update nor the backup could be installed, nothing is retried
+    restore_failed,
 };
 
 fn prepareJump() noreturn {
     board.jumpToApp(app_start_addr);
 }
 
-const update_phase = enum(usize) {
+pub const update_phase = enum(usize) {
     check,
     backup,
     erase_flash,
@@ -48,65 +54,93 @@ const update_phase = enum(usize) {
 
 task: freertos.StaticTask(@This(), 2000, "bootApp", taskFunction),
 
-fn firmwareUpdate() !firmware_update_outcome {
-    return firmwareUpdateStateMachine(update_phase.check);
+/// Called with every phase the update enters, the host update benchmark times the phases with it
+pub var phase_observer: ?*const fn (phase: update_phase) void = null;
+
+/// Start or resume the update of the candidate on the SD card
+pub fn firmwareUpdate() !firmware_update_outcome {
+    return firmwareUpdateStateMachine(null);
 }
 
-fn firmwareRestore() !firmware_update_outcome {
+/// Restore the backup of the last update, as after an update that failed with an error
+pub fn firmwareRestore() !firmware_update_outcome {
     return firmwareUpdateStateMachine(update_phase.restore_backup);
 }
 
-fn checkFirmwareCandidate() !update_phase {
+fn checkFirmwareCandidate(signed: *firmware.signed_image) !update_phase {
     _ = c.printf("Checking firmware image\n");
 
-    try firmware.checkFirmwareImage(config.fw_file_name); // If this fails, we can't continue.
+    // Header and trailer only, an installed image is not read again
+    _ = firmware.precheckFirmwareImage(config.fw_file_name) catch |err| {
+        if (err == firmware.firmware_error.firmware_not_validated) {
+            // Flashed before a reset, but never validated: put back the image of the backup
+            _ = c.printf("Installed image not validated, restoring backup\n");
+            return update_phase.erase_flash_before_restore;
+        }
+        return err; // If this fails, we can't continue.
+    };
+
+    // Nothing is backed up or erased for an image that is not signed
+    _ = c.printf("Checking signature\n");
+    try firmware.verifyCandidate(config.fw_file_name, signed);
 
     return update_phase.backup; // next phase
 }
 
-fn performFirmwareBackup() !struct {
+/// Only the pages the candidate changes are backed up, see `backup`
+fn performFirmwareBackup(changes: *backup.header) !struct {
     phase: update_phase,
     backup_len: usize,
 } {
+    var backup_hash: [32]u8 = undefined;
     const fw_len = nvm.getFirmwareSize() catch 0;
 
     _ = c.printf("Backing up current image\n");
 
-    const backup_len = try firmware.backupFirmware(config.app_backup_file_name, if (fw_len != 0) fw_len else null);
+    // The backup file is hashed while it is written
+    const backup_len = try backup.create(config.fw_file_name, config.app_backup_file_name, if (fw_len != 0) fw_len else firmware.fw.len, changes, &backup_hash);
 
+    _ = c.printf("Backed up %u of %u pages\n", changes.stored, (changes.app_len + firmware.flash_page_size - 1) / firmware.flash_page_size);
     _ = c.printf("Verifying backup\n");
 
-    try firmware.verifyBackup(config.app_backup_file_name, backup_len);
+    try firmware.verifyFileHash(config.app_backup_file_name, &backup_hash);
 
     // If we fail here, we can loop for some time and try again to backup the firmware
     // The current logic would fail the whole process if the backup is not successful, which should be ok
     return .{ .phase = update_phase.erase_flash, .backup_len = backup_len };
 }
 
-fn eraseFlash(backup_len: usize) !update_phase {
-    _ = backup_len;
+/// Only the changed pages are erased
+fn eraseFlash(changes: *const backup.header) !update_phase {
     _ = c.printf("Erasing flash\n");
 
-    try firmware.eraseFlash(null);
+    try firmware.erasePages(&changes.changed);
     return update_phase.flash;
 }
 
-fn eraseFlashBeforeRestore(backup_len: usize) !update_phase {
-    _ = backup_len;
+fn eraseFlashBeforeRestore(changes: *const backup.header) !update_phase {
     // Erase flash
     _ = c.printf("Erasing flash\n");
 
-    try firmware.eraseFlash(null); // Erase flash ?
+    try firmware.erasePages(&changes.changed);
     return update_phase.restore_backup;
 }
 
-fn restoreBackup() !struct { phase: update_phase, app_len: usize } {
+fn restoreBackup(changes: *const backup.header, digest: *[32]u8) !struct { phase: update_phase, app_len: usize } {
     var app_len: usize = 0;
     var phase = update_phase.verify_backup;
 
     _ = c.printf("Restoring backup\n");
 
-    if (firmware.flashFirmware(config.app_backup_file_name, null)) |val| {
+    // The backup carries the SHA-256 of the complete application
+    digest.* = changes.app_digest;
+
+    // The update failed before any page was erased
+    if (firmware.verifyFlashHash(changes.app_len, digest)) |_| {
+        return .{ .phase = update_phase.backup_restored, .app_len = changes.app_len };
+    } else |_| {}
+
+    if (backup.restore(config.app_backup_file_name, changes)) |val| {
         app_len = val;
         phase = update_phase.verify_backup;
     } else |err| {
@@ -120,10 +154,12 @@ fn restoreBackup() !struct { phase: update_phase, app_len: usize } {
     return .{ .phase = phase, .app_len = app_len };
 }
 
-fn verifyImage(app_len: usize) !update_phase {
+/// The flash is compared with the hash of the signed candidate, the signature itself was checked
+/// before the flash was erased.
+fn verifyImage(app_len: usize, signed: *const firmware.signed_image) !update_phase {
     _ = c.printf("Verifying new image\n");
 
-    firmware.verifyBackup(config.fw_file_name, app_len) catch |err| {
+    firmware.verifyFlashedImage(app_len, signed) catch |err| {
         if (err == firmware.firmware_error.hash_compare_mismatch) {
             // go to erase flash
             return update_phase.erase_flash;
@@ -132,16 +168,16 @@ fn verifyImage(app_len: usize) !update_phase {
         }
     };
 
-    nvm.setFirmwareSize(app_len) catch {};
+    nvm.setFirmwareSize(@intCast(app_len)) catch {};
 
     return update_phase.complete;
 }
 
-fn verifyBackup(app_len: usize) !update_phase {
+fn verifyBackup(app_len: usize, digest: *const [32]u8) !update_phase {
     // Verify backup
     _ = c.printf("Verifying backup\n");
 
-    firmware.verifyBackup(config.app_backup_file_name, app_len) catch |err| {
+    firmware.verifyFlashHash(app_len, digest) catch |err| {
         if (err == firmware.firmware_error.hash_compare_mismatch) {
             // go to erase flash
             return update_phase.erase_flash_before_restore;
@@ -153,14 +189,14 @@ fn verifyBackup(app_len: usize) !update_phase {
     return update_phase.backup_restored;
 }
 
-fn flashImage() !struct {
+fn flashImage(image_id: u32, changes: *const backup.header, from: ?*const journal.record) !struct {
     phase: update_phase,
     app_len: usize,
 } {
     var app_len: usize = 0;
     var phase = update_phase.restore_backup;
 
-    if (firmware.flashFirmware(config.fw_file_name, null)) |val| {
+    if (firmware.flashFirmware(config.fw_file_name, image_id, &changes.changed, from)) |val| {
         app_len = val;
         phase = update_phase.verify_flash;
     } else |err| {
@@ -178,51 +214,153 @@ fn flashImage() !struct {
 
 const update_state = struct { phase: update_phase, app_len: usize, backup_len: usize };
 
+/// Record the step completed before entering `next`, so a reset resumes there
+fn journalStep(image_id: u32, next: update_phase, app_len: usize) void {
+    switch (next) {
+        // The erase has to be complete before anything is programmed
+        update_phase.erase_flash => journal.mark(image_id, .backed_up),
+        update_phase.flash => journal.mark(image_id, .erased),
+        update_phase.verify_flash => journal.markFlashed(image_id, app_len),
+        // A partially restored image is erased and restored again
+        update_phase.erase_flash_before_restore, update_phase.restore_backup => journal.mark(image_id, .restoring),
+        update_phase.complete, update_phase.backup_restored => journal.clear(),
+        else => {},
+    }
+}
+
 /// This function implements the firmware update state machine.
+/// Only the pages FW.BIN changes are backed up, erased and programmed, see `backup`.
+/// The signature of FW.BIN is checked before anything is erased, also when an update resumes after
+/// a reset. The programmed image is compared with the signed hash, the backup is hashed while it is
+/// written.
 /// It is responsible for checking the firmware image in the SD card,
 /// backing up the current image, erasing the flash, writing the new image,
 /// verifying the new image, and finally setting the new image size in the NVM.
 /// If any of the steps fail, the state machine will try to restore the backup.
+/// A failed write or verification programs the image again, up to `update_reflash_attempts` times.
 /// If the backup is not successful, the state machine will loop and try to backup the firmware again.
 /// If the backup is successful, the state machine will try to erase the flash and restore the backup.
 /// If the restore is successful, the state machine will try to verify the backup.
+/// The backup is restored at most `update_restore_attempts` times, and only over the application it
+/// was taken from. Otherwise the update ends with `restore_failed`.
 fn firmwareUpdateStateMachine(start_phase: ?update_phase) !firmware_update_outcome {
     var outcome = firmware_update_outcome.incomplete;
     var phase = start_phase orelse update_phase.check;
     var backup_len: usize = 0;
     var app_len: usize = 0;
+    // SHA-256 of the backed up application, while it is restored
+    var image_hash: [32]u8 = undefined;
+    // Candidate with a checked signature, checked again after a reset
+    var signed: firmware.signed_image = undefined;
+    var signed_loaded = false;
+    // Pages changed by the update, read from the backup file when not taken in this run
+    var changes: backup.header = undefined;
+    var changes_loaded = false;
+    // Times the image was programmed again
+    var reflash_attempts: u8 = 0;
+    // Times the backup was restored
+    var restore_attempts: u8 = 0;
+    var base_checked = false;
+
+    // The journal only applies to this candidate
+    const image_id = firmware.imageIdentity(config.fw_file_name) catch 0;
+    var resume_from: ?journal.record = null;
+
+    if (start_phase == null) {
+        if (journal.load(image_id)) |rec| {
+            _ = c.printf("Resuming firmware update\n");
+
+            phase = switch (rec.getStage()) {
+                .backed_up => update_phase.erase_flash,
+                .erased => update_phase.flash,
+                .flashing => blk: {
+                    resume_from = rec;
+                    break :blk update_phase.flash;
+                },
+                .flashed => blk: {
+                    app_len = rec.offset;
+                    break :blk update_phase.verify_flash;
+                },
+                .restoring => update_phase.erase_flash_before_restore,
+            };
+        }
+    }
 
     var state: update_state = .{ .phase = start_phase orelse update_phase.check, .app_len = 0, .backup_len = 0 };
     _ = state;
 
     while (true) {
-        phase = switch (phase) {
-            update_phase.check => try checkFirmwareCandidate(),
+        if (phase_observer) |observe| observe(phase);
+
+        switch (phase) {
+            update_phase.erase_flash, update_phase.flash, update_phase.verify_flash, update_phase.erase_flash_before_restore, update_phase.restore_backup => {
+                if (!changes_loaded) try backup.load(config.app_backup_file_name, &changes);
+                changes_loaded = true;
+            },
+            else => {},
+        }
+
+        switch (phase) {
+            update_phase.erase_flash_before_restore, update_phase.restore_backup => if (!base_checked) {
+                backup.checkBase(&changes) catch |err| {
+                    if (err != backup.backup_error.base_mismatch) return err;
+
+                    // A backup of another application, e.g. left from an earlier update
+                    _ = c.printf("Backup does not match the application, not restored\n");
+                    return firmware_update_outcome.restore_failed;
+                };
+                base_checked = true;
+            },
+            update_phase.erase_flash, update_phase.flash, update_phase.verify_flash => if (!signed_loaded) {
+                _ = c.printf("Checking signature\n");
+
+                firmware.verifyCandidate(config.fw_file_name, &signed) catch |err| {
+                    if (err != firmware.firmware_error.firmware_candidate_not_valid) return err;
+
+                    // FW.BIN changed since the update started, nothing of it is installed
+                    _ = c.printf("Invalid image, restoring backup\n");
+                    phase = update_phase.erase_flash_before_restore;
+                    continue;
+                };
+                signed_loaded = true;
+            },
+            else => {},
+        }
+
+        var next = switch (phase) {
+            update_phase.check => blk: {
+                const res = try checkFirmwareCandidate(&signed);
+
+                signed_loaded = (res == update_phase.backup);
+                break :blk res;
+            },
             update_phase.backup => blk: {
                 // Backup current image
-                const res = try performFirmwareBackup();
+                const res = try performFirmwareBackup(&changes);
 
+                changes_loaded = true;
                 backup_len = res.backup_len;
                 break :blk res.phase;
             },
-            update_phase.erase_flash => try eraseFlash(backup_len),
+            update_phase.erase_flash => try eraseFlash(&changes),
             update_phase.flash => blk: {
                 // Write new image
-                const res = try flashImage();
+                const res = try flashImage(image_id, &changes, if (resume_from) |*rec| rec else null);
 
+                resume_from = null;
                 app_len = res.app_len;
                 break :blk res.phase;
             },
-            update_phase.verify_flash => try verifyImage(app_len),
-            update_phase.erase_flash_before_restore => try eraseFlashBeforeRestore(backup_len),
+            update_phase.verify_flash => try verifyImage(app_len, &signed),
+            update_phase.erase_flash_before_restore => try eraseFlashBeforeRestore(&changes),
             update_phase.restore_backup => blk: {
                 // Restore backup
-                const res = try restoreBackup();
+                const res = try restoreBackup(&changes, &image_hash);
 
                 app_len = res.app_len;
                 break :blk res.phase;
             },
-            update_phase.verify_backup => try verifyBackup(app_len),
+            update_phase.verify_backup => try verifyBackup(app_len, &image_hash),
             update_phase.complete => {
                 return firmware_update_outcome.success;
             },
@@ -230,13 +368,64 @@ fn firmwareUpdateStateMachine(start_phase: ?update_phase) !firmware_update_outco
                 return firmware_update_outcome.backup_restore;
             },
         };
+
+        if ((next == update_phase.erase_flash) and (phase != update_phase.backup)) {
+            reflash_attempts += 1;
+
+            if (reflash_attempts > config.update_reflash_attempts) {
+                _ = c.printf("Programming failed, restoring backup\n");
+                next = update_phase.erase_flash_before_restore;
+            }
+        }
+
+        if (next == update_phase.erase_flash_before_restore) {
+            restore_attempts += 1;
+
+            if (restore_attempts > config.update_restore_attempts) {
+                _ = c.printf("Restoring the backup failed, giving up\n");
+                return firmware_update_outcome.restore_failed;
+            }
+        }
+
+        journalStep(image_id, next, app_len);
+        phase = next;
     }
 
     return outcome;
 }
 
+/// Install the image the application downloaded into the staging region.
+/// The SD card is not used. Until the install is verified the staged image is kept, so an
+/// interrupted install is repeated on the next boot.
+fn installStagedFirmware(len: usize) !void {
+    _ = c.printf("Checking staged image\n");
+
+    try firmware.verifyStagedFirmware(len);
+
+    _ = c.printf("Installing staged image\n");
+
+    const app_len = try firmware.installStagedFirmware(len);
+
+    nvm.setFirmwareSize(@intCast(app_len)) catch {};
+}
+
+/// The update and the backup both failed, later boots do not retry them
+/// The application is only started if the flash holds a signed image.
+fn updateFailed(self: *@This()) void {
+    journal.clear();
+    nvm.clearFirmwareValidators();
+    nvm.clearUpdateRequest() catch unreachable;
+
+    firmware.validateFlashedImage() catch {
+        _ = c.printf("No valid application, staying in the bootloader\n");
+        leds.red.on();
+        self.task.suspendTask();
+    };
+}
+
 fn taskFunction(self: *@This()) noreturn {
-    _ = self;
+    // The bootloader never rewrites itself
+    flash.lock(0, chips.FLASH_BOOTLOADER_SIZE);
 
     _ = nvm.init() catch 0;
 
@@ -244,7 +433,33 @@ fn taskFunction(self: *@This()) noreturn {
         _ = c.printf("Failed to load config from NVM\n");
     };
 
+    var staging_attempts: u8 = 0;
+
     while (nvm.isUpdateRequested() catch false) {
+        if (staging.pending()) |len| {
+            staging_attempts += 1;
+
+            if (installStagedFirmware(len)) |_| {
+                staging.clear();
+                nvm.clearUpdateRequest() catch unreachable;
+            } else |err| {
+                if ((err == firmware.firmware_error.firmware_candidate_not_valid) or (err == firmware.firmware_error.firmware_already_in_system)) {
+                    if (err == firmware.firmware_error.firmware_candidate_not_valid) nvm.clearFirmwareValidators();
+                    staging.clear();
+                    nvm.clearUpdateRequest() catch unreachable;
+                } else if (staging_attempts >= config.staging_install_attempts) {
+                    // Flash error that does not go away, drop the staged image and boot
+                    _ = c.printf("Staged install failed, giving up\n");
+                    nvm.clearFirmwareValidators();
+                    staging.clear();
+                    nvm.clearUpdateRequest() catch unreachable;
+                } else {
+                    // Flash error, repeat the install from the staged image
+                }
+            }
+            continue;
+        }
+
         fatfs.mount("SD") catch break;
         defer {
             fatfs.unmount("SD") catch {};
@@ -254,7 +469,10 @@ fn taskFunction(self: *@This()) noreturn {
             nvm.clearUpdateRequest() catch unreachable;
             if (val == firmware_update_outcome.backup_restore) {
                 // Firmware update failed, but backup was restored
-                // Try to boot the app
+                // Try to boot the app, the image is downloaded again
+                nvm.clearFirmwareValidators();
+            } else if (val == firmware_update_outcome.restore_failed) {
+                self.updateFailed();
             } else {
                 // Happy path
             }
@@ -262,16 +480,21 @@ fn taskFunction(self: *@This()) noreturn {
             if (err == firmware.firmware_error.firmware_candidate_not_valid) {
                 // Do nothing
                 // Invalid candidate
+                journal.clear();
+                nvm.clearFirmwareValidators();
                 nvm.clearUpdateRequest() catch unreachable;
             } else if (err == firmware.firmware_error.firmware_already_in_system) {
                 // Do nothing
                 _ = c.printf("Firmware already in system\n");
                 nvm.clearUpdateRequest() catch unreachable;
             } else {
-                if (firmwareRestore()) |_| {
+                nvm.clearFirmwareValidators();
+                if (firmwareRestore()) |val| {
                     nvm.clearUpdateRequest() catch unreachable;
+                    if (val == firmware_update_outcome.restore_failed) self.updateFailed();
                 } else |_| {
-                    // error case
+                    // Give up instead of restoring again on every boot
+                    self.updateFailed();
                 }
             }
         }
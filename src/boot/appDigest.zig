@@ -0,0 +1,83 @@
+//! Cached SHA-256 of the installed application
+//!
+//! Hashing up to the whole application flash in software is the slowest part of checking and
+//! installing an update. The digest of the application is kept in NVM (`app_digest`), keyed by the
+//! image header in flash (version and sizes) and the number of bytes hashed. Everything that erases
+//! or programs the application flash drops the cached digest first and is not done if that fails,
+//! so a cached digest always describes the current flash.
+const std = @import("std");
+const config = @import("../config.zig");
+const nvm = @import("../nvm.zig");
+const firmware = @import("firmware.zig");
+
+const record = extern struct {
+    /// Layout marker
+    magic: u32,
+    /// Bytes hashed
+    len: u32,
+    /// Image header in flash when the digest was taken
+    header: [@sizeOf(firmware.image_header)]u8,
+    /// SHA-256 of the first `len` bytes of the application
+    digest: [32]u8,
+
+    const magic_value: u32 = 0x47444141; // "AADG"
+
+    comptime {
+        if (@sizeOf(@This()) > nvm.max_object_size) @compileError("Application digest exceeds the NVM object size");
+    }
+};
+
+pub const app_digest_error = error{
+    digest_not_dropped,
+};
+
+/// The cached digest is known to be gone
+var dropped = false;
+
+/// SHA-256 of the first `len` bytes of the application
+/// Taken from the cache if it matches the flash, otherwise computed and cached.
+pub fn get(len: usize, digest: *[32]u8) ![]u8 {
+    var rec: record = undefined;
+
+    const data = nvm.readData(.app_digest, std.mem.asBytes(&rec)) catch null;
+
+    if ((data != null) and (data.?.len == @sizeOf(record)) and (rec.magic == record.magic_value) and (rec.len == len) and std.mem.eql(u8, &rec.header, firmware.fw[0..@sizeOf(firmware.image_header)])) {
+        digest.* = rec.digest;
+        return digest;
+    }
+
+    _ = try config.calculateMemHash(firmware.fw[0..len], digest);
+
+    store(len, digest);
+
+    return digest;
+}
+
+/// Cache the digest of the first `len` bytes of the application
+pub fn store(len: usize, digest: *const [32]u8) void {
+    var rec = std.mem.zeroes(record);
+
+    rec.magic = record.magic_value;
+    rec.len = @intCast(len);
+    @memcpy(&rec.header, firmware.fw[0..@sizeOf(firmware.image_header)]);
+    rec.digest = digest.*;
+
+    nvm.writeData(.app_digest, std.mem.asBytes(&rec)) catch return;
+
+    dropped = false;
+}
+
+/// Drop the cached digest before the application flash is modified
+/// Returns `digest_not_dropped` if the digest is still in NVM, the flash must not be modified then.
+pub fn invalidate() !void {
+    var rec: record = undefined;
+
+    if (dropped) return;
+
+    nvm.deleteObject(.app_digest) catch {};
+
+    // Deleting a missing object fails as well, so check that it is gone
+    if (nvm.readData(.app_digest, std.mem.asBytes(&rec))) |_| return app_digest_error.digest_not_dropped else |_| {}
+
+    dropped = true;
+}
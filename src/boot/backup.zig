@@ -0,0 +1,266 @@
+//! Differential application backup
+//!
+//! Before an update, the bootloader compares every flash page with the same page of the candidate
+//! image, padded with 0xFF. Only the pages that differ are copied to the backup file, erased and
+//! programmed. Pages the new image leaves identical are not touched at all.
+//!
+//! The backup file starts with a `header` sector holding the map of changed pages, followed by the
+//! stored pages in ascending order. Changed pages beyond the end of the old application hold no
+//! data, they are only erased on restore.
+//!
+//! A restore only brings back the changed pages, the others have to be those of the application the
+//! backup was taken from. The header keeps the SHA-256 of these pages, `checkBase` compares it with
+//! the flash before a restore.
+const std = @import("std");
+const sha256 = @import("../sha256.zig");
+const fatfs = @import("../fatfs.zig");
+const chips = @import("../chips.zig");
+const firmware = @import("firmware.zig");
+const candidate = @import("candidate.zig");
+const appDigest = @import("appDigest.zig");
+
+const page_size = firmware.flash_page_size;
+
+/// Number of flash pages of the application area
+pub const page_count: usize = (chips.FLASH_APP_SIZE + page_size - 1) / page_size;
+
+/// Offset of the first stored page in the backup file, sector aligned for raw transfers
+const data_offset: usize = fatfs.sector_size;
+
+pub const backup_error = error{
+    /// The backup file is missing its header or does not match it
+    backup_not_valid,
+    /// The pages kept in flash are not those of the application the backup was taken from
+    base_mismatch,
+};
+
+/// Set of application flash pages
+pub const pageMap = extern struct {
+    bits: [(page_count + 7) / 8]u8,
+
+    pub fn isSet(self: *const @This(), page: usize) bool {
+        return 0 != (self.bits[page / 8] & (@as(u8, 1) << @intCast(page % 8)));
+    }
+
+    fn set(self: *@This(), page: usize) void {
+        self.bits[page / 8] |= (@as(u8, 1) << @intCast(page % 8));
+    }
+};
+
+/// First sector of the backup file
+pub const header = extern struct {
+    /// Layout marker
+    magic: u32,
+    /// Size of the backed up application
+    app_len: u32,
+    /// Size of the image the backup was taken for
+    image_len: u32,
+    /// Number of pages stored after the header
+    stored: u32,
+    /// SHA-256 of the backed up application
+    app_digest: [32]u8,
+    /// SHA-256 of the application pages the update leaves unchanged
+    base_digest: [32]u8,
+    /// Pages changed by the update
+    changed: pageMap,
+
+    const magic_value: u32 = 0x324B4244; // "DBK2"
+
+    comptime {
+        if (@sizeOf(@This()) > data_offset) @compileError("Backup header exceeds the first sector");
+    }
+
+    /// The page holds application data kept in the backup
+    pub fn isStored(self: *const @This(), page: usize) bool {
+        return self.changed.isSet(page) and ((page * page_size) < self.app_len);
+    }
+
+    /// Bytes stored for the page, the last application page may be partial
+    fn storedLen(self: *const @This(), page: usize) usize {
+        return @min(page_size, self.app_len - (page * page_size));
+    }
+
+    /// Bytes stored after the header
+    pub fn storedSize(self: *const @This()) usize {
+        var len: usize = 0;
+
+        for (0..page_count) |page| {
+            if (self.isStored(page)) len += self.storedLen(page);
+        }
+
+        return len;
+    }
+};
+
+/// Marks the pages the candidate changes
+const planning = struct {
+    hdr: *header,
+
+    fn page(context: *anyopaque, pos: usize, data: []u8) anyerror!void {
+        const self: *@This() = @ptrCast(@alignCast(context));
+
+        @memset(firmware.scratch_area[data.len..], 0xFF);
+        self.compare(pos, &firmware.scratch_area);
+    }
+
+    fn compare(self: *@This(), pos: usize, content: []const u8) void {
+        if (!std.mem.eql(u8, content, firmware.fw[pos..(pos + page_size)])) {
+            self.hdr.changed.set(pos / page_size);
+            if (pos < self.hdr.app_len) self.hdr.stored += 1;
+        }
+    }
+};
+
+/// Find the pages of the first `app_len` bytes of flash the image at `image_path` changes
+/// A compressed image is compared as it is inflated.
+fn plan(image_path: [*:0]const u8, app_len: usize, hdr: *header) !void {
+    var state = planning{ .hdr = hdr };
+
+    hdr.* = std.mem.zeroes(header);
+    hdr.magic = header.magic_value;
+    hdr.app_len = @intCast(app_len);
+
+    _ = try appDigest.get(app_len, &hdr.app_digest);
+
+    const image_len = try candidate.stream(image_path, 0, .{ .page = planning.page, .context = &state });
+
+    hdr.image_len = @intCast(image_len);
+
+    // Flash beyond the image is erased by the update
+    @memset(firmware.scratch_area[0..], 0xFF);
+
+    var pos = std.mem.alignForward(usize, image_len, page_size);
+    while (pos < app_len) : (pos += page_size) {
+        state.compare(pos, &firmware.scratch_area);
+    }
+
+    try baseDigest(hdr, &hdr.base_digest);
+}
+
+/// SHA-256 of the first `app_len` bytes of flash without the changed pages
+fn baseDigest(hdr: *const header, digest: *[32]u8) !void {
+    var hasher = sha256.init();
+    defer hasher.free();
+
+    try hasher.start();
+
+    var pos: usize = 0;
+    while (pos < hdr.app_len) : (pos += page_size) {
+        if (hdr.changed.isSet(pos / page_size)) continue;
+
+        try hasher.update(firmware.fw[pos..@min(pos + page_size, hdr.app_len)]);
+    }
+
+    try hasher.finish(digest);
+}
+
+/// Check that the unchanged pages still belong to the application the backup was taken from
+/// Restoring the backup over another application would mix the two, `base_mismatch` is returned.
+pub fn checkBase(hdr: *const header) !void {
+    var digest: [32]u8 = undefined;
+
+    try baseDigest(hdr, &digest);
+
+    if (!std.mem.eql(u8, &digest, &hdr.base_digest)) return backup_error.base_mismatch;
+}
+
+fn emit(backup: *fatfs.file, raw: bool, pos: usize, data: []u8, hasher: *sha256) !void {
+    try hasher.update(data);
+
+    if (raw) return backup.writeRaw(pos, data);
+
+    var rem = data;
+    while (rem.len != 0) {
+        const wb = try backup.write(rem);
+        if (wb == 0) return fatfs.frError.FR_DENIED; // Volume full
+
+        rem = rem[wb..];
+    }
+}
+
+/// Back up the application pages the image at `image_path` changes
+/// `app_len` is the size of the installed application. The map of changed pages is returned in
+/// `hdr` and the SHA-256 of the backup file in `digest`.
+/// Returns the size of the backup file
+pub fn create(image_path: [*:0]const u8, backup_path: [*:0]const u8, app_len: usize, hdr: *header, digest: *[32]u8) !usize {
+    var first: [data_offset]u8 = [_]u8{0} ** data_offset;
+
+    try plan(image_path, app_len, hdr);
+
+    @memcpy(first[0..@sizeOf(header)], std.mem.asBytes(hdr));
+
+    var backup = try fatfs.file.open(backup_path, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+    defer {
+        backup.close() catch {};
+    }
+
+    var hasher = sha256.init();
+    defer hasher.free();
+    try hasher.start();
+
+    // A contiguous backup is written as raw sectors, the FAT is only updated at open and close
+    const raw = if (backup.preallocate(data_offset + hdr.storedSize())) |_| true else |_| false;
+
+    try emit(&backup, raw, 0, &first, &hasher);
+
+    var pos: usize = data_offset;
+    for (0..page_count) |page| {
+        if (!hdr.isStored(page)) continue;
+
+        const data = firmware.fw[(page * page_size)..][0..hdr.storedLen(page)];
+
+        try emit(&backup, raw, pos, data, &hasher);
+        pos += data.len;
+    }
+
+    try hasher.finish(digest);
+    try backup.sync();
+
+    return backup.size();
+}
+
+/// Read the map of changed pages from the backup file
+pub fn load(backup_path: [*:0]const u8, hdr: *header) !void {
+    var backup = try fatfs.file.open(backup_path, @intFromEnum(fatfs.file.fMode.read));
+    defer {
+        backup.close() catch {};
+    }
+
+    if (@sizeOf(header) != (try backup.read(std.mem.asBytes(hdr))).len) return backup_error.backup_not_valid;
+
+    if ((hdr.magic != header.magic_value) or (hdr.app_len > firmware.fw.len) or (hdr.image_len > firmware.fw.len)) {
+        return backup_error.backup_not_valid;
+    }
+
+    if (backup.size() != (data_offset + hdr.storedSize())) return backup_error.backup_not_valid;
+}
+
+/// Program the stored pages back into the flash
+/// The changed pages have to be erased before.
+/// Returns the size of the restored application
+pub fn restore(backup_path: [*:0]const u8, hdr: *const header) !usize {
+    const buf = firmware.scratch_area[0..];
+
+    var backup = try fatfs.file.open(backup_path, @intFromEnum(fatfs.file.fMode.read));
+    defer {
+        backup.close() catch {};
+    }
+
+    if (backup.extent == null) try backup.lseek(data_offset);
+
+    var pos: usize = data_offset;
+    for (0..page_count) |page| {
+        if (!hdr.isStored(page)) continue;
+
+        const len = hdr.storedLen(page);
+        const data = if (backup.extent != null) try backup.readRaw(pos, buf[0..len]) else try backup.read(buf[0..len]);
+        if (data.len != len) return backup_error.backup_not_valid;
+
+        @memset(buf[len..], 0xFF);
+
+        try firmware.programPage(page * page_size, buf);
+        pos += len;
+    }
+
+    return hdr.app_len;
+}
@@ -0,0 +1,159 @@
+//! Firmware candidate on the SD card
+//!
+//! FW.BIN holds either a signed image or a compressed container: a `container` header followed by
+//! the zlib stream of the signed image. The stream is inflated with a window of
+//! `config.fw_inflate_window_bits`, so the image has to be compressed with a window of at most that
+//! size. Containers are created with `invoke compress-fw`.
+//!
+//! Both kinds are delivered page by page through the flash scratch area. The signature covers the
+//! decompressed image and is checked on the stream before the flash is erased, see
+//! `firmware.verifyCandidate`.
+const std = @import("std");
+const config = @import("../config.zig");
+const fatfs = @import("../fatfs.zig");
+const inflate = @import("../inflate.zig");
+const firmware = @import("firmware.zig");
+
+const page_size = firmware.flash_page_size;
+
+pub const candidate_error = error{
+    /// The decompressed image does not have the size given in the container
+    image_size_mismatch,
+};
+
+/// Header of a compressed candidate
+pub const container = extern struct {
+    /// Layout marker
+    magic: u32,
+    /// Size of the decompressed image
+    image_len: u32,
+
+    const magic_value: u32 = 0x5A57464D; // "MFWZ"
+};
+
+/// Receives the image one page at a time
+/// `data` lies in the flash scratch area. Only the last page of the image is shorter than a page.
+pub const pageHandler = struct {
+    page: *const fn (context: *anyopaque, pos: usize, data: []u8) anyerror!void,
+    context: *anyopaque,
+};
+
+/// Compressed input, read from the file a sector at a time
+const fileSource = struct {
+    file: *fatfs.file,
+    buffer: [fatfs.sector_size]u8,
+
+    pub fn next(self: *@This()) !?[]const u8 {
+        const data = try self.file.read(&self.buffer);
+
+        return if (data.len == 0) null else data;
+    }
+};
+
+/// Collects the inflated output into pages
+const pageSink = struct {
+    handler: pageHandler,
+    /// Image position of the page being filled
+    pos: usize,
+    /// Bytes of the page being filled
+    fill: usize,
+    /// Pages before this position are dropped
+    skip: usize,
+    /// Size announced by the container
+    image_len: usize,
+
+    pub fn write(self: *@This(), data: []const u8) !void {
+        var rem = data;
+
+        if ((self.pos + self.fill + data.len) > self.image_len) return candidate_error.image_size_mismatch;
+
+        while (rem.len != 0) {
+            const len = @min(rem.len, page_size - self.fill);
+
+            if (self.pos >= self.skip) {
+                @memcpy(firmware.scratch_area[self.fill..(self.fill + len)], rem[0..len]);
+            }
+
+            self.fill += len;
+            rem = rem[len..];
+
+            if (self.fill == page_size) try self.emit();
+        }
+    }
+
+    fn emit(self: *@This()) !void {
+        if ((self.fill != 0) and (self.pos >= self.skip)) {
+            try self.handler.page(self.handler.context, self.pos, firmware.scratch_area[0..self.fill]);
+        }
+
+        self.pos += self.fill;
+        self.fill = 0;
+    }
+};
+
+var source: fileSource = undefined;
+var inflater: inflate.Inflater(config.fw_inflate_window_bits, fileSource, pageSink) = .{};
+
+/// Read the container header at the start of `file`, null for a plain image
+pub fn readContainer(file: *fatfs.file) !?container {
+    var hdr: container = undefined;
+
+    try file.rewind();
+
+    const data = try file.read(std.mem.asBytes(&hdr));
+
+    return if ((data.len == @sizeOf(container)) and (hdr.magic == container.magic_value)) hdr else null;
+}
+
+/// The candidate in `path` is a compressed container
+pub fn isCompressed(path: [*:0]const u8) !bool {
+    var file = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.read));
+    defer {
+        file.close() catch {};
+    }
+
+    return (null != try readContainer(&file));
+}
+
+/// Stream the image in `path` to `handler`, starting at the page aligned position `from`
+/// A compressed image is inflated from its start, the pages before `from` are dropped.
+/// Returns the size of the image
+pub fn stream(path: [*:0]const u8, from: usize, handler: pageHandler) !usize {
+    var file = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.read));
+    defer {
+        file.close() catch {};
+    }
+
+    if (try readContainer(&file)) |hdr| {
+        if (hdr.image_len > firmware.fw.len) return firmware.firmware_error.flash_firmware_size_error;
+        if (from > hdr.image_len) return firmware.firmware_error.flash_firmware_size_error;
+
+        var sink = pageSink{ .handler = handler, .pos = 0, .fill = 0, .skip = from, .image_len = hdr.image_len };
+
+        source.file = &file;
+        inflater.init(&source, &sink);
+        try inflater.run();
+        try sink.emit();
+
+        if (sink.pos != hdr.image_len) return candidate_error.image_size_mismatch;
+
+        return hdr.image_len;
+    }
+
+    const len = file.size();
+    if ((len > firmware.fw.len) or (from > len)) return firmware.firmware_error.flash_firmware_size_error;
+
+    if (file.extent == null) try file.lseek(from);
+
+    var pos = from;
+    while (pos < len) {
+        // Contiguous images are read as raw sectors
+        const data = if (file.extent != null) try file.readRaw(pos, firmware.scratch_area[0..]) else try file.read(firmware.scratch_area[0..]);
+        if (data.len == 0) break;
+
+        try handler.page(handler.context, pos, data);
+        pos += data.len;
+    }
+
+    return len;
+}
@@ -7,6 +7,12 @@ const config = @import("../config.zig");
 const fatfs = @import("../fatfs.zig");
 const freertos = @import("../freertos.zig");
 const chips = @import("../chips.zig");
+const staging = @import("staging.zig");
+const journal = @import("journal.zig");
+const backup = @import("backup.zig");
+const candidate = @import("candidate.zig");
+const appDigest = @import("appDigest.zig");
+const flash = @import("../flash.zig");
 const c = @cImport({
     @cInclude("board.h");
     @cInclude("miso_config.h");
@@ -17,13 +23,16 @@ const c = @cImport({
 
 const firmware_start_address: usize = chips.FLASH_BOOTLOADER_SIZE;
 const firmware_max_size: usize = chips.FLASH_APP_SIZE;
-const flash_page_size: usize = 4096;
+pub const flash_page_size: usize = flash.page_size;
 const flash_page_addr_mask: usize = @intCast(~@as(u32, flash_page_size - 1)); // 0xFFFFF000
-const sd_page_size: usize = 512;
+
+/// mcuboot flash area device ID of the application flash
+const app_device_id: u8 = 1;
 
 pub const firmware_error = error{
     firmware_already_in_system,
     firmware_candidate_not_valid,
+    firmware_not_validated,
     hash_compare_mismatch,
     flash_erase_error,
     flash_write_error,
@@ -31,10 +40,10 @@ pub const firmware_error = error{
 };
 
 /// Describes the entire firmware image as a byte-slice
-const fw: []u8 = @as([*]u8, @ptrFromInt(firmware_start_address))[0..firmware_max_size];
+pub const fw: []u8 = flash.region(firmware_start_address, firmware_max_size);
 
-/// Scratch area for reading from the SD card
-var scratch_area: [flash_page_size]u8 = undefined;
+/// Scratch area for reading from the SD card, shared by the update steps
+pub var scratch_area: [flash_page_size]u8 = undefined;
 
 fn checkFirmwareCandidateSize(path: [*:0]const u8, app_len: ?usize) !usize {
     const app_fw = fw[0..(app_len orelse fw.len)];
@@ -67,12 +76,76 @@ pub fn verifyFirmware(path: [*:0]const u8) !void {
     try bootutil_img_validate(null, 0, &hdr, &fa_p, temp_buf.ptr, temp_buf.len, null, 0, null);
 }
 
+/// Check the signature of the image in the staging region
+///
+/// Error Cases:
+/// - If the staged image equals the installed one, `firmware_already_in_system` is returned
+/// - If the signature verification fails, `firmware_candidate_not_valid` is returned
+pub fn verifyStagedFirmware(len: usize) !void {
+    var hdr: image_header = undefined;
+    var staged_hash: [32]u8 = undefined;
+    var app_hash: [32]u8 = undefined;
+
+    if (len > fw.len) return firmware_error.flash_firmware_size_error;
+
+    if (std.mem.eql(u8, try config.calculateMemHash(staging.region[0..len], &staged_hash), try appDigest.get(len, &app_hash))) {
+        return firmware_error.firmware_already_in_system;
+    }
+
+    load_global_public_key();
+
+    var fa_p: flash_area = .{ .fa_id = 0, .fa_device_id = staging.device_id, .pad16 = 0, .fa_off = 0, .fa_size = @intCast(staging.region.len), .fp = null };
+
+    boot_image_load_header(&fa_p, &hdr) catch return firmware_error.firmware_candidate_not_valid;
+
+    var temp_buf = try freertos.allocator.alloc(u8, @as(usize, 512));
+    defer freertos.allocator.free(temp_buf);
+
+    bootutil_img_validate(null, 0, &hdr, &fa_p, temp_buf.ptr, temp_buf.len, null, 0, null) catch return firmware_error.firmware_candidate_not_valid;
+}
+
+/// Copy the staged image over the application
+/// Returns the size of the installed image
+pub fn installStagedFirmware(len: usize) !usize {
+    var staged_hash: [32]u8 = undefined;
+    var app_hash: [32]u8 = undefined;
+
+    if (len > fw.len) return firmware_error.flash_firmware_size_error;
+
+    try eraseFlash(null);
+
+    // Flash is copied through RAM
+    var current_pos: usize = 0;
+    while (current_pos < len) {
+        const end_pos: usize = @min(current_pos + scratch_area.len, len);
+
+        @memcpy(scratch_area[0..(end_pos - current_pos)], staging.region[current_pos..end_pos]);
+        @memset(scratch_area[(end_pos - current_pos)..], 0xFF);
+
+        flash.writeWords(fw[current_pos..].ptr, &scratch_area) catch return firmware_error.flash_write_error;
+
+        current_pos = end_pos;
+    }
+
+    if (!std.mem.eql(u8, try config.calculateMemHash(staging.region[0..len], &staged_hash), try appDigest.get(len, &app_hash))) {
+        return firmware_error.hash_compare_mismatch;
+    }
+
+    return len;
+}
+
 /// Check the firmware image signature
 ///
 /// Error Cases:
 /// - If the file size is larger than the allowed firmware size, then `flash_firmware_size_error` is returned
 /// - If the signature verification fails, the process will be aborted and `firmware_candidate_not_valid` is returned
 pub fn checkFirmwareImage(path: [*:0]const u8) !void {
+    // The signature of a compressed image is checked by the bootloader, which inflates it anyway
+    if (try candidate.isCompressed(path)) {
+        _ = try precheckFirmwareImage(path);
+        return;
+    }
+
     const cand_len = try checkFirmwareCandidateSize(path, null); // Either the file is not open-able or the size is too large
 
     if (verifyBackup(path, cand_len)) |_| {
@@ -89,29 +162,255 @@ pub fn checkFirmwareImage(path: [*:0]const u8) !void {
     }
 }
 
-/// Perform the firmware backup
-/// Returns the size of the backup length
-pub fn backupFirmware(path: [*:0]const u8, app_len: ?usize) !usize {
-    const app_fw = fw[0..(app_len orelse fw.len)];
+/// Check whether a firmware candidate is already installed, reading only its header and TLV trailer
+///
+/// The trailer holds the SHA-256 of header and payload, so an image with the same header and
+/// trailer as the application is already installed. The signature of a new image is checked with
+/// `verifyCandidate` before anything is erased.
+/// A matching image is only reported as installed once its signature in flash checks out,
+/// otherwise `firmware_not_validated` is returned: the install was interrupted before the check.
+/// A compressed candidate is inflated once and compared with the flash. Any failure to inflate it
+/// returns `firmware_candidate_not_valid`.
+/// Returns the size of the candidate.
+pub fn precheckFirmwareImage(path: [*:0]const u8) !usize {
+    var hdr: image_header = undefined;
 
-    var backup = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+    if (try candidate.isCompressed(path)) {
+        var cmp = comparing{ .valid = false, .equal = true };
+
+        const len = candidate.stream(path, 0, .{ .page = comparing.page, .context = &cmp }) catch return firmware_error.firmware_candidate_not_valid;
+
+        if (!cmp.valid) return firmware_error.firmware_candidate_not_valid;
+
+        if (!cmp.equal) return len;
+
+        validateFlashedImage() catch return firmware_error.firmware_not_validated;
+        return firmware_error.firmware_already_in_system;
+    }
+
+    var file = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.read));
     defer {
-        backup.close() catch {};
+        file.close() catch {};
+    }
+
+    const len = file.size();
+    if (len > fw.len) return firmware_error.flash_firmware_size_error;
+
+    if (@sizeOf(image_header) != (try file.read(std.mem.asBytes(&hdr))).len) return firmware_error.firmware_candidate_not_valid;
+    if (hdr.ih_magic != c.IMAGE_MAGIC) return firmware_error.firmware_candidate_not_valid;
+
+    const tlv_start = @as(usize, hdr.ih_hdr_size) + hdr.ih_img_size;
+    if (tlv_start >= len) return firmware_error.firmware_candidate_not_valid;
+
+    if (!std.mem.eql(u8, std.mem.asBytes(&hdr), fw[0..@sizeOf(image_header)])) return len;
+
+    try file.lseek(tlv_start);
+
+    var pos = tlv_start;
+    while (pos < len) {
+        const data = try file.read(scratch_area[0..@min(scratch_area.len, len - pos)]);
+        if (data.len == 0) return firmware_error.firmware_candidate_not_valid;
+
+        if (!std.mem.eql(u8, data, fw[pos..(pos + data.len)])) return len;
+        pos += data.len;
+    }
+
+    validateFlashedImage() catch return firmware_error.firmware_not_validated;
+    return firmware_error.firmware_already_in_system;
+}
+
+/// Compares an inflated candidate with the flash
+const comparing = struct {
+    /// The image starts with an image header
+    valid: bool,
+    /// Every page so far equals the flash
+    equal: bool,
+
+    fn page(context: *anyopaque, pos: usize, data: []u8) anyerror!void {
+        const self: *@This() = @ptrCast(@alignCast(context));
+
+        if (pos == 0) {
+            var hdr: image_header = undefined;
+
+            if (data.len < @sizeOf(image_header)) return firmware_error.firmware_candidate_not_valid;
+
+            @memcpy(std.mem.asBytes(&hdr), data[0..@sizeOf(image_header)]);
+            self.valid = (hdr.ih_magic == c.IMAGE_MAGIC);
+        }
+
+        if (!std.mem.eql(u8, data, fw[pos..(pos + data.len)])) self.equal = false;
+    }
+};
+
+/// Room for the unprotected TLVs of a candidate: SHA-256, public key and signature
+const trailer_capacity = 512;
+
+/// mcuboot TLVs checked by `verifyCandidate`, see bootutil/image.h
+const tlv_info_magic: u16 = 0x6907;
+const tlv_pubkey: u16 = 0x02;
+const tlv_sha256: u16 = 0x10;
+const tlv_ecdsa_sig: u16 = 0x22;
+
+/// Signed candidate, taken by `verifyCandidate` and checked against the flash by `verifyFlashedImage`
+pub const signed_image = struct {
+    /// Size of the image with its TLVs
+    len: usize,
+    /// Header, payload and protected TLVs, the part covered by the signature
+    signed_len: usize,
+    /// SHA-256 of the signed part
+    hash: [32]u8,
+    /// Unprotected TLVs
+    trailer: [trailer_capacity]u8,
+};
+
+/// Hashes the signed part of a candidate and keeps its unprotected TLVs
+const signing = struct {
+    image: *signed_image,
+    hasher: sha256,
+
+    fn page(context: *anyopaque, pos: usize, data: []u8) anyerror!void {
+        const self: *@This() = @ptrCast(@alignCast(context));
+        const image = self.image;
+
+        if (pos == 0) {
+            if (data.len < @sizeOf(image_header)) return firmware_error.firmware_candidate_not_valid;
+
+            const hdr = std.mem.bytesToValue(image_header, data[0..@sizeOf(image_header)]);
+            if (hdr.ih_magic != c.IMAGE_MAGIC) return firmware_error.firmware_candidate_not_valid;
+
+            image.signed_len = @as(usize, hdr.ih_hdr_size) + hdr.ih_img_size + hdr.ih_protect_tlv_size;
+        }
+
+        const end = pos + data.len;
+
+        if (pos < image.signed_len) {
+            try self.hasher.update(data[0..(@min(end, image.signed_len) - pos)]);
+        }
+
+        if (end > image.signed_len) {
+            const start = @max(pos, image.signed_len);
+
+            if ((end - image.signed_len) > image.trailer.len) return firmware_error.firmware_candidate_not_valid;
+
+            @memcpy(image.trailer[(start - image.signed_len)..(end - image.signed_len)], data[(start - pos)..]);
+        }
+    }
+};
+
+/// Check the signature of a candidate on the SD card before anything is erased
+///
+/// The candidate is streamed once, a compressed one is inflated on the way. Header, payload and
+/// protected TLVs are hashed, the hash has to match the SHA-256 TLV, the public key TLV has to be
+/// the provisioned key and the ECDSA signature TLV has to verify over the hash, as
+/// bootutil_img_validate checks them. Once the image is programmed, `verifyFlashedImage` compares
+/// the flash with the hash taken here, so the image is hashed only once more.
+/// Any failure to read, inflate or verify the candidate returns `firmware_candidate_not_valid`.
+pub fn verifyCandidate(path: [*:0]const u8, image: *signed_image) !void {
+    var state = signing{ .image = image, .hasher = sha256.init() };
+    defer state.hasher.free();
+
+    try state.hasher.start();
+
+    image.signed_len = 0;
+    image.len = candidate.stream(path, 0, .{ .page = signing.page, .context = &state }) catch return firmware_error.firmware_candidate_not_valid;
+
+    if (image.len <= image.signed_len) return firmware_error.firmware_candidate_not_valid;
+
+    try state.hasher.finish(&image.hash);
+
+    const trailer = image.trailer[0..(image.len - image.signed_len)];
+    if ((trailer.len < 4) or (std.mem.readIntLittle(u16, trailer[0..2]) != tlv_info_magic)) return firmware_error.firmware_candidate_not_valid;
+
+    const tlv_tot = std.mem.readIntLittle(u16, trailer[2..4]);
+    if (tlv_tot > trailer.len) return firmware_error.firmware_candidate_not_valid;
+
+    load_global_public_key();
+
+    var hash_ok = false;
+    var key_ok = false;
+    var sig: ?[]const u8 = null;
+
+    var pos: usize = 4;
+    while ((pos + 4) <= tlv_tot) {
+        const tlv_type = std.mem.readIntLittle(u16, trailer[pos..][0..2]);
+        const tlv_len = std.mem.readIntLittle(u16, trailer[(pos + 2)..][0..2]);
+
+        pos += 4;
+        if ((pos + tlv_len) > tlv_tot) return firmware_error.firmware_candidate_not_valid;
+
+        const value = trailer[pos..(pos + tlv_len)];
+
+        switch (tlv_type) {
+            tlv_sha256 => hash_ok = std.mem.eql(u8, value, &image.hash),
+            tlv_pubkey => key_ok = std.mem.eql(u8, value, pub_key[0..pub_key_len]),
+            tlv_ecdsa_sig => sig = value,
+            else => {},
+        }
+
+        pos += tlv_len;
     }
 
-    try backup.sync();
+    if (!hash_ok or !key_ok or (sig == null)) return firmware_error.firmware_candidate_not_valid;
 
-    while (backup.tell() < app_fw.len) {
-        const start_position: usize = backup.tell();
-        const end_position: usize = if ((start_position + sd_page_size) > app_fw.len) app_fw.len else (start_position + sd_page_size);
+    var key = pk.init();
+    defer key.free();
 
-        var wb = try backup.write(app_fw[start_position..end_position]);
+    key.parse(pub_key[0..pub_key_len]) catch return firmware_error.firmware_candidate_not_valid;
+    key.verify(&image.hash, sig.?) catch return firmware_error.firmware_candidate_not_valid;
+}
+
+/// Compare the programmed application with a candidate checked by `verifyCandidate`
+/// The signed part is hashed, the unprotected TLVs are compared as they are.
+pub fn verifyFlashedImage(len: usize, image: *const signed_image) !void {
+    var flash_hash: [32]u8 = undefined;
+
+    if (image.len > fw.len) return firmware_error.flash_firmware_size_error;
+    if (len != image.len) return firmware_error.hash_compare_mismatch;
+
+    if (!std.mem.eql(u8, try appDigest.get(image.signed_len, &flash_hash), &image.hash)) {
+        return firmware_error.hash_compare_mismatch;
+    }
 
-        _ = wb;
-        try backup.sync();
+    if (!std.mem.eql(u8, fw[image.signed_len..image.len], image.trailer[0..(image.len - image.signed_len)])) {
+        return firmware_error.hash_compare_mismatch;
     }
+}
+
+/// Check the signature of the image in the application flash
+pub fn validateFlashedImage() !void {
+    var hdr: image_header = undefined;
+
+    load_global_public_key();
+
+    var fa_p: flash_area = .{ .fa_id = 0, .fa_device_id = app_device_id, .pad16 = 0, .fa_off = 0, .fa_size = @intCast(fw.len), .fp = null };
+
+    boot_image_load_header(&fa_p, &hdr) catch return firmware_error.firmware_candidate_not_valid;
+
+    var temp_buf = try freertos.allocator.alloc(u8, @as(usize, 512));
+    defer freertos.allocator.free(temp_buf);
 
-    return backup.size();
+    bootutil_img_validate(null, 0, &hdr, &fa_p, temp_buf.ptr, temp_buf.len, null, 0, null) catch return firmware_error.firmware_candidate_not_valid;
+}
+
+/// Compare the SHA-256 of a file with `expected`
+pub fn verifyFileHash(path: [*:0]const u8, expected: *const [32]u8) !void {
+    var file_hash: [32]u8 = undefined;
+
+    if (!std.mem.eql(u8, try config.calculateFileHash(path, &file_hash), expected)) {
+        return firmware_error.hash_compare_mismatch;
+    }
+}
+
+/// Compare the SHA-256 of the first `len` bytes of the application with `expected`
+/// The cached digest is used while the flash is unchanged, see `appDigest`.
+pub fn verifyFlashHash(len: usize, expected: *const [32]u8) !void {
+    var flash_hash: [32]u8 = undefined;
+
+    if (len > fw.len) return firmware_error.flash_firmware_size_error;
+
+    if (!std.mem.eql(u8, try appDigest.get(len, &flash_hash), expected)) {
+        return firmware_error.hash_compare_mismatch;
+    }
 }
 
 pub fn verifyBackup(path: [*:0]const u8, app_len: ?usize) !void {
@@ -121,7 +420,7 @@ pub fn verifyBackup(path: [*:0]const u8, app_len: ?usize) !void {
     var app_flash_hash: [32]u8 = undefined;
 
     const hash_backup = try config.calculateFileHash(path, &app_backup_hash);
-    const hash_flash = try config.calculateMemHash(app_fw, &app_flash_hash);
+    const hash_flash = try appDigest.get(app_fw.len, &app_flash_hash);
 
     if (!std.mem.eql(u8, hash_backup, hash_flash)) {
         return firmware_error.hash_compare_mismatch;
@@ -133,6 +432,8 @@ pub fn verifyBackup(path: [*:0]const u8, app_len: ?usize) !void {
 pub fn eraseFlash(app_len: ?usize) !void {
     const app_fw = fw[0..(app_len orelse fw.len)];
 
+    try appDigest.invalidate();
+
     var current_pos: usize = 0;
     while (current_pos < app_fw.len) {
         const start_pos = current_pos & flash_page_addr_mask;
@@ -140,51 +441,123 @@ pub fn eraseFlash(app_len: ?usize) !void {
 
         const dest_slice = app_fw[start_pos..end_pos];
 
-        if (c.mscReturnOk != c.MSC_ErasePage(@as(*u32, @alignCast(@ptrCast(dest_slice.ptr))))) {
-            return firmware_error.flash_erase_error;
-        }
+        flash.erasePage(dest_slice.ptr) catch return firmware_error.flash_erase_error;
 
         current_pos = end_pos;
     }
 }
 
-/// Flash the firmware image
+/// Erase the application pages in `pages`
+pub fn erasePages(pages: *const backup.pageMap) !void {
+    try appDigest.invalidate();
+
+    for (0..backup.page_count) |page| {
+        if (!pages.isSet(page)) continue;
+
+        flash.erasePage(fw[(page * flash_page_size)..].ptr) catch return firmware_error.flash_erase_error;
+    }
+}
+
+/// Program the erased application page at `pos`
+pub fn programPage(pos: usize, data: *[flash_page_size]u8) !void {
+    try appDigest.invalidate();
+
+    flash.writeWords(fw[pos..].ptr, data) catch return firmware_error.flash_write_error;
+}
+
+/// Programs the pages of the candidate
+const flashing = struct {
+    image_id: u32,
+    changes: *const backup.pageMap,
+
+    fn page(context: *anyopaque, pos: usize, data: []u8) anyerror!void {
+        const self: *@This() = @ptrCast(@alignCast(context));
+
+        if (!self.changes.isSet(pos / flash_page_size)) return;
+
+        // If padding is needed
+        @memset(scratch_area[data.len..], 0xFF);
+
+        try programPage(pos, &scratch_area);
+
+        // Whole pages only, the last one is covered by the completed image
+        if (data.len == flash_page_size) journal.markFlashing(self.image_id, pos + data.len);
+    }
+};
+
+/// Flash the firmware image and record the progress in the update journal
+/// Only the pages in `changes` are programmed, the others already hold the image. The progress is
+/// journaled after every programmed page. With `from`, flashing continues at the journaled page.
+/// A compressed image is inflated into the flash on the way. The data is not hashed here, the
+/// programmed image is checked against the signed hash, see `verifyFlashedImage`.
 /// Returns the size of the flashed image
 /// Error Cases:
-/// - If the file size is larger than the allowed firmware size, then `flash_firmware_size_error` is returned
+/// - If the image size is larger than the allowed firmware size, then `flash_firmware_size_error` is returned
 /// - If the flash write fails, then `flash_write_error` is returned
-pub fn flashFirmware(path: [*:0]const u8, app_len: ?usize) !usize {
-    const app_fw = fw[0..(app_len orelse fw.len)];
+pub fn flashFirmware(path: [*:0]const u8, image_id: u32, changes: *const backup.pageMap, from: ?*const journal.record) !usize {
+    var state = flashing{ .image_id = image_id, .changes = changes };
+
+    var start: usize = 0;
+
+    if (from) |rec| {
+        start = rec.offset;
+
+        if (((start % flash_page_size) != 0) or (start > fw.len)) return firmware_error.flash_firmware_size_error;
+
+        // The reset may have hit while this page was programmed
+        if ((start < fw.len) and changes.isSet(start / flash_page_size)) {
+            try appDigest.invalidate();
+
+            flash.erasePage(fw[start..].ptr) catch return firmware_error.flash_erase_error;
+        }
+    }
+
+    return candidate.stream(path, start, .{ .page = flashing.page, .context = &state });
+}
+
+/// Identity of a candidate image for the update journal
+/// CRC-32 of its size, header and TLV trailer. The trailer holds the SHA-256 of the image.
+/// For a compressed image, CRC-32 of the file size, the container header and the end of the
+/// stream, which holds the Adler-32 of the image.
+pub fn imageIdentity(path: [*:0]const u8) !u32 {
+    var hdr: image_header = undefined;
+    var crc = std.hash.Crc32.init();
 
     var file = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.read));
     defer {
         file.close() catch {};
     }
 
-    try file.sync();
+    const len: u32 = @intCast(file.size());
+
+    if (try candidate.readContainer(&file)) |container| {
+        crc.update(std.mem.asBytes(&len));
+        crc.update(std.mem.asBytes(&container));
+
+        try file.lseek(@max(@sizeOf(candidate.container), len -| scratch_area.len));
+        while (try file.readEof(scratch_area[0..])) |data| {
+            crc.update(data);
+        }
 
-    if (file.size() > app_fw.len) {
-        return firmware_error.flash_firmware_size_error;
+        return crc.final();
     }
 
-    var current_pos: usize = 0;
-    while (try file.readEof(scratch_area[0..])) |br| {
-        // Generate the destination slice
-        const dest_slice = app_fw[current_pos..(current_pos + scratch_area.len)]; // Destination slice is the same size as the scratch area
+    try file.rewind();
 
-        // If padding is needed
-        if (br.len < scratch_area.len) {
-            @memset(scratch_area[br.len..], 0xFF);
-        }
+    if (@sizeOf(image_header) != (try file.read(std.mem.asBytes(&hdr))).len) return firmware_error.firmware_candidate_not_valid;
 
-        if (c.mscReturnOk != c.MSC_WriteWord(@as(*u32, @alignCast(@ptrCast(dest_slice.ptr))), &scratch_area, scratch_area.len)) {
-            return firmware_error.flash_write_error;
-        }
+    const tlv_start = @as(usize, hdr.ih_hdr_size) + hdr.ih_img_size;
+    if (tlv_start >= len) return firmware_error.firmware_candidate_not_valid;
+
+    crc.update(std.mem.asBytes(&len));
+    crc.update(std.mem.asBytes(&hdr));
 
-        current_pos = file.tell();
+    try file.lseek(tlv_start);
+    while (try file.readEof(scratch_area[0..])) |data| {
+        crc.update(data);
     }
 
-    return file.size();
+    return crc.final();
 }
 
 // C-interop
@@ -216,6 +589,8 @@ pub export fn flash_area_read(fa: [*c]const flash_area, off: u32, dst: ?*anyopaq
 
         fil.lseek(off) catch unreachable;
         _ = fil.read(dst_slice) catch unreachable;
+    } else if (staging.device_id == c.flash_area_get_device_id(fa)) {
+        @memcpy(dst_slice, staging.region[off..(off + len)]);
     } else {
         // Read from flash is easy using slice-math
         @memcpy(dst_slice, fw[off..(off + len)]);
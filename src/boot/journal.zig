@@ -0,0 +1,101 @@
+//! Firmware update journal
+//!
+//! The bootloader records the progress of a firmware update in NVM (`update_journal`), so an update
+//! interrupted by a reset continues where it stopped instead of restoring the backup and starting
+//! over. While the image is programmed, the journal is written after every flash page. After a
+//! reset, the page that was in progress is erased again and programming continues with it.
+//!
+//! The journal belongs to one candidate image, identified by `firmware.imageIdentity`.
+const std = @import("std");
+const nvm = @import("../nvm.zig");
+
+/// Last completed step of the update
+pub const stage = enum(u32) {
+    /// The backup is written and verified
+    backed_up,
+    /// The application flash is erased
+    erased,
+    /// The image is programmed up to `offset`
+    flashing,
+    /// The image is programmed completely, `offset` holds its size
+    flashed,
+    /// The backup is being restored
+    restoring,
+};
+
+pub const record = extern struct {
+    /// Layout marker
+    magic: u32,
+    /// `stage` value
+    stage: u32,
+    /// Identity of the candidate image
+    image_id: u32,
+    /// Bytes programmed, page aligned while flashing
+    offset: u32,
+
+    const magic_value: u32 = 0x4A445055; // "UPDJ"
+
+    comptime {
+        if (@sizeOf(@This()) > nvm.max_object_size) @compileError("Update journal exceeds the NVM object size");
+    }
+
+    pub fn getStage(self: *const @This()) stage {
+        return @enumFromInt(self.stage);
+    }
+};
+
+/// Journal of the update of image `image_id`, if any
+pub fn load(image_id: u32) ?record {
+    var rec: record = undefined;
+
+    const data = nvm.readData(.update_journal, std.mem.asBytes(&rec)) catch return null;
+
+    if ((data.len != @sizeOf(record)) or (rec.magic != record.magic_value) or (rec.image_id != image_id)) return null;
+    if (rec.stage > @intFromEnum(stage.restoring)) return null;
+
+    return rec;
+}
+
+fn save(rec: *record) void {
+    rec.magic = record.magic_value;
+
+    // Without the journal an interrupted update restores the backup as before
+    nvm.writeData(.update_journal, std.mem.asBytes(rec)) catch {};
+}
+
+/// Record a completed step
+pub fn mark(image_id: u32, step: stage) void {
+    var rec = std.mem.zeroes(record);
+
+    rec.stage = @intFromEnum(step);
+    rec.image_id = image_id;
+
+    save(&rec);
+}
+
+/// Record the programming progress
+pub fn markFlashing(image_id: u32, offset: usize) void {
+    var rec = std.mem.zeroes(record);
+
+    rec.stage = @intFromEnum(stage.flashing);
+    rec.image_id = image_id;
+    rec.offset = @intCast(offset);
+
+    save(&rec);
+}
+
+/// Record the completely programmed image
+pub fn markFlashed(image_id: u32, len: usize) void {
+    var rec = std.mem.zeroes(record);
+
+    rec.stage = @intFromEnum(stage.flashed);
+    rec.image_id = image_id;
+    rec.offset = @intCast(len);
+
+    save(&rec);
+}
+
+/// The update is finished
+pub fn clear() void {
+    nvm.deleteObject(.update_journal) catch {};
+}
@@ -0,0 +1,239 @@
+//! Firmware staging region
+//!
+//! The application downloads a new image straight into the staging region at the end of the flash
+//! instead of the SD card. The bootloader validates the staged image and copies it over the
+//! application. The staged image stays untouched until it is installed, so an interrupted
+//! install simply starts again.
+//!
+//! Progress is recorded in NVM (`staging_marker`) at page boundaries. Everything after the last
+//! marker is erased again when a download resumes.
+const std = @import("std");
+const builtin = @import("builtin");
+const sha256 = @import("../sha256.zig");
+const nvm = @import("../nvm.zig");
+const chips = @import("../chips.zig");
+const firmware = @import("firmware.zig");
+const flash = @import("../flash.zig");
+const c = @cImport({
+    @cInclude("board.h");
+});
+
+/// Host builds stage into the upper 352 KiB of the application area, the split layout described in
+/// chips.zig, so the host tests run this code although the default layout has no staging region
+const host_staging_size: usize = if ((builtin.os.tag != .freestanding) and (chips.FLASH_STAGING_SIZE == 0)) 352 * 1024 else 0;
+
+const staging_start: usize = chips.FLASH_STAGING_START - host_staging_size;
+const staging_size: usize = chips.FLASH_STAGING_SIZE + host_staging_size;
+
+/// Direct-to-flash downloads are available
+pub const enabled = (staging_size != 0);
+
+/// Flash page size
+pub const page_size: usize = flash.page_size;
+
+/// Number of bytes programmed at once
+pub const write_block_size: usize = 512;
+
+/// Distance between two progress markers
+pub const marker_interval: usize = 4 * page_size;
+
+/// mcuboot flash area device ID of the staging region
+pub const device_id: u8 = 2;
+
+/// The staging region as a byte-slice
+pub const region: []u8 = flash.region(staging_start, staging_size);
+
+pub const staging_error = error{
+    /// No staging region configured
+    not_available,
+    /// The image does not fit into the staging region
+    image_too_large,
+    /// Less data than announced was written
+    image_incomplete,
+};
+
+comptime {
+    if ((staging_size % page_size) != 0) @compileError("Staging region must be a multiple of the flash page size");
+    if ((page_size % write_block_size) != 0) @compileError("Write block size must divide the flash page size");
+    if ((marker_interval % page_size) != 0) @compileError("Markers must be recorded at page boundaries");
+}
+
+/// Progress marker stored in NVM
+const marker = extern struct {
+    /// Layout marker
+    magic: u32,
+    /// `state_writing` or `state_complete`
+    state: u32,
+    /// Identity of the image (URL and validator)
+    id: u32,
+    /// Size of the image
+    size: u32,
+    /// Bytes programmed, page aligned while writing
+    offset: u32,
+    /// SHA-256 context of the programmed data
+    hash_state: [@sizeOf(std.meta.FieldType(sha256, .ctx))]u8,
+
+    const magic_value: u32 = 0x4D475453; // "STGM"
+    const state_writing: u32 = 0;
+    const state_complete: u32 = 1;
+
+    comptime {
+        if (@sizeOf(@This()) > nvm.max_object_size) @compileError("Staging marker exceeds the NVM object size");
+    }
+};
+
+fn loadMarker(m: *marker) bool {
+    const data = nvm.readData(.staging_marker, std.mem.asBytes(m)) catch return false;
+
+    return (data.len == @sizeOf(marker)) and (m.magic == marker.magic_value) and (m.size <= region.len) and (m.offset <= m.size);
+}
+
+/// Size of a completely staged image waiting to be installed
+pub fn pending() ?usize {
+    var m: marker = undefined;
+
+    if (!enabled or !loadMarker(&m) or (m.state != marker.state_complete) or (m.offset != m.size)) return null;
+
+    return m.size;
+}
+
+/// Forget the staged image
+pub fn clear() void {
+    nvm.deleteObject(.staging_marker) catch {};
+}
+
+/// Streams an image into the staging region
+///
+/// Pages are erased just ahead of the data, writes are buffered to whole words and the SHA-256 is
+/// computed over each block as it is programmed.
+pub const writer = struct {
+    /// Identity of the image
+    id: u32,
+    /// Size of the image
+    size: usize,
+    /// Bytes programmed into flash
+    offset: usize,
+    /// End of the erased area
+    erased: usize,
+    /// Data waiting to be programmed
+    buffer: [write_block_size]u8 align(@alignOf(u32)),
+    buffered: usize,
+    hasher: sha256,
+
+    /// Start staging an image of `size` bytes
+    /// With `resumable`, a previous attempt on the same image continues where its last marker was recorded.
+    /// Returns the offset the data has to continue from.
+    pub fn begin(self: *@This(), id: u32, size: usize, resumable: bool) !usize {
+        var m: marker = undefined;
+
+        if (!enabled) return staging_error.not_available;
+        if (size > region.len) return staging_error.image_too_large;
+
+        self.id = id;
+        self.size = size;
+        self.offset = 0;
+        self.buffered = 0;
+        self.hasher = sha256.init();
+
+        if (resumable and loadMarker(&m) and (m.state == marker.state_writing) and (m.id == id) and (m.size == size) and ((m.offset % page_size) == 0)) {
+            self.offset = m.offset;
+            @memcpy(std.mem.asBytes(&self.hasher.ctx), &m.hash_state);
+        } else {
+            clear();
+            try self.hasher.start();
+        }
+
+        // The page at the marker may hold data written after it
+        self.erased = self.offset;
+
+        return self.offset;
+    }
+
+    /// Position of the next byte in the image
+    pub fn position(self: *const @This()) usize {
+        return self.offset + self.buffered;
+    }
+
+    /// Append data to the image
+    pub fn write(self: *@This(), data: []const u8) !void {
+        if ((self.position() + data.len) > self.size) return staging_error.image_too_large;
+
+        var rem = data;
+        while (rem.len != 0) {
+            const len = @min(rem.len, self.buffer.len - self.buffered);
+
+            @memcpy(self.buffer[self.buffered .. self.buffered + len], rem[0..len]);
+            self.buffered += len;
+            rem = rem[len..];
+
+            if (self.buffered == self.buffer.len) {
+                try self.flush();
+            }
+        }
+    }
+
+    /// Program the buffered data
+    fn flush(self: *@This()) !void {
+        if (self.buffered == 0) return;
+
+        // Flash is programmed in words. Only the last block of an image is padded.
+        const len = std.mem.alignForward(usize, self.buffered, @sizeOf(u32));
+        @memset(self.buffer[self.buffered..len], 0xFF);
+
+        while (self.erased < (self.offset + len)) {
+            flash.erasePage(region[self.erased..].ptr) catch return firmware.firmware_error.flash_erase_error;
+            self.erased += page_size;
+        }
+
+        flash.writeWords(region[self.offset..].ptr, self.buffer[0..len]) catch return firmware.firmware_error.flash_write_error;
+
+        // Hash exactly what was programmed, without the padding
+        try self.hasher.update(self.buffer[0..self.buffered]);
+
+        self.offset += self.buffered;
+        self.buffered = 0;
+
+        // The hash state now covers exactly the programmed data
+        if ((self.offset % marker_interval) == 0) {
+            self.saveMarker(marker.state_writing) catch {};
+        }
+    }
+
+    fn saveMarker(self: *@This(), state: u32) !void {
+        var m: marker = std.mem.zeroes(marker);
+
+        m.magic = marker.magic_value;
+        m.state = state;
+        m.id = self.id;
+        m.size = @intCast(self.size);
+        m.offset = @intCast(self.offset);
+        @memcpy(&m.hash_state, std.mem.asBytes(&self.hasher.ctx));
+
+        try nvm.writeData(.staging_marker, std.mem.asBytes(&m));
+    }
+
+    /// Complete the image and mark it for installation
+    /// Returns the SHA-256 of the image
+    pub fn finish(self: *@This()) ![32]u8 {
+        var digest: [32]u8 = undefined;
+        defer self.hasher.free();
+
+        try self.flush();
+
+        if (self.offset != self.size) return staging_error.image_incomplete;
+
+        try self.saveMarker(marker.state_complete);
+        try self.hasher.finish(&digest);
+
+        return digest;
+    }
+
+    /// Abandon the image
+    pub fn discard(self: *@This()) void {
+        self.hasher.free();
+        clear();
+    }
+};
+
+/// Writer instance
+pub var image: writer = undefined;
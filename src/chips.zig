@@ -45,7 +45,17 @@ const FLASH_AVAILABLE_SIZE: usize = FLASH_SIZE - NVM3_SIZE;
 
 pub const FLASH_BOOTLOADER_SIZE: usize = 256 * KiB;
 
-pub const FLASH_APP_SIZE: usize = (FLASH_SIZE - NVM3_SIZE - FLASH_BOOTLOADER_SIZE);
+/// Size of the firmware staging region in bytes.
+/// A non-zero size enables direct-to-flash firmware downloads. The region is taken from the application.
+/// The default layout ships without a staging region: the whole application area stays available and
+/// downloads go to the SD card. Splitting the application area, e.g. 352 KiB, requires an application
+/// that fits into the remaining half.
+pub const FLASH_STAGING_SIZE: usize = 0;
+
+pub const FLASH_APP_SIZE: usize = (FLASH_SIZE - NVM3_SIZE - FLASH_BOOTLOADER_SIZE - FLASH_STAGING_SIZE);
+
+/// Start of the firmware staging region, right after the application.
+pub const FLASH_STAGING_START: usize = FLASH_BOOTLOADER_SIZE + FLASH_APP_SIZE;
 
 //const FLASH_RESERVE_SIZE: usize = FLASH_AVAILABLE_SIZE - FLASH_APP_SIZE;
 
@@ -26,6 +26,7 @@ const sha256 = @import("sha256.zig");
 const mbedtls = @import("mbedtls.zig");
 const pk = @import("pk.zig");
 const nvm = @import("nvm.zig");
+const storage = @import("storage.zig");
 pub const c = @cImport({
     @cInclude("miso_config.h");
 });
@@ -46,6 +47,15 @@ pub const min_task_stack_depth: u16 = freertos.c.configMINIMAL_STACK_SIZE;
 pub const enable_lwm2m = root.enable_lwm2m;
 pub const enable_mqtt = root.enable_mqtt;
 pub const enable_http = root.enable_http;
+pub const enable_tls13 = root.enable_tls13;
+
+/// Support https URIs in the HTTP client
+pub const enable_https = enable_http;
+
+/// Record per-state timing, traffic and heap usage of TLS handshakes
+/// Enabled, it takes 768 bytes of static RAM for the history (32 records of 24 bytes) and 40 bytes in
+/// every TLS context, and prints a line per handshake state. Disabled, it takes no RAM.
+pub const enable_handshake_profiler = false;
 
 pub const rtos_prio_boot_app = @intFromEnum(task_priorities.rtos_prio_highest);
 
@@ -70,6 +80,60 @@ pub const rtos_stack_depth_mqtt: u16 = if (enable_mqtt) 1600 else min_task_stack
 pub const rtos_prio_user_task = @intFromEnum(task_priorities.rtos_prio_below_normal);
 pub const rtos_stack_depth_user_task: u16 = 2500;
 
+// NETWORK MEDIATOR
+/// Number of sockets the mediator can track (SimpleLink supports up to SL_MAX_SOCKETS)
+pub const network_max_sockets: usize = 8;
+/// Maximum number of tasks waiting on the same socket direction
+pub const network_max_waiters: u32 = 4;
+/// Select polling period while waits are pending
+pub const network_poll_period_ms: u32 = 50;
+/// Maximum time a send waits for the socket to accept data
+pub const network_tx_timeout_s: u32 = 5;
+
+// DNS
+pub const rtos_prio_dns = @intFromEnum(task_priorities.rtos_prio_normal);
+pub const rtos_stack_depth_dns: u16 = 400;
+
+/// Number of cached hosts
+pub const dns_cache_size: usize = 4;
+/// Maximum number of tasks waiting for the same lookup
+pub const dns_max_waiters: u32 = 4;
+/// Lifetime of a resolved address (SimpleLink does not report the record TTL)
+pub const dns_ttl_ms: u32 = 10 * 60 * 1000;
+/// Lifetime of a failed lookup
+pub const dns_negative_ttl_ms: u32 = 30 * 1000;
+/// Time after expiry during which the old address is served while it is refreshed
+pub const dns_stale_ms: u32 = 60 * 60 * 1000;
+/// Maximum time a connection open waits for a lookup
+pub const dns_timeout_ms: u32 = 10 * 1000;
+
+// STORAGE
+pub const rtos_prio_storage = @intFromEnum(task_priorities.rtos_prio_normal);
+pub const rtos_stack_depth_storage: u16 = 600;
+
+/// Storage requests queued at once
+pub const storage_queue_depth: usize = 8;
+/// Read size when hashing a file
+pub const storage_hash_block_size: usize = 512;
+/// Requests served in a row on one file while requests on other files wait
+pub const storage_max_run: u32 = 8;
+/// Age of the oldest request after which it is served before further requests on the current file
+pub const storage_max_wait_ms: u32 = 100;
+
+// WRITE BEHIND
+/// Number of download buffers. One is filled while the others are written to the SD card.
+pub const write_behind_buffers: usize = 2;
+/// Size of a download buffer, a multiple of the sector size
+pub const write_behind_buffer_size: usize = 4 * 512;
+
+// FAST SEEK
+/// Number of cluster link maps shared by all open files
+pub const fatfs_link_maps: usize = 2;
+/// Size of a link map in words. A file with n fragments needs 2n + 1 words.
+pub const fatfs_link_map_words: usize = 64;
+/// Files opened for reading get a link map from this size on
+pub const fatfs_fast_seek_min_size: usize = 64 * 1024;
+
 // version
 pub const miso_version_mayor: u8 = 0;
 pub const miso_version_minor: u8 = 0;
@@ -89,8 +153,21 @@ pub const config_file_name = "SD:CONFIG.TXT";
 pub const config_sig_file_name = "SD:CONFIG.SIG";
 
 /// Default Config Public Key Location
+/// The key is provisioned with the device and never downloaded.
 pub const config_pub_key_file_name = "SD:CONFIG.PUB";
 
+/// Downloaded configuration, until its signature is verified
+pub const config_new_file_name = "SD:CONFIG.NEW";
+
+/// Downloaded configuration signature, until it is verified
+pub const config_sig_new_file_name = "SD:CONFSIG.NEW";
+
+/// CA certificates (PEM) trusted for HTTPS downloads, provisioned like the config public key
+pub const https_ca_file_name = "SD:CA.PEM";
+
+/// Default Firmware Delta Location
+pub const fw_delta_file_name = "SD:FW.DLT";
+
 /// Default APP backup Firmware Location
 pub const app_backup_file_name = "SD:APP.BAK";
 
@@ -107,6 +184,47 @@ pub const config_error = (fatfs.frError || sha256.sha256_error || std.mem.Alloca
 /// Const File block Size
 pub const file_block_size: usize = 512;
 
+/// Reads (TLS records for https) requested per HTTP range request
+pub const http_range_reads: usize = 8;
+
+/// HTTP requests in flight on one connection when fetching a batch of resources
+pub const http_pipeline_depth: usize = 3;
+
+/// Maximum size of a downloaded configuration file
+pub const config_max_file_size: usize = 4096;
+
+/// Record HTTP download progress in NVM every n bytes
+pub const http_checkpoint_interval: usize = 16 * 1024;
+
+/// Try a delta against the running image before downloading the full firmware image
+pub const enable_delta_update = true;
+
+/// Suffix appended to the firmware URI to locate the delta
+pub const fw_delta_uri_suffix = ".delta";
+
+/// Maximum size of a firmware delta
+pub const fw_delta_max_size: usize = 256 * 1024;
+
+/// Offer deflate content coding on full-body HTTP downloads (never on HEAD or range requests)
+pub const http_accept_deflate = true;
+
+/// Inflate window (2^n bytes). Servers must compress with a window of at most this size.
+pub const http_inflate_window_bits: u4 = 12;
+
+/// Inflate window (2^n bytes) of compressed firmware images. Images must be compressed with a window of at most this size.
+pub const fw_inflate_window_bits: u4 = 12;
+
+/// Installs of a staged image the bootloader attempts before it gives up and boots the application
+pub const staging_install_attempts: u8 = 3;
+
+/// Times the bootloader programs FW.BIN again after a failed write or verification before it
+/// restores the backup
+pub const update_reflash_attempts: u8 = 3;
+
+/// Times the bootloader erases and restores the backup before the update ends in
+/// `firmware_update_outcome.restore_failed`
+pub const update_restore_attempts: u8 = 3;
+
 /// Helper Getters
 pub inline fn getHttpSigKey() []u8 {
     return c.config_get_http_sig_key()[0..c.strlen(c.config_get_http_sig_key())];
@@ -120,6 +238,10 @@ pub inline fn getHttpSigUri() []u8 {
     return c.config_get_http_sig_uri()[0..c.strlen(c.config_get_http_sig_uri())];
 }
 
+pub inline fn getConfigUri() []u8 {
+    return c.config_get_config_uri()[0..c.strlen(c.config_get_config_uri())];
+}
+
 /// Open file and calculate SHA256 hash
 /// Precondition: The File System has been mounted (!)
 pub fn calculateFileHash(path: [*:0]const u8, hash: *[32]u8) config_error![]u8 {
@@ -157,23 +279,63 @@ pub fn calculateMemHash(slice: []u8, hash: *[32]u8) config_error![]u8 {
     return hash[0..];
 }
 
-/// Load a public key im PEM format into PK context
-fn load_public_key_from_file(path: [*:0]const u8, pk_ctx: *pk) config_error!void {
+/// Load a public key im PEM format into PK context, reading it in the storage task
+fn load_public_key_from_file(path: [*:0]const u8, pk_ctx: *pk) !void {
     //const allocator = freertos.allocator;
 
-    var key_file = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.read));
-    defer key_file.close() catch {};
+    var key_file = try storage.service.open(path, @intFromEnum(fatfs.file.fMode.read));
+    defer storage.service.close(&key_file) catch {};
 
     const key = try allocator.alloc(u8, key_file.size() + @as(usize, 1));
     defer allocator.free(key);
 
     @memset(key, 0);
 
-    _ = try key_file.read(key);
+    _ = try storage.service.read(&key_file, null, key);
 
     try pk_ctx.parse(key);
 }
 
+/// Verify the signature in `sig_path` over the configuration `hash` with the provisioned public key
+fn verify_config_signature(hash: []u8, sig_path: [*:0]const u8) !void {
+    var sig_file = try storage.service.open(sig_path, @intFromEnum(fatfs.file.fMode.read));
+    errdefer storage.service.close(&sig_file) catch {};
+
+    const sig = try allocator.alloc(u8, sig_file.size());
+    defer allocator.free(sig);
+
+    _ = try storage.service.read(&sig_file, null, sig);
+
+    try storage.service.close(&sig_file);
+
+    // Load the Public Key
+    var pk_ctx = pk.init();
+    defer pk_ctx.free();
+
+    load_public_key_from_file(config_pub_key_file_name, &pk_ctx) catch |err| {
+        _ = c.printf("CONFIG public key could not be loaded\r\n");
+        return err;
+    };
+
+    try pk_ctx.setTrusted();
+
+    pk.verifyTrusted(hash, sig) catch |err| {
+        _ = c.printf("CONFIG signature verification failed\r\n");
+        return err;
+    };
+
+    _ = c.printf("CONFIG signature verified successfully\r\n");
+}
+
+/// Verify a downloaded configuration against its downloaded signature, without loading it
+pub fn verify_config_candidate(path: [*:0]const u8, sig_path: [*:0]const u8) !void {
+    var config_sha256: [32]u8 align(@alignOf(u32)) = undefined;
+
+    const hash = try storage.service.hashFile(path, &config_sha256);
+
+    try verify_config_signature(hash, sig_path);
+}
+
 /// Open the configuration file, calculate the hash value and compare it with the nvm reference.
 pub fn open_config_file(path: [*:0]const u8) !void {
     var config_sha256: [32]u8 align(@alignOf(u32)) = undefined;
@@ -187,31 +349,10 @@ pub fn open_config_file(path: [*:0]const u8) !void {
         @memset(&ref_config_sha256, 0);
     };
 
-    const hash = try calculateFileHash(path, &config_sha256); // open config file and calculate the hash
+    const hash = try storage.service.hashFile(path, &config_sha256); // open config file and hash it in the storage task
 
     if (!std.mem.eql(u8, &ref_config_sha256, hash)) {
-        var sig_file = try fatfs.file.open(config_sig_file_name, @intFromEnum(fatfs.file.fMode.read));
-        errdefer sig_file.close() catch {};
-
-        const sig = try allocator.alloc(u8, sig_file.size());
-        defer allocator.free(sig);
-
-        _ = try sig_file.read(sig);
-
-        try sig_file.close();
-
-        // Load the Public Key
-        var pk_ctx = pk.init();
-        defer pk_ctx.free();
-
-        load_public_key_from_file(config_pub_key_file_name, &pk_ctx) catch {};
-
-        pk_ctx.verify(hash, sig) catch |err| {
-            _ = c.printf("CONFIG signature verification failed\r\n");
-            return err;
-        };
-
-        _ = c.printf("CONFIG signature verified successfully\r\n");
+        try verify_config_signature(hash, config_sig_file_name);
 
         c.miso_load_config(); // Process the config
 
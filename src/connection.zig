@@ -177,6 +177,9 @@ pub fn Connection(comptime sslType: type) type {
         pub fn open(self: *@This(), uri: std.Uri, local_port: ?u16) !void {
             try self.ssl.open(uri, local_port);
         }
+        pub fn openWithEarlyData(self: *@This(), uri: std.Uri, local_port: ?u16, early_data: []const u8) !void {
+            try self.ssl.openWithEarlyData(uri, local_port, early_data);
+        }
         pub fn close(self: *@This()) !void {
             try self.ssl.close();
         }
@@ -189,167 +192,209 @@ pub fn Connection(comptime sslType: type) type {
         pub fn waitRx(self: *@This(), timeout_s: u32) !bool {
             return self.ssl.waitRx(timeout_s);
         }
+        pub fn waitTx(self: *@This(), timeout_s: u32) !bool {
+            return self.ssl.waitTx(timeout_s);
+        }
     };
 }
 
+/// Number of socket descriptors SimpleLink can hand out
+const sd_limit: usize = c.SL_FD_SETSIZE;
+
+/// Marker for a socket descriptor without slot
+const no_slot: u8 = 0xFF;
+
+comptime {
+    if ((config.network_max_sockets == 0) or (config.network_max_sockets > 32)) @compileError("network_max_sockets must be between 1 and 32");
+}
+
+/// Bit mask with all slots set
+const all_slots: u32 = std.math.maxInt(u32) >> (32 - config.network_max_sockets);
+
+/// Readiness direction
+const direction = enum { rx, tx };
+
+/// Wait queue for one direction of a socket
+///
+/// Any number of tasks can wait on the same queue. The mediator bumps `generation` and gives
+/// the semaphore once per waiter when the socket becomes ready. A waiter that wakes up without
+/// a generation change took a token of a released waiter and gives it back, or, with no released
+/// waiter left, a stale token and keeps waiting.
+const waitQueue = struct {
+    /// Latest deadline among the waiters
+    deadline: u32 = 0,
+    /// Number of waiting tasks
+    waiters: u32 = 0,
+    /// Incremented each time the waiters are released
+    generation: u32 = 0,
+    /// Released waiters that have not returned yet, their tokens are still in the semaphore
+    released: u32 = 0,
+    /// Signaled once per waiter
+    signal: freertos.Semaphore = undefined,
+    signal_buffer: freertos.StaticSemaphore_t = undefined,
+
+    fn create(self: *@This()) void {
+        self.* = .{};
+        self.signal = freertos.Semaphore.createCountingSemaphoreStatic(config.network_max_waiters, 0, &self.signal_buffer) catch unreachable;
+    }
+
+    /// Release all waiters. Call with the mediator mutex held.
+    fn wake(self: *@This()) void {
+        self.generation +%= 1;
+        self.released += self.waiters;
+        while (self.waiters > 0) : (self.waiters -= 1) {
+            self.signal.give() catch {};
+        }
+    }
+
+    /// The queue has waiters whose deadline has not passed
+    inline fn pending(self: *const @This(), now: u32) bool {
+        return (self.waiters != 0) and (@as(i32, @bitCast(self.deadline -% now)) >= 0);
+    }
+};
+
+const connectionManagerElement = struct {
+    sd: i16 = -1,
+    rx: waitQueue = .{},
+    tx: waitQueue = .{},
+
+    pub fn init(self: *@This()) void {
+        self.sd = -1;
+        self.rx.create();
+        self.tx.create();
+    }
+
+    inline fn queue(self: *@This(), dir: direction) *waitQueue {
+        return switch (dir) {
+            .rx => &self.rx,
+            .tx => &self.tx,
+        };
+    }
+
+    inline fn idle(self: *const @This()) bool {
+        return (self.rx.waiters == 0) and (self.tx.waiters == 0) and (self.rx.released == 0) and (self.tx.released == 0);
+    }
+};
+
 fn run(self: *@This()) noreturn {
     var read_fd_set: c.SlFdSet_t = undefined;
     var write_fd_set: c.SlFdSet_t = undefined;
 
-    c.SL_FD_ZERO(&read_fd_set);
-    c.SL_FD_ZERO(&write_fd_set);
-
     self.mutex.give() catch {};
 
     while (true) {
-        // Start the loop
         var read_set_ptr: ?*c.SlFdSet_t = null;
         var write_set_ptr: ?*c.SlFdSet_t = null;
         var nfsd: i16 = -1;
-        var maintenance: usize = 0;
 
         c.SL_FD_ZERO(&read_fd_set);
         c.SL_FD_ZERO(&write_fd_set);
 
-        const current_time = freertos.xTaskGetTickCount();
-
-        // Go through the connection list
-        for (&self.connections) |*conn| {
-            if (conn.sd >= 0) {
-                if (conn.rx_queue.recieve(0)) |msg| {
-                    if ((msg.deadline > conn.rx_wait_deadline_ms) or (msg.deadline == 0)) {
-                        conn.rx_wait_deadline_ms = msg.deadline;
-                    }
-                }
-                if (conn.tx_queue.recieve(0)) |msg| {
-                    if ((msg.deadline > conn.tx_wait_deadline_ms) or (msg.deadline == 0)) {
-                        conn.tx_wait_deadline_ms = msg.deadline;
-                    }
-                }
-
-                if ((conn.rx_wait_deadline_ms == 0)) {
-                    if (self.mutex.take(null) catch unreachable) {
-                        conn.sd = -1; // Invalidate the connection
-                        self.mutex.give() catch unreachable;
-                    }
-                    maintenance += 1; // Go for another loop if there are no more deadlines
-                } else if (conn.rx_wait_deadline_ms >= current_time) {
-                    c.SL_FD_SET(conn.sd, &read_fd_set);
-                    if (nfsd < conn.sd) {
-                        nfsd = conn.sd;
-                    }
-                    read_set_ptr = &read_fd_set;
-                } else {
-                    conn.rx_wait_deadline_ms = 0; // reset deadline
-                    const msg: timeout_resp = .{ .timeout = 0 };
-                    conn.rx_signal.send(&msg, null) catch {};
-                    maintenance += 1; // Go for another loop if there are no more deadlines
-                }
+        // Collect the sockets with pending waits
+        self.lock();
+        const current_time: u32 = freertos.xTaskGetTickCount();
+        var used = self.used_mask;
+        while (used != 0) : (used &= used - 1) {
+            const conn = &self.connections[@ctz(used)];
+
+            if (conn.rx.pending(current_time)) {
+                c.SL_FD_SET(conn.sd, &read_fd_set);
+                read_set_ptr = &read_fd_set;
+                nfsd = @max(nfsd, conn.sd);
+            }
+            if (conn.tx.pending(current_time)) {
+                c.SL_FD_SET(conn.sd, &write_fd_set);
+                write_set_ptr = &write_fd_set;
+                nfsd = @max(nfsd, conn.sd);
             }
         }
+        self.unlock();
 
-        if ((read_set_ptr != null) or (write_set_ptr != null)) {
-            var tv = c.SlTimeval_t{ .tv_sec = 0, .tv_usec = 0 };
+        if (nfsd < 0) {
+            // No pending waits. Expired waiters time out on their own.
+            _ = self.task.waitForNotify(0, 0xFFFFFFFF, null) catch {};
+            continue;
+        }
 
-            const res = c.sl_Select(nfsd + 1, read_set_ptr, write_set_ptr, null, &tv);
+        var tv = c.SlTimeval_t{ .tv_sec = 0, .tv_usec = 0 };
 
-            if (res > 0) {
-                if (read_set_ptr) |read_set| {
-                    for (&self.connections) |*conn| {
-                        if (conn.sd >= 0) {
-                            if (1 == c.SL_FD_ISSET(conn.sd, read_set)) {
-                                conn.rx_wait_deadline_ms = 0; // reset deadline
+        const res = c.sl_Select(nfsd + 1, read_set_ptr, write_set_ptr, null, &tv);
 
-                                const msg: timeout_resp = .{ .timeout = 1 };
+        if (res > 0) {
+            self.lock();
+            used = self.used_mask;
+            while (used != 0) : (used &= used - 1) {
+                const conn = &self.connections[@ctz(used)];
 
-                                conn.rx_signal.send(&msg, null) catch {};
-                            } else {
-                                // Do nothing
-                            }
-                        }
-                    }
+                if ((read_set_ptr != null) and (1 == c.SL_FD_ISSET(conn.sd, &read_fd_set))) {
+                    conn.rx.wake();
+                }
+                if ((write_set_ptr != null) and (1 == c.SL_FD_ISSET(conn.sd, &write_fd_set))) {
+                    conn.tx.wake();
                 }
-            } else if (res == 0) {
-                // Select returned without any events
-                self.task.delayTask(50);
-            } else {
-                // Error
-                _ = c.printf("Select ERROR\n\r");
             }
-        } else if (maintenance != 0) {
-            // do nothing
+            self.unlock();
+        } else if (res == 0) {
+            // Select returned without any events. Poll again later or when a new wait arrives.
+            _ = self.task.waitForNotify(0, 0xFFFFFFFF, config.network_poll_period_ms) catch {};
         } else {
-            // no deadlines
-            if (self.task.waitForNotify(0, 0xFFFFFFFF, null)) |_| {
-                // Do something
-            } else |_| {
-                // Do nothing
-            }
+            // Error
+            _ = c.printf("Select ERROR\n\r");
+            self.task.delayTask(config.network_poll_period_ms);
         }
-        // Do something
     }
 }
 
-const timeout_msg = struct {
-    deadline: u32,
-};
+task: freertos.StaticTask(@This(), 1200, "select_task", run),
+mutex: freertos.StaticMutex(),
+connections: [config.network_max_sockets]connectionManagerElement = undefined,
+/// Slot index by socket descriptor
+slot_index: [sd_limit]u8 = undefined,
+/// Bit mask of the slots in use
+used_mask: u32 = 0,
+
+inline fn lock(self: *@This()) void {
+    _ = self.mutex.take(null) catch unreachable;
+}
 
-const timeout_resp = struct {
-    timeout: u32,
-};
+inline fn unlock(self: *@This()) void {
+    self.mutex.give() catch unreachable;
+}
 
-const connectionManagerElement = struct {
-    sd: i16 = -1,
-    rx_wait_deadline_ms: u32 = 0,
-    tx_wait_deadline_ms: u32 = 0,
-    rx_signal: freertos.StaticQueue(timeout_resp, 1),
-    tx_signal: freertos.StaticBinarySemaphore(),
-    rx_queue: freertos.StaticQueue(timeout_msg, 1),
-    tx_queue: freertos.StaticQueue(timeout_msg, 1),
+/// Look up the slot of a socket, allocating one if needed. Call with the mutex held.
+fn getSlot(self: *@This(), sd: i16) ?*connectionManagerElement {
+    if ((sd < 0) or (sd >= sd_limit)) return null;
 
-    pub fn init(self: *@This()) void {
-        self.sd = -1;
-        self.rx_wait_deadline_ms = 0;
-        self.tx_wait_deadline_ms = 0;
-        self.rx_signal.create() catch unreachable;
-        self.tx_signal.create() catch unreachable;
-        self.rx_queue.create() catch unreachable;
-        self.tx_queue.create() catch unreachable;
-    }
-};
+    const idx = self.slot_index[@intCast(sd)];
+    if (idx != no_slot) return &self.connections[idx];
 
-task: freertos.StaticTask(@This(), 1200, "select_task", run),
-mutex: freertos.StaticMutex(),
-connections: [4]connectionManagerElement = undefined,
+    const free_mask = ~self.used_mask & all_slots;
+    if (free_mask == 0) return null;
 
-/// Look if socket is already in the pool
-fn findSocket(self: *@This(), sd: i16) ?*connectionManagerElement {
-    for (&self.connections) |*conn| {
-        if (conn.sd == sd) {
-            return conn;
-        }
-    }
-    return null;
+    const slot: u8 = @intCast(@ctz(free_mask));
+    self.used_mask |= (@as(u32, 1) << @intCast(slot));
+    self.slot_index[@intCast(sd)] = slot;
+    self.connections[slot].sd = sd;
+
+    return &self.connections[slot];
 }
 
-/// Look for the first free position in the pool
-fn findFreeSocket(self: *@This(), sd: i16) ?*connectionManagerElement {
-    for (&self.connections) |*conn| {
-        if (conn.sd < 0) {
-            if (self.mutex.take(null) catch unreachable) {
-                conn.sd = sd;
-                self.mutex.give() catch unreachable;
-            }
-            return conn;
-        }
+/// Return the slot of a socket without waiters to the pool. Call with the mutex held.
+fn releaseSlot(self: *@This(), conn: *connectionManagerElement) void {
+    if (conn.idle() and conn.sd >= 0) {
+        const slot: u8 = self.slot_index[@intCast(conn.sd)];
+        self.slot_index[@intCast(conn.sd)] = no_slot;
+        self.used_mask &= ~(@as(u32, 1) << @intCast(slot));
+        conn.sd = -1;
     }
-    return null;
 }
 
 pub fn initializeConnectionsManager(self: *@This()) void {
     for (&self.connections) |*conn| {
         conn.init();
     }
+    @memset(&self.slot_index, no_slot);
+    self.used_mask = 0;
 }
 
 pub fn init(self: *@This()) !void {
@@ -359,31 +404,74 @@ pub fn init(self: *@This()) !void {
     self.task.suspendTask();
 }
 
-pub fn wait_rx(self: *@This(), sd: i16, timeout_s: u32) !bool {
-    const deadline_ms: u32 = @as(u32, freertos.xTaskGetTickCount()) + (timeout_s * 1024);
-    const msg: timeout_msg = .{ .deadline = deadline_ms };
+/// Wait until the socket is readable (rx) or writable (tx)
+/// Returns false on timeout
+fn wait(self: *@This(), sd: i16, dir: direction, timeout_s: u32) !bool {
+    const timeout_ms: u32 = timeout_s * 1000;
 
-    // Find a connection in the pool.
-    var conn: *connectionManagerElement = self.findSocket(sd) orelse (self.findFreeSocket(sd) orelse unreachable);
+    self.lock();
 
-    conn.rx_signal.reset();
+    const conn = self.getSlot(sd) orelse {
+        self.unlock();
+        return connection_error.socket;
+    };
+    const queue = conn.queue(dir);
+    const deadline: u32 = @as(u32, freertos.xTaskGetTickCount()) +% timeout_ms;
+
+    if ((queue.waiters == 0) or (@as(i32, @bitCast(deadline -% queue.deadline)) > 0)) {
+        queue.deadline = deadline;
+    }
+    queue.waiters += 1;
+    const generation = queue.generation;
 
-    try conn.rx_queue.send(&msg, null);
+    self.unlock();
 
     self.task.notify(1, .eIncrement) catch {};
 
-    if (conn.rx_signal.recieve(null)) |resp| {
-        if (1 == resp.timeout) {
+    var gave_back = false;
+
+    while (true) {
+        // Let the owner of a given back token take it before trying again
+        if (gave_back) freertos.vTaskDelay(1);
+        gave_back = false;
+
+        const remaining: u32 = deadline -% @as(u32, freertos.xTaskGetTickCount());
+        const signaled = if (@as(i32, @bitCast(remaining)) > 0) (queue.signal.take(remaining) catch false) else false;
+
+        self.lock();
+        defer self.unlock();
+
+        if (queue.generation != generation) {
+            // Released by the mediator. The token may still be in the semaphore if the take timed out.
+            if (!signaled) _ = queue.signal.take(0) catch false;
+            queue.released -= 1;
+            self.releaseSlot(conn);
             return true;
-        } else {
-            // _ = c.printf("Deadline missed: %d\n\r", freertos.xTaskGetTickCount() - deadline_ms);
+        }
+
+        if (!signaled) {
+            queue.waiters -= 1;
+            self.releaseSlot(conn);
             return false;
         }
-    } else {
-        return false;
+
+        if (queue.released > 0) {
+            // Token of a waiter released before this one registered
+            queue.signal.give() catch {};
+            gave_back = true;
+        }
+        // Otherwise a stale token from an earlier wait, keep waiting
     }
 }
 
+pub fn wait_rx(self: *@This(), sd: i16, timeout_s: u32) !bool {
+    return self.wait(sd, .rx, timeout_s);
+}
+
+pub fn wait_tx(self: *@This(), sd: i16, timeout_s: u32) !bool {
+    return self.wait(sd, .tx, timeout_s);
+}
+
 pub var connectionManager: @This() = undefined;
 
 /// Handle the mbedtls threading
@@ -406,3 +494,7 @@ export fn resume_network_mediator() callconv(.C) void {
 pub fn network_mediator_wait_rx(sd: i16, timeout_s: u32) !bool {
     return connectionManager.wait_rx(sd, timeout_s);
 }
+
+pub fn network_mediator_wait_tx(sd: i16, timeout_s: u32) !bool {
+    return connectionManager.wait_tx(sd, timeout_s);
+}
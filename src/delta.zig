@@ -0,0 +1,199 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! Delta firmware updates
+//!
+//! A patch reconstructs a new application image from the running image in flash. It is applied as a
+//! stream: the patch is read from SD in small blocks and the result is written to the firmware file,
+//! where it goes through the normal signature check before it is flashed.
+//!
+//! Patch layout (little endian):
+//!
+//! | Field      | Size | Description                                  |
+//! |------------|------|----------------------------------------------|
+//! | magic      | 4    | "MDLT"                                       |
+//! | version    | 1    | 1                                            |
+//! | reserved   | 3    |                                              |
+//! | old_size   | 4    | Size of the base image                       |
+//! | new_size   | 4    | Size of the reconstructed image              |
+//! | old_sha256 | 32   | SHA-256 of the base image                    |
+//!
+//! followed by commands:
+//!
+//! - `0x01 COPY   off:u32 len:u32`            copy `len` bytes of the base image at `off`
+//! - `0x02 ADD    off:u32 len:u32 data[len]`  base image bytes at `off` plus `data` (mod 256)
+//! - `0x03 INSERT len:u32 data[len]`          literal bytes
+//! - `0x00 END`
+//!
+//! Patches are generated with `invoke make-delta`.
+
+const std = @import("std");
+const config = @import("config.zig");
+const fatfs = @import("fatfs.zig");
+const firmware = @import("boot/firmware.zig");
+const appDigest = @import("boot/appDigest.zig");
+
+pub const delta_error = error{
+    /// Not a patch or unsupported version
+    invalid_header,
+    /// The patch was generated for a different base image
+    base_mismatch,
+    /// Unknown command
+    invalid_command,
+    /// Command exceeds the base or the new image
+    out_of_bounds,
+    /// Patch ended early
+    unexpected_end,
+    /// Reconstructed size does not match
+    size_mismatch,
+    /// File write incomplete
+    write_error,
+};
+
+const header = extern struct {
+    magic: [4]u8,
+    version: u8,
+    reserved: [3]u8,
+    old_size: u32,
+    new_size: u32,
+    old_sha256: [32]u8,
+};
+
+const command = enum(u8) {
+    end = 0x00,
+    copy = 0x01,
+    add = 0x02,
+    insert = 0x03,
+};
+
+const patch_magic = "MDLT";
+const patch_version: u8 = 1;
+
+/// Buffered reader for the patch file
+const patchReader = struct {
+    file: *fatfs.file,
+    buffer: *[config.file_block_size]u8,
+    data: []u8 = &.{},
+
+    fn read(self: *@This(), dst: []u8) !void {
+        var offset: usize = 0;
+
+        while (offset < dst.len) {
+            if (self.data.len == 0) {
+                self.data = try self.file.read(self.buffer[0..]);
+                if (self.data.len == 0) return delta_error.unexpected_end;
+            }
+
+            const len = @min(self.data.len, dst.len - offset);
+            @memcpy(dst[offset .. offset + len], self.data[0..len]);
+            self.data = self.data[len..];
+            offset += len;
+        }
+    }
+
+    fn int(self: *@This(), comptime T: type) !T {
+        var bytes: [@sizeOf(T)]u8 = undefined;
+        try self.read(&bytes);
+        return std.mem.readIntLittle(T, &bytes);
+    }
+};
+
+/// Patch read buffer
+var read_buffer: [config.file_block_size]u8 = undefined;
+
+/// Scratch area for ADD and INSERT data
+var scratch_area: [config.file_block_size]u8 = undefined;
+
+fn writeAll(out: *fatfs.file, data: []const u8) !void {
+    if (data.len != try out.write(data)) return delta_error.write_error;
+}
+
+/// Apply the patch in `patch_path` to the running image and write the new image to `out_path`
+/// Returns the size of the new image
+pub fn apply(patch_path: [*:0]const u8, out_path: [*:0]const u8) !usize {
+    const base = firmware.fw;
+
+    var patch = try fatfs.file.open(patch_path, @intFromEnum(fatfs.file.fMode.read));
+    defer {
+        patch.close() catch {};
+    }
+
+    var reader = patchReader{ .file = &patch, .buffer = &read_buffer };
+
+    var hdr: header = undefined;
+    try reader.read(std.mem.asBytes(&hdr));
+
+    if (!std.mem.eql(u8, &hdr.magic, patch_magic) or (hdr.version != patch_version)) return delta_error.invalid_header;
+    if ((hdr.old_size > base.len) or (hdr.new_size > base.len)) return delta_error.out_of_bounds;
+
+    // The patch only applies to the image it was generated against
+    var base_hash: [32]u8 = undefined;
+    _ = try appDigest.get(hdr.old_size, &base_hash);
+    if (!std.mem.eql(u8, &base_hash, &hdr.old_sha256)) return delta_error.base_mismatch;
+
+    var out = try fatfs.file.open(out_path, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+    defer {
+        out.close() catch {};
+    }
+
+    var written: usize = 0;
+
+    while (true) {
+        var cmd_byte: [1]u8 = undefined;
+        try reader.read(&cmd_byte);
+
+        const cmd = std.meta.intToEnum(command, cmd_byte[0]) catch return delta_error.invalid_command;
+        if (cmd == .end) break;
+
+        const offset: usize = if (cmd == .insert) 0 else try reader.int(u32);
+        const len: usize = try reader.int(u32);
+
+        if ((written + len) > hdr.new_size) return delta_error.out_of_bounds;
+        if ((cmd != .insert) and ((offset + len) > hdr.old_size)) return delta_error.out_of_bounds;
+
+        switch (cmd) {
+            .copy => try writeAll(&out, base[offset .. offset + len]),
+            .add, .insert => {
+                var done: usize = 0;
+                while (done < len) {
+                    const chunk = scratch_area[0..@min(scratch_area.len, len - done)];
+                    try reader.read(chunk);
+
+                    if (cmd == .add) {
+                        for (chunk, base[offset + done .. offset + done + chunk.len]) |*dst, src| {
+                            dst.* +%= src;
+                        }
+                    }
+
+                    try writeAll(&out, chunk);
+                    done += chunk.len;
+                }
+            },
+            .end => unreachable,
+        }
+
+        written += len;
+    }
+
+    if (written != hdr.new_size) return delta_error.size_mismatch;
+
+    try out.sync();
+
+    return written;
+}
@@ -0,0 +1,319 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! DNS cache and asynchronous resolver
+//!
+//! Every connection open used to call `sl_NetAppDnsGetHostByName` synchronously.
+//! Resolved addresses are now cached with a TTL. Failed lookups are cached for a shorter time (negative caching).
+//! Expired entries are served while a refresh runs in the background (stale-while-revalidate).
+//! Lookups run in the resolver task. Tasks asking for a host that is already being resolved wait for the
+//! pending query instead of issuing a duplicate one.
+//! SimpleLink does not report the record TTL, so the TTLs are configured in config.zig.
+
+const std = @import("std");
+const freertos = @import("freertos.zig");
+const config = @import("config.zig");
+const c = @cImport({
+    @cInclude("board.h");
+    @cInclude("simplelink.h");
+});
+
+pub const dns_error = error{
+    /// Host could not be resolved (or is negatively cached)
+    not_found,
+    /// Resolution did not complete in time
+    timeout,
+};
+
+/// Maximum host name length stored in the cache
+const max_host_len = 64;
+
+const entry_state = enum(u8) {
+    /// Free slot
+    empty,
+    /// Address is valid (possibly stale)
+    valid,
+    /// Lookup failed
+    negative,
+    /// First lookup in progress
+    resolving,
+};
+
+const entry = struct {
+    host: [max_host_len]u8 = undefined,
+    host_len: u8 = 0,
+    addr: u32 = 0,
+    state: entry_state = .empty,
+    /// A background refresh is pending
+    refreshing: bool = false,
+    /// Tick count after which the entry is expired
+    expires: freertos.TickType_t = 0,
+    /// Tick count of last use (LRU eviction)
+    last_used: freertos.TickType_t = 0,
+    /// Number of tasks waiting for the lookup to complete
+    waiters: u32 = 0,
+    /// Signaled once per waiter when the lookup completes
+    done: freertos.Semaphore = undefined,
+    done_buffer: freertos.StaticSemaphore_t = undefined,
+
+    fn matches(self: *const @This(), host: []const u8) bool {
+        return (self.state != .empty) and std.ascii.eqlIgnoreCase(self.host[0..self.host_len], host);
+    }
+};
+
+task: freertos.StaticTask(@This(), config.rtos_stack_depth_dns, "dns", run),
+queue: freertos.StaticQueue(u8, config.dns_cache_size),
+mutex: freertos.StaticMutex(),
+entries: [config.dns_cache_size]entry,
+
+/// Statistics
+queries: u32,
+hits: u32,
+
+/// `a` is at or after `b`, tolerating tick counter wrap around
+inline fn tickReached(a: freertos.TickType_t, b: freertos.TickType_t) bool {
+    return @as(i32, @bitCast(a -% b)) >= 0;
+}
+
+inline fn lock(self: *@This()) void {
+    _ = self.mutex.take(null) catch unreachable;
+}
+
+inline fn unlock(self: *@This()) void {
+    self.mutex.give() catch unreachable;
+}
+
+/// Issue the DNS query. Returns the address in host byte order.
+fn query(self: *@This(), host: []const u8) ?u32 {
+    var host_ip: u32 = 0;
+
+    self.queries +%= 1;
+
+    const ret = c.sl_NetAppDnsGetHostByName(@as([*c]i8, @ptrCast(@constCast(host.ptr))), @intCast(host.len), &host_ip, c.SL_AF_INET);
+
+    return if (ret >= 0) host_ip else null;
+}
+
+fn find(self: *@This(), host: []const u8) ?*entry {
+    for (&self.entries) |*e| {
+        if (e.matches(host)) return e;
+    }
+    return null;
+}
+
+/// Find a slot for a new host. Entries with a pending lookup are never evicted.
+fn allocate(self: *@This(), host: []const u8) ?*entry {
+    var victim: ?*entry = null;
+
+    for (&self.entries) |*e| {
+        if (e.state == .empty) {
+            victim = e;
+            break;
+        }
+        if ((e.state == .resolving) or e.refreshing or (e.waiters != 0)) continue;
+
+        if (victim == null or tickReached(victim.?.last_used, e.last_used)) {
+            victim = e;
+        }
+    }
+
+    if (victim) |e| {
+        @memcpy(e.host[0..host.len], host);
+        e.host_len = @intCast(host.len);
+        e.state = .resolving;
+        e.refreshing = false;
+        e.waiters = 0;
+    }
+
+    return victim;
+}
+
+/// Hand an entry to the resolver task
+fn schedule(self: *@This(), e: *entry) bool {
+    const idx: u8 = @intCast((@intFromPtr(e) - @intFromPtr(&self.entries)) / @sizeOf(entry));
+
+    self.queue.send(&idx, 0) catch return false;
+    return true;
+}
+
+/// Resolve `host` to an IPv4 address in host byte order
+///
+/// - Cached addresses are returned immediately.
+/// - Expired addresses are returned immediately while they are refreshed in the background.
+/// - Otherwise the caller waits up to `timeout_ms` for the resolver task.
+/// - Host names too long for the cache are resolved directly, without caching.
+pub fn resolve(self: *@This(), host: []const u8, timeout_ms: u32) !u32 {
+    if (host.len > max_host_len) return self.query(host) orelse dns_error.not_found;
+
+    const deadline = freertos.xTaskGetTickCount() +% timeout_ms;
+
+    self.lock();
+
+    const now = freertos.xTaskGetTickCount();
+
+    const e = self.find(host) orelse (self.allocate(host) orelse {
+        // Every slot has a pending lookup. Resolve directly.
+        self.unlock();
+        return self.query(host) orelse dns_error.not_found;
+    });
+
+    e.last_used = now;
+
+    switch (e.state) {
+        .valid => {
+            self.hits +%= 1;
+            const addr = e.addr;
+
+            if (tickReached(now, e.expires) and !e.refreshing) {
+                if (tickReached(now, e.expires +% config.dns_stale_ms)) {
+                    // Too old to be served. Resolve again and wait.
+                    e.state = .resolving;
+                } else {
+                    e.refreshing = self.schedule(e);
+                    self.unlock();
+                    return addr;
+                }
+            } else {
+                self.unlock();
+                return addr;
+            }
+        },
+        .negative => {
+            if (!tickReached(now, e.expires)) {
+                self.hits +%= 1;
+                self.unlock();
+                return dns_error.not_found;
+            }
+            e.state = .resolving;
+        },
+        .resolving, .empty => {},
+    }
+
+    // New lookup: queue it once. Pending lookups are joined.
+    if (e.waiters == 0 and !self.schedule(e)) {
+        e.state = .empty;
+        self.unlock();
+        return self.query(host) orelse dns_error.not_found;
+    }
+
+    e.waiters += 1;
+
+    while (true) {
+        self.unlock();
+
+        const remaining = deadline -% freertos.xTaskGetTickCount();
+        const signaled = if (@as(i32, @bitCast(remaining)) > 0) (e.done.take(remaining) catch false) else false;
+
+        self.lock();
+
+        // The entry may have been recycled while unlocked, check the host again
+        if (!e.matches(host)) break;
+
+        switch (e.state) {
+            .valid => {
+                const addr = e.addr;
+                self.unlock();
+                return addr;
+            },
+            .negative => {
+                self.unlock();
+                return dns_error.not_found;
+            },
+            else => {},
+        }
+
+        if (!signaled) {
+            if (e.waiters > 0) e.waiters -= 1;
+            self.unlock();
+            return dns_error.timeout;
+        }
+        // Stale token from an earlier timeout, keep waiting
+    }
+
+    self.unlock();
+    return dns_error.timeout;
+}
+
+/// Drop a cached host, e.g. after connecting to its address failed
+pub fn invalidate(self: *@This(), host: []const u8) void {
+    self.lock();
+    defer self.unlock();
+
+    if (self.find(host)) |e| {
+        if (e.state == .valid and !e.refreshing and e.waiters == 0) {
+            e.state = .empty;
+        }
+    }
+}
+
+/// Resolver task
+fn run(self: *@This()) noreturn {
+    var host: [max_host_len]u8 = undefined;
+
+    while (true) {
+        const idx = self.queue.recieve(null) orelse continue;
+        const e = &self.entries[idx];
+
+        self.lock();
+        const host_len = e.host_len;
+        @memcpy(host[0..host_len], e.host[0..host_len]);
+        self.unlock();
+
+        const result = self.query(host[0..host_len]);
+        const now = freertos.xTaskGetTickCount();
+
+        self.lock();
+
+        if (e.matches(host[0..host_len])) {
+            if (result) |addr| {
+                e.addr = addr;
+                e.state = .valid;
+                e.expires = now +% config.dns_ttl_ms;
+            } else if (e.refreshing) {
+                // Keep serving the stale address until the stale window ends
+            } else {
+                e.state = .negative;
+                e.expires = now +% config.dns_negative_ttl_ms;
+            }
+            e.refreshing = false;
+
+            while (e.waiters > 0) : (e.waiters -= 1) {
+                e.done.give() catch {};
+            }
+        }
+
+        self.unlock();
+    }
+}
+
+pub fn create(self: *@This()) void {
+    self.queries = 0;
+    self.hits = 0;
+
+    for (&self.entries) |*e| {
+        e.* = .{};
+        e.done = freertos.Semaphore.createCountingSemaphoreStatic(config.dns_max_waiters, 0, &e.done_buffer) catch unreachable;
+    }
+
+    self.mutex.create() catch unreachable;
+    self.queue.create() catch unreachable;
+    self.task.create(self, config.rtos_prio_dns) catch unreachable;
+}
+
+pub var service: @This() = undefined;
@@ -27,8 +27,11 @@
 ///
 /// Tested on FreeRTOS with a standard SD card
 ///
+const std = @import("std");
+const config = @import("config.zig");
 const c = @cImport({
     @cInclude("ff.h");
+    @cInclude("disk_cache.h");
 });
 
 const FIL = c.FIL;
@@ -128,10 +131,52 @@ pub const dir = struct {
     }
 };
 
+/// Cluster link map (CLMT) for fast seeks
+///
+/// The maps live in a fixed pool, so a file handle can still be copied around.
+const linkMap = struct {
+    table: [config.fatfs_link_map_words]c.DWORD,
+    used: bool,
+
+    var pool = [_]@This(){.{ .table = undefined, .used = false }} ** config.fatfs_link_maps;
+
+    fn acquire() ?*@This() {
+        for (&pool) |*map| {
+            if (null == @cmpxchgStrong(bool, &map.used, false, true, .Acquire, .Monotonic)) return map;
+        }
+        return null;
+    }
+
+    fn release(self: *@This()) void {
+        @atomicStore(bool, &self.used, false, .Release);
+    }
+};
+
+/// Sector size of the volume
+pub const sector_size: usize = c.FF_MAX_SS;
+
+/// `FIL.flag`: the file buffer holds data not yet written (ff.c)
+const FA_DIRTY: u8 = 0x80;
+
+/// Bounce buffer for partial sectors of raw transfers, used under the volume lock
+var raw_sector: [sector_size]u8 align(@alignOf(u32)) = undefined;
+
+/// Sectors of a file stored in one piece
+pub const sectorExtent = struct {
+    /// First sector of the file
+    sector: c.LBA_t,
+    /// Number of sectors covering the file
+    count: usize,
+};
+
 /// File API
 pub const file = struct {
     /// File handle
     handle: FIL,
+    /// Link map in use, if any
+    link_map: ?*linkMap,
+    /// Location of a contiguous file, for raw sector transfers
+    extent: ?sectorExtent,
 
     /// File open mode. See documentation for `f_open` in `ff.h`
     pub const fMode = enum(u8) {
@@ -149,19 +194,159 @@ pub const file = struct {
     //}
 
     /// Open a file in given path and with the given mode. See `fMode` for possible modes.
+    /// Large files opened for reading only get a link map for fast seeks.
     pub fn open(path: [*:0]const u8, mode: u8) frError!@This() {
         var self: @This() = undefined;
 
+        self.link_map = null;
+        self.extent = null;
         try fRet.check(c.f_open(&self.handle, path, mode));
 
+        if ((0 == (mode & @intFromEnum(fMode.write))) and (self.size() >= config.fatfs_fast_seek_min_size)) {
+            _ = self.enableFastSeek() catch false;
+        }
+
         return self;
     }
 
     /// Close the current file
     pub inline fn close(self: *@This()) frError!void {
+        defer self.disableFastSeek();
         try fRet.check(c.f_close(&self.handle));
     }
 
+    /// Build a link map of the file, so seeks no longer follow the FAT chain.
+    /// Returns false if no map is available or the file is too fragmented for one.
+    /// The file can not grow while the map is in use.
+    pub fn enableFastSeek(self: *@This()) frError!bool {
+        if (null != self.link_map) return true;
+
+        const map = linkMap.acquire() orelse return false;
+
+        map.table[0] = map.table.len;
+        self.handle.cltbl = &map.table;
+
+        fRet.check(c.f_lseek(&self.handle, std.math.maxInt(FSIZE_t))) catch |err| {
+            self.handle.cltbl = null;
+            map.release();
+            return if (err == frError.FR_NOT_ENOUGH_CORE) false else err;
+        };
+
+        self.link_map = map;
+
+        // A single fragment: the file is contiguous
+        if ((map.table[1] != 0) and (map.table[3] == 0)) {
+            self.extent = self.clusterExtent(map.table[2]);
+        }
+
+        return true;
+    }
+
+    /// Drop the link map and return it to the pool
+    pub fn disableFastSeek(self: *@This()) void {
+        if (self.link_map) |map| {
+            self.handle.cltbl = null;
+            self.link_map = null;
+            map.release();
+        }
+    }
+
+    fn clusterExtent(self: *const @This(), cluster: c.DWORD) sectorExtent {
+        const fs = self.handle.obj.fs;
+
+        return .{ .sector = fs.*.database + (cluster - 2) * fs.*.csize, .count = (c.f_size(&self.handle) + sector_size - 1) / sector_size };
+    }
+
+    /// Reserve a contiguous area of `len` bytes for an empty file opened for writing
+    /// The file size is set to `len` and the allocation is committed right away. Afterwards
+    /// `writeRaw` and `readRaw` transfer whole sectors without touching the FAT.
+    /// Fails with `FR_DENIED` if the volume has no contiguous free area of this size.
+    pub fn preallocate(self: *@This(), len: usize) frError!void {
+        try fRet.check(c.f_expand(&self.handle, len, 1));
+        try self.sync();
+
+        self.extent = self.clusterExtent(self.handle.obj.sclust);
+    }
+
+    /// Lock the volume and check a raw transfer. Returns the first sector.
+    fn rawBegin(self: *@This(), offset: usize, len: usize) frError!c.LBA_t {
+        const ext = self.extent orelse return frError.FR_DENIED;
+
+        if (((offset % sector_size) != 0) or ((offset + len) > (ext.count * sector_size))) {
+            return frError.FR_INVALID_PARAMETER;
+        }
+
+        // Buffered data of the file has to reach the disk first
+        if (0 != (self.handle.flag & FA_DIRTY)) {
+            try self.sync();
+        }
+
+        if (0 == c.ff_mutex_take(self.handle.obj.fs.*.ldrv)) return frError.FR_TIMEOUT;
+
+        return ext.sector + @as(c.LBA_t, @intCast(offset / sector_size));
+    }
+
+    fn rawEnd(self: *@This()) void {
+        c.ff_mutex_give(self.handle.obj.fs.*.ldrv);
+    }
+
+    fn diskCheck(res: c.DRESULT) frError!void {
+        return switch (res) {
+            c.RES_OK => {},
+            c.RES_NOTRDY => frError.FR_NOT_READY,
+            else => frError.FR_DISK_ERR,
+        };
+    }
+
+    /// Write `data` straight to the sectors of a contiguous file, starting at the sector aligned `offset`
+    /// The rest of a trailing partial sector is cleared. The file pointer does not move.
+    pub fn writeRaw(self: *@This(), offset: usize, data: []const u8) frError!void {
+        const sector = try self.rawBegin(offset, data.len);
+        defer self.rawEnd();
+
+        const pdrv = self.handle.obj.fs.*.pdrv;
+        const whole = data.len / sector_size;
+        const tail = data.len % sector_size;
+
+        // The file buffer must not keep an outdated copy
+        if ((self.handle.sect >= sector) and (self.handle.sect < (sector + whole + 1))) {
+            self.handle.sect = 0;
+        }
+
+        if (whole != 0) {
+            try diskCheck(c.disk_write(pdrv, data.ptr, sector, @intCast(whole)));
+        }
+
+        if (tail != 0) {
+            @memcpy(raw_sector[0..tail], data[whole * sector_size ..]);
+            @memset(raw_sector[tail..], 0);
+            try diskCheck(c.disk_write(pdrv, &raw_sector, sector + @as(c.LBA_t, @intCast(whole)), 1));
+        }
+    }
+
+    /// Read the sectors of a contiguous file straight into `buf`, starting at the sector aligned `offset`
+    /// Returns the data read, which ends at the end of the file. The file pointer does not move.
+    pub fn readRaw(self: *@This(), offset: usize, buf: []u8) frError![]u8 {
+        const len = @min(buf.len, c.f_size(&self.handle) -| offset);
+        const sector = try self.rawBegin(offset, len);
+        defer self.rawEnd();
+
+        const pdrv = self.handle.obj.fs.*.pdrv;
+        const whole = len / sector_size;
+        const tail = len % sector_size;
+
+        if (whole != 0) {
+            try diskCheck(c.disk_read(pdrv, buf.ptr, sector, @intCast(whole)));
+        }
+
+        if (tail != 0) {
+            try diskCheck(c.disk_read(pdrv, &raw_sector, sector + @as(c.LBA_t, @intCast(whole)), 1));
+            @memcpy(buf[whole * sector_size .. len], raw_sector[0..tail]);
+        }
+
+        return buf[0..len];
+    }
+
     /// Read a slice of bytes from the current open file
     pub fn read(self: *@This(), buf: []u8) frError![]u8 {
         var bytesRead: usize = 0;
@@ -232,11 +417,30 @@ pub const file = struct {
 };
 
 /// Mount a volume into the global file system
+/// The FAT and the fixed root directory are pinned in the sector cache
 pub fn mount(volume: [*:0]const u8) frError!void {
     try fRet.check(c.f_mount(&fileSystem, volume, 1));
+
+    c.disk_cache_set_metadata(fileSystem.fatbase, fileSystem.database);
 }
 
 /// Unmount a volume from the global file system
+/// Cached sectors are written to the disk before the volume is released
 pub fn unmount(volume: [*:0]const u8) frError!void {
+    _ = c.disk_cache_flush(fileSystem.pdrv);
+    c.disk_cache_set_metadata(0, 0);
+
     try fRet.check(c.f_unmount(volume));
 }
+
+/// Sector cache statistics
+pub const cacheStats = c.disk_cache_stats_t;
+
+/// Read the sector cache statistics
+pub fn cacheStatistics() cacheStats {
+    var stats: cacheStats = undefined;
+
+    c.disk_cache_get_stats(&stats);
+
+    return stats;
+}
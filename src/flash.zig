@@ -0,0 +1,89 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! Internal flash erase and program through the flash HAL (flash_hal.h)
+//!
+//! Reads go through `region`, which is memory mapped on the target. Erase and program go through
+//! the HAL, so the locked range applies. Host builds keep the flash in `host_memory` and hand it to
+//! the simulator (csrc/host/flash_sim.c), so the update code runs unchanged on the host.
+
+const builtin = @import("builtin");
+const chips = @import("chips.zig");
+const c = @cImport({
+    @cInclude("board.h");
+    @cInclude("flash_hal.h");
+});
+
+/// Erase unit
+pub const page_size: usize = c.FLASH_HAL_PAGE_SIZE;
+
+pub const flash_error = error{
+    invalid_address,
+    locked,
+    timeout,
+    failed,
+};
+
+fn check(status: c.flash_hal_status_t) flash_error!void {
+    return switch (status) {
+        c.FLASH_HAL_OK => {},
+        c.FLASH_HAL_ERR_ADDRESS => flash_error.invalid_address,
+        c.FLASH_HAL_ERR_LOCKED => flash_error.locked,
+        c.FLASH_HAL_ERR_TIMEOUT => flash_error.timeout,
+        else => flash_error.failed,
+    };
+}
+
+/// Host builds simulate the flash, see `host_memory`
+const host = (builtin.os.tag != .freestanding);
+
+/// Flash content of host builds, at flash address 0. Pass it to `flash_sim_open`.
+pub var host_memory: [if (host) chips.FLASH_SIZE else 0]u8 align(@alignOf(u32)) = undefined;
+
+/// The `len` bytes of flash at `start`, to read in place
+pub fn region(comptime start: usize, comptime len: usize) []u8 {
+    if (host) return host_memory[start..(start + len)];
+
+    return @as([*]u8, @ptrFromInt(start))[0..len];
+}
+
+inline fn address(ptr: [*]const u8) u32 {
+    if (host) return @intCast(@intFromPtr(ptr) - @intFromPtr(&host_memory));
+
+    return @intCast(@intFromPtr(ptr));
+}
+
+/// Erase the page starting at the page aligned `page`
+pub inline fn erasePage(page: [*]const u8) flash_error!void {
+    try check(c.flash_hal_erase_page(address(page)));
+}
+
+/// Program `data`, a multiple of words, at the word aligned `dest`
+pub inline fn writeWords(dest: [*]const u8, data: []const u8) flash_error!void {
+    try check(c.flash_hal_write_words(address(dest), data.ptr, @intCast(data.len)));
+}
+
+/// Reject erase and program of the `len` bytes at `start` until `unlock`
+pub inline fn lock(start: usize, len: usize) void {
+    c.flash_hal_lock(@intCast(start), @intCast(len));
+}
+
+pub inline fn unlock() void {
+    c.flash_hal_unlock();
+}
@@ -60,6 +60,7 @@ pub const pdFALSE = c.pdFALSE;
 
 pub const portMAX_DELAY = c.portMAX_DELAY;
 pub const pdMS_TO_TICKS = c.pdMS_TO_TICKS;
+pub const portTICK_PERIOD_MS = c.portTICK_PERIOD_MS;
 
 // Scheduler State
 const eTaskSchedulerState = enum(BaseType_t) { taskSCHEDULER_NOT_STARTED = c.taskSCHEDULER_NOT_STARTED, taskSCHEDULER_SUSPENDED = c.taskSCHEDULER_SUSPENDED, taskSCHEDULER_RUNNING = c.taskSCHEDULER_RUNNING };
@@ -119,6 +120,16 @@ pub fn xTaskGetTickCount() TickType_t {
     return c.xTaskGetTickCount();
 }
 
+/// Currently free heap in bytes
+pub fn xPortGetFreeHeapSize() usize {
+    return c.xPortGetFreeHeapSize();
+}
+
+/// Lowest free heap since boot in bytes
+pub fn xPortGetMinimumEverFreeHeapSize() usize {
+    return c.xPortGetMinimumEverFreeHeapSize();
+}
+
 pub inline fn portYIELD_FROM_ISR(xSwitchRequired: BaseType_t) void {
     if (xSwitchRequired != pdFALSE) {
         portYIELD();
@@ -0,0 +1,177 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/// TLS handshake profiler
+///
+/// Records, for every handshake state of a `TlsContext`, the wall time, the time spent in
+/// handshake steps that made progress (CPU time), the bytes exchanged with the peer and the
+/// heap peak. Every completed state is logged as a compact line and the last `history_len`
+/// records are kept in RAM.
+///
+/// Times are in RTOS ticks (1 ms).
+const std = @import("std");
+const freertos = @import("freertos.zig");
+const c = @cImport({
+    @cInclude("board.h");
+});
+
+/// Number of records kept in RAM
+pub const history_len: usize = 32;
+
+/// Profile of a single handshake state
+pub const Record = struct {
+    /// mbedTLS handshake state (`mbedtls_ssl_states`)
+    state: i32,
+    /// Time spent in the state, including waiting for the peer
+    wall_ticks: u32,
+    /// Time spent in handshake steps that did not return WANT_READ/WANT_WRITE
+    cpu_ticks: u32,
+    /// Bytes sent to the peer
+    tx_bytes: u32,
+    /// Bytes received from the peer
+    rx_bytes: u32,
+    /// Heap peak in bytes, relative to the free heap when entering the state
+    heap_peak: u32,
+};
+
+/// Ring buffer of the last records
+var history: [history_len]Record = undefined;
+
+/// Next write position in the ring buffer
+var history_head: usize = 0;
+
+/// Number of valid records in the ring buffer
+var history_count: usize = 0;
+
+fn push(record: Record) void {
+    history[history_head] = record;
+    history_head = (history_head + 1) % history_len;
+    if (history_count < history_len) {
+        history_count += 1;
+    }
+}
+
+/// Get a stored record. Index 0 is the oldest record.
+pub fn getRecord(idx: usize) ?Record {
+    if (idx >= history_count) return null;
+
+    return history[(history_head + history_len - history_count + idx) % history_len];
+}
+
+/// Number of stored records
+pub fn count() usize {
+    return history_count;
+}
+
+/// Log a record
+fn log(record: *const Record) void {
+    _ = c.printf("hs %d: wall %d cpu %d tx %d rx %d heap %d\r\n", record.state, record.wall_ticks, record.cpu_ticks, record.tx_bytes, record.rx_bytes, record.heap_peak);
+}
+
+/// Log all stored records, oldest first
+pub fn dump() void {
+    var idx: usize = 0;
+    while (getRecord(idx)) |record| : (idx += 1) {
+        log(&record);
+    }
+}
+
+/// Handshake profiler instance, owned by a TLS context
+pub const Profiler = struct {
+    /// Record of the current state
+    record: Record = undefined,
+    /// Tick when the current state was entered
+    state_start: freertos.TickType_t = 0,
+    /// Free heap when the current state was entered
+    heap_free_start: usize = 0,
+    /// Lowest free heap seen in the current state
+    heap_free_min: usize = 0,
+    /// Handshake in progress
+    active: bool = false,
+
+    fn enter(self: *@This(), state: i32) void {
+        self.record = .{ .state = state, .wall_ticks = 0, .cpu_ticks = 0, .tx_bytes = 0, .rx_bytes = 0, .heap_peak = 0 };
+        self.state_start = freertos.xTaskGetTickCount();
+        self.heap_free_start = freertos.xPortGetFreeHeapSize();
+        self.heap_free_min = self.heap_free_start;
+    }
+
+    fn sampleHeap(self: *@This()) void {
+        const free_heap = freertos.xPortGetFreeHeapSize();
+        if (free_heap < self.heap_free_min) {
+            self.heap_free_min = free_heap;
+        }
+    }
+
+    fn commit(self: *@This()) void {
+        self.record.wall_ticks = freertos.xTaskGetTickCount() -% self.state_start;
+        self.record.heap_peak = @intCast(self.heap_free_start - self.heap_free_min);
+
+        push(self.record);
+        log(&self.record);
+    }
+
+    /// Start profiling a handshake in the given state
+    pub fn start(self: *@This(), state: i32) void {
+        self.active = true;
+        self.enter(state);
+    }
+
+    /// Account a call to `mbedtls_ssl_handshake_step`
+    /// - state: handshake state after the step
+    /// - progressed: the step did not wait for the network
+    /// - step_ticks: duration of the step
+    pub fn step(self: *@This(), state: i32, progressed: bool, step_ticks: freertos.TickType_t) void {
+        if (!self.active) return;
+
+        if (progressed) {
+            self.record.cpu_ticks += step_ticks;
+        }
+        self.sampleHeap();
+
+        if (state != self.record.state) {
+            self.commit();
+            self.enter(state);
+        }
+    }
+
+    /// Account bytes sent to the peer
+    pub fn sent(self: *@This(), len: c_int) void {
+        if (self.active and (len > 0)) {
+            self.record.tx_bytes += @intCast(len);
+            self.sampleHeap();
+        }
+    }
+
+    /// Account bytes received from the peer
+    pub fn received(self: *@This(), len: c_int) void {
+        if (self.active and (len > 0)) {
+            self.record.rx_bytes += @intCast(len);
+            self.sampleHeap();
+        }
+    }
+
+    /// Finish profiling the handshake
+    pub fn finish(self: *@This()) void {
+        if (!self.active) return;
+
+        self.commit();
+        self.active = false;
+    }
+};
@@ -0,0 +1,213 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! File system benchmark for the host
+//!
+//! Runs the FatFs facade (`fatfs.zig`), the sector cache (disk_cache.c) and FatFs on Linux, with
+//! the SD card replaced by a disk image (csrc/host/sdmm_image.c). Every scenario reports the card
+//! time of the SD card model, the commands and sectors it caused and the sector cache counters.
+//! The card time is the figure to compare, the host time only shows the CPU cost on the host.
+//!
+//! Build and run with `zig build host-fs-bench [-- image]`. The image, `fs-bench.img` by default,
+//! is created and formatted on every run.
+const std = @import("std");
+const fatfs = @import("fatfs.zig");
+const config = @import("config.zig");
+const c = @cImport({
+    @cInclude("ff.h");
+    @cInclude("disk_cache.h");
+    @cInclude("sdmm_image.h");
+});
+
+/// Size of the disk image, formatted as FAT32
+const image_size: u64 = 256 * 1024 * 1024;
+
+/// Sequential transfers
+const seq_file_name = "SD:SEQ.BIN";
+const seq_file_size: usize = 4 * 1024 * 1024;
+const seq_block_size: usize = 4096;
+
+/// Small files, e.g. configuration and certificates
+const small_file_count: usize = 32;
+const small_file_size: usize = 256;
+
+/// Log records, each one synced
+const log_file_name = "SD:LOG.TXT";
+const log_record_count: usize = 128;
+const log_record_size: usize = 64;
+
+const bench_error = error{
+    image_error,
+    mkfs_error,
+    flush_error,
+};
+
+var block: [seq_block_size]u8 = undefined;
+
+fn sequentialWrite() anyerror!usize {
+    var f = try fatfs.file.open(seq_file_name, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+    defer f.close() catch {};
+
+    var pos: usize = 0;
+    while (pos < seq_file_size) : (pos += block.len) {
+        @memset(&block, @truncate(pos / block.len));
+        _ = try f.write(&block);
+    }
+
+    return seq_file_size;
+}
+
+fn sequentialRead() anyerror!usize {
+    var f = try fatfs.file.open(seq_file_name, @intFromEnum(fatfs.file.fMode.read));
+    defer f.close() catch {};
+
+    var len: usize = 0;
+    while (try f.readEof(&block)) |data| {
+        len += data.len;
+    }
+
+    return len;
+}
+
+fn smallFileCreate() anyerror!usize {
+    var name_buf: [16]u8 = undefined;
+
+    @memset(block[0..small_file_size], 'c');
+
+    for (0..small_file_count) |i| {
+        const name = try std.fmt.bufPrintZ(&name_buf, "SD:S{d:0>3}.TXT", .{i});
+
+        var f = try fatfs.file.open(name.ptr, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+        defer f.close() catch {};
+
+        _ = try f.write(block[0..small_file_size]);
+    }
+
+    return small_file_count * small_file_size;
+}
+
+fn appendWithSync() anyerror!usize {
+    var f = try fatfs.file.open(log_file_name, @intFromEnum(fatfs.file.fMode.open_append) | @intFromEnum(fatfs.file.fMode.write));
+    defer f.close() catch {};
+
+    @memset(block[0..log_record_size], 'l');
+    block[log_record_size - 1] = '\n';
+
+    for (0..log_record_count) |_| {
+        _ = try f.write(block[0..log_record_size]);
+        try f.sync();
+    }
+
+    return log_record_count * log_record_size;
+}
+
+/// Hashes in `config.file_block_size` reads, like `config.calculateFileHash`
+/// SHA-256 of the standard library stands in for mbedTLS, the host cost is not the target's anyway.
+fn largeFileHash() anyerror!usize {
+    var hash: [32]u8 = undefined;
+    var len: usize = 0;
+
+    var f = try fatfs.file.open(seq_file_name, @intFromEnum(fatfs.file.fMode.read));
+    defer f.close() catch {};
+
+    var sha = std.crypto.hash.sha2.Sha256.init(.{});
+
+    while (try f.readEof(block[0..config.file_block_size])) |data| {
+        sha.update(data);
+        len += data.len;
+    }
+
+    sha.final(&hash);
+
+    return len;
+}
+
+fn run(out: anytype, name: []const u8, scenario: *const fn () anyerror!usize) !void {
+    var card: c.sdmm_image_stats_t = undefined;
+    const before = fatfs.cacheStatistics();
+
+    c.sdmm_image_reset_stats();
+
+    var timer = try std.time.Timer.start();
+
+    const len = try scenario();
+
+    // Dirty sectors are charged to the scenario that wrote them
+    if (c.disk_cache_flush(0) != c.RES_OK) return bench_error.flush_error;
+
+    const host_us = timer.read() / std.time.ns_per_us;
+
+    c.sdmm_image_get_stats(&card);
+    const after = fatfs.cacheStatistics();
+
+    const card_us = card.elapsed_us;
+    const kib_s = if (card_us != 0) (@as(u64, len) * std.time.us_per_s) / (card_us * 1024) else 0;
+
+    try out.print("{s:<16} {d:>8} {d:>10} {d:>8} {d:>6} {d:>7} {d:>7} {d:>5} {d:>7} {d:>7} {d:>7} {d:>9}\n", .{
+        name,
+        len,
+        card_us / std.time.us_per_ms,
+        kib_s,
+        card.commands,
+        card.sectors_read,
+        card.sectors_written,
+        card.syncs,
+        after.hits - before.hits,
+        after.misses - before.misses,
+        after.read_ahead - before.read_ahead,
+        host_us,
+    });
+}
+
+fn format(path: [:0]const u8) !void {
+    var work: [c.FF_MAX_SS]u8 = undefined;
+    const opt = c.MKFS_PARM{ .fmt = c.FM_FAT32, .n_fat = 0, .@"align" = 0, .n_root = 0, .au_size = 0 };
+
+    var image = try std.fs.cwd().createFile(path, .{ .truncate = true });
+    defer image.close();
+
+    // Sparse, only the written sectors take space
+    try image.setEndPos(image_size);
+
+    if (0 != c.sdmm_image_open(path.ptr, null)) return bench_error.image_error;
+
+    if (c.f_mkfs("SD:", &opt, &work, @intCast(work.len)) != c.FR_OK) return bench_error.mkfs_error;
+}
+
+pub fn main() !void {
+    const out = std.io.getStdOut().writer();
+
+    var args = std.process.args();
+    _ = args.skip();
+    const path = args.next() orelse "fs-bench.img";
+
+    try format(path);
+    defer c.sdmm_image_close();
+
+    try fatfs.mount("SD");
+    defer fatfs.unmount("SD") catch {};
+
+    try out.print("{s:<16} {s:>8} {s:>10} {s:>8} {s:>6} {s:>7} {s:>7} {s:>5} {s:>7} {s:>7} {s:>7} {s:>9}\n", .{ "scenario", "bytes", "card ms", "KiB/s", "cmds", "rd sect", "wr sect", "syncs", "hits", "misses", "ahead", "host us" });
+
+    try run(out, "sequential write", sequentialWrite);
+    try run(out, "sequential read", sequentialRead);
+    try run(out, "small files", smallFileCreate);
+    try run(out, "append + sync", appendWithSync);
+    try run(out, "hash large file", largeFileHash);
+}
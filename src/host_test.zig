@@ -0,0 +1,821 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//! Tests for the host
+//!
+//! Runs the update code on Linux with the stand-ins of the update benchmark: the flash is
+//! csrc/host/flash_sim.c on top of `flash.host_memory`, NVM3 is csrc/host/nvm3_sim.c and the SD card
+//! is a disk image (csrc/host/sdmm_image.c). Every test starts with an erased flash and an empty
+//! NVM3, the update tests with a freshly formatted card.
+//!
+//! Build and run with `zig build host-test`.
+const std = @import("std");
+const nvm = @import("nvm.zig");
+const flash = @import("flash.zig");
+const fatfs = @import("fatfs.zig");
+const config = @import("config.zig");
+const staging = @import("boot/staging.zig");
+const firmware = @import("boot/firmware.zig");
+const app = @import("boot/app.zig");
+const appDigest = @import("boot/appDigest.zig");
+const backup = @import("boot/backup.zig");
+const inflate = @import("inflate.zig");
+const delta = @import("delta.zig");
+const c = @cImport({
+    @cInclude("ff.h");
+    @cInclude("disk_cache.h");
+    @cInclude("sdmm_image.h");
+    @cInclude("flash_sim.h");
+    @cInclude("nvm3_sim.h");
+});
+
+const Sha256 = std.crypto.hash.sha2.Sha256;
+const Ecdsa = std.crypto.sign.ecdsa.EcdsaP256Sha256;
+
+/// Disk image of the update tests, removed by `closeCard`
+const card_path = "host-test.img";
+const card_size: u64 = 64 * 1024 * 1024;
+
+/// mcuboot image layout as in the update benchmark: `--header-size 0x80 --pad-header --public-key-format full`
+const image_magic: u32 = 0x96f3b83d;
+const header_size: usize = 0x80;
+const payload_size: usize = 16 * firmware.flash_page_size;
+const image_capacity: usize = header_size + payload_size + 256;
+
+/// SubjectPublicKeyInfo of a P-256 key, followed by the uncompressed point
+const spki_prefix = [_]u8{ 0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00 };
+const spki_len: usize = spki_prefix.len + 65;
+
+var key: Ecdsa.KeyPair = undefined;
+var installed_buf: [image_capacity]u8 = undefined;
+var candidate_buf: [image_capacity]u8 = undefined;
+
+/// Erased flash and empty NVM3, undo with `close`
+fn open() !void {
+    if (0 != c.flash_sim_open(null, &flash.host_memory)) return error.flash_error;
+    errdefer c.flash_sim_close();
+
+    _ = c.nvm3_open(@ptrCast(&nvm.miso_nvm3), @ptrCast(&nvm.miso_nvm3_init));
+    try nvm.eraseAll();
+}
+
+fn close() void {
+    nvm.close();
+    c.flash_sim_close();
+}
+
+fn randomData(allocator: std.mem.Allocator, len: usize, seed: u64) ![]u8 {
+    var prng = std.rand.DefaultPrng.init(seed);
+    const data = try allocator.alloc(u8, len);
+
+    prng.random().bytes(data);
+
+    return data;
+}
+
+fn publicKeyInfo() [spki_len]u8 {
+    var info: [spki_len]u8 = undefined;
+
+    @memcpy(info[0..spki_prefix.len], &spki_prefix);
+    @memcpy(info[spki_prefix.len..], &key.public_key.toUncompressedSec1());
+
+    return info;
+}
+
+fn writeTlv(writer: anytype, tlv_type: u16, value: []const u8) !void {
+    try writer.writeIntLittle(u16, tlv_type);
+    try writer.writeIntLittle(u16, @intCast(value.len));
+    try writer.writeAll(value);
+}
+
+/// Signed image with a random payload in `buf`
+fn signedImage(buf: []u8, minor: u8, seed: u64) ![]u8 {
+    var payload: [payload_size]u8 = undefined;
+    var prng = std.rand.DefaultPrng.init(seed);
+
+    prng.random().bytes(&payload);
+
+    return signImage(buf, &payload, minor);
+}
+
+/// Signed image of `payload` in `buf`, laid out as imgtool signs it
+fn signImage(buf: []u8, payload: *const [payload_size]u8, minor: u8) ![]u8 {
+    var hdr = std.mem.zeroes(firmware.image_header);
+    var digest: [32]u8 = undefined;
+    var der: [Ecdsa.Signature.der_encoded_max_length]u8 = undefined;
+
+    @memcpy(buf[header_size..(header_size + payload_size)], payload);
+
+    hdr.ih_magic = image_magic;
+    hdr.ih_hdr_size = header_size;
+    hdr.ih_img_size = payload_size;
+    hdr.ih_ver.iv_minor = minor;
+
+    @memset(buf[0..header_size], 0);
+    @memcpy(buf[0..@sizeOf(firmware.image_header)], std.mem.asBytes(&hdr));
+
+    const signed = buf[0..(header_size + payload_size)];
+    Sha256.hash(signed, &digest, .{});
+    const sig = (try key.sign(signed, null)).toDer(&der);
+
+    const tlv_len = 4 + (4 + digest.len) + (4 + spki_len) + (4 + sig.len);
+    var tlv = std.io.fixedBufferStream(buf[signed.len..]);
+    const writer = tlv.writer();
+
+    try writer.writeIntLittle(u16, 0x6907);
+    try writer.writeIntLittle(u16, @intCast(tlv_len));
+    try writeTlv(writer, 0x10, &digest);
+    try writeTlv(writer, 0x02, &publicKeyInfo());
+    try writeTlv(writer, 0x22, sig);
+
+    return buf[0..(signed.len + tlv_len)];
+}
+
+/// Formatted card mounted as SD, undo with `closeCard`
+fn formatCard() !void {
+    var work: [c.FF_MAX_SS]u8 = undefined;
+    const opt = c.MKFS_PARM{ .fmt = c.FM_ANY, .n_fat = 0, .@"align" = 0, .n_root = 0, .au_size = 0 };
+
+    var image = try std.fs.cwd().createFile(card_path, .{ .truncate = true });
+    defer image.close();
+
+    // Sparse, only the written sectors take space
+    try image.setEndPos(card_size);
+
+    if (0 != c.sdmm_image_open(card_path, null)) return error.image_error;
+    errdefer c.sdmm_image_close();
+
+    // Sectors of the card of the last test must not reach this one
+    c.disk_cache_invalidate();
+
+    if (c.f_mkfs("SD:", &opt, &work, @intCast(work.len)) != c.FR_OK) return error.mkfs_error;
+    try fatfs.mount("SD");
+}
+
+/// Formatted card mounted as SD, `installed` in the application flash and its key provisioned
+fn openCard(installed: []const u8) !void {
+    var text: [256]u8 = undefined;
+
+    try formatCard();
+    errdefer closeCard();
+
+    @memcpy(firmware.fw[0..installed.len], installed);
+    _ = try nvm.init();
+    try nvm.setFirmwareSize(@intCast(installed.len));
+
+    const encoded = std.base64.standard.Encoder.encode(&text, &publicKeyInfo());
+    text[encoded.len] = 0;
+    config.c.config_set_http_sig_key(&text);
+}
+
+fn closeCard() void {
+    fatfs.unmount("SD") catch {};
+    c.sdmm_image_close();
+    std.fs.cwd().deleteFile(card_path) catch {};
+}
+
+fn storeFile(path: [*:0]const u8, data: []const u8) !void {
+    var f = try fatfs.file.open(path, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+    defer f.close() catch {};
+
+    _ = try f.write(data);
+}
+
+/// Put the candidate on the card as FW.BIN
+fn storeCandidate(image: []const u8) !void {
+    return storeFile(config.fw_file_name, image);
+}
+
+/// Change a few payload pages of `image` and sign it again as `minor`
+fn changedImage(buf: []u8, image: []const u8, minor: u8) ![]u8 {
+    var payload: [payload_size]u8 = undefined;
+
+    @memcpy(&payload, image[header_size..(header_size + payload_size)]);
+    for (0..4) |i| {
+        payload[(3 + (i * 3)) * firmware.flash_page_size] ^= 0xFF;
+    }
+
+    return signImage(buf, &payload, minor);
+}
+
+fn flashErases() u32 {
+    var stats: c.flash_sim_stats_t = undefined;
+
+    c.flash_sim_get_stats(&stats);
+
+    return stats.erases;
+}
+
+/// Stage `data[from..to]` in writes of `chunk` bytes
+fn stage(w: *staging.writer, data: []const u8, from: usize, to: usize, chunk: usize) !void {
+    var pos = from;
+
+    while (pos < to) {
+        const len = @min(chunk, to - pos);
+        try w.write(data[pos..(pos + len)]);
+        pos += len;
+    }
+}
+
+test "staging resumes at the last marker when a write crossed it" {
+    try open();
+    defer close();
+
+    const size = 3 * staging.marker_interval + 1234;
+    const data = try randomData(std.testing.allocator, size, 36);
+    defer std.testing.allocator.free(data);
+
+    // Writes of 700 bytes: the one that crosses the first marker also carries data behind it
+    var first: staging.writer = undefined;
+    try std.testing.expectEqual(@as(usize, 0), try first.begin(0x36, size, true));
+    try stage(&first, data, 0, staging.marker_interval + 2000, 700);
+
+    // Power loss: neither finished nor discarded
+    first.hasher.free();
+
+    var resumed: staging.writer = undefined;
+    const offset = try resumed.begin(0x36, size, true);
+    try std.testing.expectEqual(staging.marker_interval, offset);
+
+    try stage(&resumed, data, offset, size, 1000);
+    const digest = try resumed.finish();
+
+    var expected: [Sha256.digest_length]u8 = undefined;
+    Sha256.hash(data, &expected, .{});
+
+    try std.testing.expectEqualSlices(u8, &expected, &digest);
+    try std.testing.expectEqualSlices(u8, data, staging.region[0..size]);
+    try std.testing.expectEqual(@as(?usize, size), staging.pending());
+}
+
+test "staging starts over for another image" {
+    try open();
+    defer close();
+
+    const size = 2 * staging.marker_interval;
+    const data = try randomData(std.testing.allocator, size, 37);
+    defer std.testing.allocator.free(data);
+
+    var first: staging.writer = undefined;
+    _ = try first.begin(0x36, size, true);
+    try stage(&first, data, 0, staging.marker_interval + 512, 512);
+    first.hasher.free();
+
+    var other: staging.writer = undefined;
+    try std.testing.expectEqual(@as(usize, 0), try other.begin(0x37, size, true));
+    other.discard();
+
+    try std.testing.expectEqual(@as(?usize, null), staging.pending());
+}
+
+test "a signed candidate is installed" {
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 44);
+    const candidate = try signedImage(&candidate_buf, 2, 45);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeCandidate(candidate);
+
+    try std.testing.expectEqual(app.firmware_update_outcome.success, try app.firmwareUpdate());
+    try std.testing.expectEqualSlices(u8, candidate, firmware.fw[0..candidate.len]);
+}
+
+test "a candidate with a bad signature is rejected before anything is erased" {
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 44);
+    const candidate = try signedImage(&candidate_buf, 2, 45);
+    candidate[candidate.len - 1] ^= 0x01;
+
+    try openCard(installed);
+    defer closeCard();
+    try storeCandidate(candidate);
+
+    c.flash_sim_reset_stats();
+
+    try std.testing.expectError(firmware.firmware_error.firmware_candidate_not_valid, app.firmwareUpdate());
+    try std.testing.expectEqual(@as(u32, 0), flashErases());
+    try std.testing.expectEqualSlices(u8, installed, firmware.fw[0..installed.len]);
+}
+
+test "a backup is not restored over another application" {
+    var other_buf: [image_capacity]u8 = undefined;
+
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 46);
+    const candidate = try changedImage(&candidate_buf, installed, 2);
+    const other = try signedImage(&other_buf, 3, 47);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeCandidate(candidate);
+
+    try std.testing.expectEqual(app.firmware_update_outcome.success, try app.firmwareUpdate());
+
+    // Another application is installed, the backup of the update is left on the card
+    @memcpy(firmware.fw[0..other.len], other);
+    c.flash_sim_reset_stats();
+
+    try std.testing.expectEqual(app.firmware_update_outcome.restore_failed, try app.firmwareRestore());
+    try std.testing.expectEqual(@as(u32, 0), flashErases());
+    try std.testing.expectEqualSlices(u8, other, firmware.fw[0..other.len]);
+}
+
+test "a backup that does not verify is restored a bounded number of times" {
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 48);
+    const candidate = try changedImage(&candidate_buf, installed, 2);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeCandidate(candidate);
+
+    try std.testing.expectEqual(app.firmware_update_outcome.success, try app.firmwareUpdate());
+
+    // Damage a stored page, behind the header sector
+    {
+        var f = try fatfs.file.open(config.app_backup_file_name, @intFromEnum(fatfs.file.fMode.read) | @intFromEnum(fatfs.file.fMode.write));
+        defer f.close() catch {};
+        var byte: [1]u8 = undefined;
+
+        try f.lseek(fatfs.sector_size + 100);
+        _ = try f.read(&byte);
+        byte[0] ^= 0xFF;
+        try f.lseek(fatfs.sector_size + 100);
+        _ = try f.write(&byte);
+    }
+
+    c.flash_sim_reset_stats();
+
+    try std.testing.expectEqual(app.firmware_update_outcome.restore_failed, try app.firmwareRestore());
+
+    // The changed pages of every attempt, nothing more
+    try std.testing.expect(flashErases() <= (config.update_restore_attempts * 6));
+}
+
+/// First phase the update entered, and the times it entered `backup`
+var first_phase: ?app.update_phase = null;
+var backups: u32 = 0;
+
+fn recordPhase(phase: app.update_phase) void {
+    if (first_phase == null) first_phase = phase;
+    if (phase == app.update_phase.backup) backups += 1;
+}
+
+test "an update interrupted while programming resumes from the journal" {
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 49);
+    const candidate = try signedImage(&candidate_buf, 2, 50);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeCandidate(candidate);
+
+    // Every page changes: the power is lost on the fourth page programmed
+    const pages: u32 = @intCast((candidate.len + firmware.flash_page_size - 1) / firmware.flash_page_size);
+    c.flash_sim_power_fail_after(pages + 4);
+
+    if (app.firmwareUpdate()) |_| return error.TestUnexpectedResult else |_| {}
+
+    c.flash_sim_power_cycle();
+
+    first_phase = null;
+    backups = 0;
+    app.phase_observer = &recordPhase;
+    defer app.phase_observer = null;
+
+    try std.testing.expectEqual(app.firmware_update_outcome.success, try app.firmwareUpdate());
+
+    // The backup of the first run is kept, the pages are erased and programmed again
+    try std.testing.expectEqual(@as(?app.update_phase, app.update_phase.erase_flash), first_phase);
+    try std.testing.expectEqual(@as(u32, 0), backups);
+    try std.testing.expectEqualSlices(u8, candidate, firmware.fw[0..candidate.len]);
+}
+
+/// zlib streams of Python's `zlib.compressobj(level, wbits=12)`, the window of the HTTP client and
+/// the bootloader
+const hello = "Hello, Hello, Hello, Hello!";
+const hello_stored = [_]u8{ 0x48, 0x0d, 0x01, 0x1b, 0x00, 0xe4, 0xff } ++ hello ++ [_]u8{ 0x7d, 0x2c, 0x08, 0xd6 };
+const hello_fixed = [_]u8{ 0x48, 0xc7, 0xf3, 0x48, 0xcd, 0xc9, 0xc9, 0xd7, 0x51, 0xf0, 0xc0, 0xa4, 0x14, 0x01, 0x7d, 0x2c, 0x08, 0xd6 };
+/// The same with the default window, wbits=15
+const hello_window_32k = [_]u8{ 0x78, 0xda, 0xf3, 0x48, 0xcd, 0xc9, 0xc9, 0xd7, 0x51, 0xf0, 0xc0, 0xa4, 0x14, 0x01, 0x7d, 0x2c, 0x08, 0xd6 };
+
+/// `lettersAndFox` at level 9: dynamic Huffman codes and a match 3756 bytes back
+const letters_dynamic = [_]u8{
+    0x48, 0xc7, 0xed, 0xd7, 0xcb, 0x75, 0x04, 0x20, 0x08, 0x05, 0xd0, 0x56, 0x6c, 0x0d, 0x01, 0x11,
+    0x04, 0x21, 0x93, 0x4c, 0x7e, 0xd5, 0xc7, 0x34, 0x91, 0x4d, 0x5c, 0x73, 0x39, 0xef, 0xb1, 0x04,
+    0xba, 0x39, 0xcb, 0x9e, 0x82, 0x31, 0x16, 0x93, 0x2e, 0x08, 0x07, 0x27, 0x66, 0xab, 0x10, 0x89,
+    0xf0, 0xb9, 0x44, 0x53, 0xad, 0x2a, 0x31, 0x64, 0x63, 0xb2, 0xb2, 0x64, 0x79, 0xe7, 0x4c, 0xc1,
+    0x45, 0xa9, 0x33, 0xc4, 0x16, 0x89, 0xe0, 0x2c, 0x1b, 0x2c, 0xdd, 0x99, 0x60, 0x4f, 0x95, 0x60,
+    0xf4, 0x7e, 0x16, 0x94, 0x14, 0xbc, 0x08, 0xca, 0x7d, 0x74, 0xf6, 0xac, 0x5e, 0x4b, 0x00, 0xa5,
+    0x06, 0x9b, 0xe2, 0x06, 0xe6, 0xe1, 0x48, 0xc5, 0x27, 0x84, 0x56, 0x30, 0x9f, 0x16, 0x84, 0x39,
+    0xe2, 0xb7, 0x85, 0x2e, 0x9b, 0xac, 0xa3, 0xab, 0x81, 0x4f, 0x2e, 0x9f, 0x68, 0x8b, 0x87, 0x90,
+    0x9a, 0x77, 0x89, 0x29, 0x16, 0x7b, 0xd5, 0x80, 0x35, 0x26, 0x44, 0x3f, 0xb4, 0x17, 0x9e, 0x3e,
+    0x45, 0xe7, 0xa8, 0x58, 0xdd, 0x98, 0xb0, 0x63, 0x71, 0x25, 0x88, 0xc0, 0xd8, 0x2a, 0x10, 0x73,
+    0x1a, 0xaa, 0x0f, 0xd9, 0xc2, 0x54, 0xba, 0xe9, 0x6d, 0x72, 0x7b, 0x79, 0x2a, 0xae, 0xd6, 0x1f,
+    0xf9, 0xb1, 0xdb, 0xc8, 0xcf, 0x66, 0xcf, 0xa8, 0xd7, 0x96, 0xef, 0xfc, 0x68, 0xbf, 0x63, 0x87,
+    0xef, 0xaf, 0x46, 0x29, 0xed, 0xda, 0x6b, 0xaf, 0xbd, 0xf6, 0xda, 0x6b, 0xaf, 0xbd, 0xf6, 0xda,
+    0x6b, 0xaf, 0xbd, 0xf6, 0xda, 0xbf, 0xb1, 0xf0, 0xcf, 0x7f, 0xd5, 0x1f, 0x14, 0x0e, 0xd1, 0x98,
+};
+
+/// 256 letters, 3500 bytes of text and the same letters again
+fn lettersAndFox(buf: *[4012]u8) void {
+    const fox = "the quick brown fox jumps over the lazy dog ";
+    var x: u32 = 33;
+
+    for (buf[0..256]) |*b| {
+        x = (x *% 1103515245) +% 12345;
+        b.* = 'a' + @as(u8, @truncate((x >> 16) & 0x0F));
+    }
+    for (buf[256..3756], 0..) |*b, i| {
+        b.* = fox[i % fox.len];
+    }
+    @memcpy(buf[3756..], buf[0..256]);
+}
+
+/// Hands out the stream in pieces of 7 bytes, so codes straddle the pieces
+const pieceSource = struct {
+    data: []const u8,
+
+    pub fn next(self: *@This()) !?[]const u8 {
+        if (self.data.len == 0) return null;
+
+        const piece = self.data[0..@min(7, self.data.len)];
+        self.data = self.data[piece.len..];
+
+        return piece;
+    }
+};
+
+const bufferSink = struct {
+    buf: [8192]u8 = undefined,
+    len: usize = 0,
+
+    pub fn write(self: *@This(), data: []const u8) !void {
+        if ((self.len + data.len) > self.buf.len) return error.NoSpaceLeft;
+
+        @memcpy(self.buf[self.len..(self.len + data.len)], data);
+        self.len += data.len;
+    }
+};
+
+const testInflater = inflate.Inflater(config.http_inflate_window_bits, pieceSource, bufferSink);
+
+fn inflateAll(stream: []const u8, sink: *bufferSink) !void {
+    var inflater: testInflater = .{};
+    var source = pieceSource{ .data = stream };
+
+    inflater.init(&source, sink);
+    try inflater.run();
+}
+
+test "zlib streams are inflated" {
+    var expected: [4012]u8 = undefined;
+
+    lettersAndFox(&expected);
+
+    const vectors = [_]struct { stream: []const u8, data: []const u8 }{
+        .{ .stream = &hello_stored, .data = hello },
+        .{ .stream = &hello_fixed, .data = hello },
+        .{ .stream = &letters_dynamic, .data = &expected },
+    };
+
+    for (vectors) |v| {
+        var sink = bufferSink{};
+
+        try inflateAll(v.stream, &sink);
+        try std.testing.expectEqualSlices(u8, v.data, sink.buf[0..sink.len]);
+    }
+}
+
+test "zlib streams that do not fit or do not check are rejected" {
+    var sink = bufferSink{};
+    var damaged = hello_fixed;
+
+    try std.testing.expectError(inflate.inflate_error.window_too_large, inflateAll(&hello_window_32k, &sink));
+
+    damaged[damaged.len - 1] ^= 0x01;
+    try std.testing.expectError(inflate.inflate_error.checksum_mismatch, inflateAll(&damaged, &sink));
+    try std.testing.expectError(inflate.inflate_error.unexpected_end, inflateAll(hello_fixed[0..(hello_fixed.len - 6)], &sink));
+}
+
+/// Compressed container of `image` in `buf`: the container header and a zlib stream of stored blocks
+fn compressedImage(buf: []u8, image: []const u8) ![]u8 {
+    var out = std.io.fixedBufferStream(buf);
+    const writer = out.writer();
+    var rem = image;
+
+    try writer.writeIntLittle(u32, 0x5A57464D); // "MFWZ"
+    try writer.writeIntLittle(u32, @intCast(image.len));
+
+    // 4 KiB window, no compression
+    try writer.writeAll(&[_]u8{ 0x48, 0x0d });
+    while (rem.len != 0) {
+        const len: u16 = @intCast(@min(rem.len, 4000));
+        const final: u8 = if (len == rem.len) 1 else 0;
+
+        try writer.writeByte(final);
+        try writer.writeIntLittle(u16, len);
+        try writer.writeIntLittle(u16, ~len);
+        try writer.writeAll(rem[0..len]);
+        rem = rem[len..];
+    }
+    try writer.writeIntBig(u32, std.hash.Adler32.hash(image));
+
+    return out.getWritten();
+}
+
+test "a compressed candidate is installed" {
+    var compressed_buf: [image_capacity + 256]u8 = undefined;
+
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 51);
+    const candidate = try changedImage(&candidate_buf, installed, 2);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeCandidate(try compressedImage(&compressed_buf, candidate));
+
+    try std.testing.expectEqual(app.firmware_update_outcome.success, try app.firmwareUpdate());
+    try std.testing.expectEqualSlices(u8, candidate, firmware.fw[0..candidate.len]);
+}
+
+/// Patch from `base` to `image` in `buf`, as `invoke make-delta` lays it out
+/// Equal pages are copied, changed ones added, the bytes behind the base inserted.
+fn deltaPatch(buf: []u8, base: []const u8, image: []const u8) ![]u8 {
+    var out = std.io.fixedBufferStream(buf);
+    const writer = out.writer();
+    var base_sha256: [32]u8 = undefined;
+    var pos: usize = 0;
+
+    Sha256.hash(base, &base_sha256, .{});
+
+    try writer.writeAll("MDLT");
+    try writer.writeAll(&[_]u8{ 1, 0, 0, 0 });
+    try writer.writeIntLittle(u32, @intCast(base.len));
+    try writer.writeIntLittle(u32, @intCast(image.len));
+    try writer.writeAll(&base_sha256);
+
+    while (pos < @min(base.len, image.len)) {
+        const len = @min(firmware.flash_page_size, @min(base.len, image.len) - pos);
+        const old = base[pos..(pos + len)];
+        const new = image[pos..(pos + len)];
+
+        try writer.writeByte(if (std.mem.eql(u8, old, new)) 0x01 else 0x02);
+        try writer.writeIntLittle(u32, @intCast(pos));
+        try writer.writeIntLittle(u32, @intCast(len));
+        if (!std.mem.eql(u8, old, new)) {
+            for (old, new) |o, n| {
+                try writer.writeByte(n -% o);
+            }
+        }
+        pos += len;
+    }
+
+    if (pos < image.len) {
+        try writer.writeByte(0x03);
+        try writer.writeIntLittle(u32, @intCast(image.len - pos));
+        try writer.writeAll(image[pos..]);
+    }
+    try writer.writeByte(0x00);
+
+    return out.getWritten();
+}
+
+test "a delta patch reconstructs the candidate from the installed image" {
+    var patch_buf: [image_capacity + 1024]u8 = undefined;
+    var read_buf: [image_capacity]u8 = undefined;
+
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 52);
+    const candidate = try changedImage(&candidate_buf, installed, 2);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeFile(config.fw_delta_file_name, try deltaPatch(&patch_buf, installed, candidate));
+
+    try std.testing.expectEqual(candidate.len, try delta.apply(config.fw_delta_file_name, config.fw_file_name));
+
+    var f = try fatfs.file.open(config.fw_file_name, @intFromEnum(fatfs.file.fMode.read));
+    defer f.close() catch {};
+
+    try std.testing.expectEqualSlices(u8, candidate, try f.read(&read_buf));
+}
+
+test "a delta patch is not applied to another image" {
+    var patch_buf: [image_capacity + 1024]u8 = undefined;
+    var other_buf: [image_capacity]u8 = undefined;
+
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 53);
+    const other = try signedImage(&other_buf, 3, 54);
+    const candidate = try changedImage(&candidate_buf, other, 4);
+
+    try openCard(installed);
+    defer closeCard();
+    try storeFile(config.fw_delta_file_name, try deltaPatch(&patch_buf, other, candidate));
+
+    try std.testing.expectError(delta.delta_error.base_mismatch, delta.apply(config.fw_delta_file_name, config.fw_file_name));
+}
+
+fn writeSectors(sector: c.LBA_t, count: usize, value: u8) !void {
+    var data: [4 * fatfs.sector_size]u8 = undefined;
+
+    @memset(data[0..(count * fatfs.sector_size)], value);
+    if (c.disk_write(0, &data, sector, @intCast(count)) != c.RES_OK) return error.disk_error;
+}
+
+/// Read `count` sectors and check that the `index`-th holds `value`
+fn expectSector(sector: c.LBA_t, count: usize, index: usize, value: u8) !void {
+    var data: [4 * fatfs.sector_size]u8 = undefined;
+
+    if (c.disk_read(0, &data, sector, @intCast(count)) != c.RES_OK) return error.disk_error;
+    try std.testing.expect(std.mem.allEqual(u8, data[(index * fatfs.sector_size)..((index + 1) * fatfs.sector_size)], value));
+}
+
+test "the sector cache stays coherent with multiple sector transfers and read-ahead" {
+    var image = try std.fs.cwd().createFile(card_path, .{ .truncate = true });
+    try image.setEndPos(1024 * 1024);
+    image.close();
+    defer std.fs.cwd().deleteFile(card_path) catch {};
+
+    if (0 != c.sdmm_image_open(card_path, null)) return error.image_error;
+    defer c.sdmm_image_close();
+
+    c.disk_cache_invalidate();
+    c.disk_cache_set_metadata(8, 16);
+    defer c.disk_cache_set_metadata(0, 0);
+    try std.testing.expectEqual(@as(c.DSTATUS, 0), c.disk_initialize(0));
+
+    // A dirty metadata sector is written back before a multiple sector read
+    try writeSectors(8, 1, 0xA1);
+    try expectSector(7, 3, 1, 0xA1);
+
+    // A multiple sector write updates the cached copy
+    try expectSector(10, 1, 0, 0x00);
+    try writeSectors(9, 3, 0xB2);
+    try expectSector(10, 1, 0, 0xB2);
+
+    // Sequential reads fill the read-ahead window, a single sector write drops it
+    try expectSector(100, 1, 0, 0x00);
+    try expectSector(101, 1, 0, 0x00);
+    try expectSector(102, 1, 0, 0x00);
+    try writeSectors(104, 1, 0xC3);
+    try expectSector(103, 1, 0, 0x00);
+    try expectSector(104, 1, 0, 0xC3);
+
+    // Flushed sectors are on the card, not only in the cache
+    try writeSectors(12, 1, 0xD4);
+    try std.testing.expectEqual(@as(c.DRESULT, c.RES_OK), c.disk_cache_flush(0));
+    c.disk_cache_invalidate();
+    try expectSector(12, 1, 0, 0xD4);
+    try expectSector(8, 1, 0, 0xA1);
+}
+
+test "seeks in a fragmented file follow the link map" {
+    try formatCard();
+    defer closeCard();
+
+    const cluster = @as(usize, fatfs.fileSystem.csize) * fatfs.sector_size;
+    const size = 16 * cluster;
+    const data = try randomData(std.testing.allocator, size, 40);
+    defer std.testing.allocator.free(data);
+
+    // Clusters written in turn with another file: every cluster of DATA.BIN is a fragment
+    {
+        const mode = @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write);
+        var f = try fatfs.file.open("SD:DATA.BIN", mode);
+        defer f.close() catch {};
+        var other = try fatfs.file.open("SD:OTHER.BIN", mode);
+        defer other.close() catch {};
+
+        var pos: usize = 0;
+        while (pos < size) : (pos += cluster) {
+            _ = try f.write(data[pos..(pos + cluster)]);
+            _ = try other.write(data[pos..(pos + cluster)]);
+        }
+    }
+
+    var f = try fatfs.file.open("SD:DATA.BIN", @intFromEnum(fatfs.file.fMode.read));
+    defer f.close() catch {};
+
+    try std.testing.expect(try f.enableFastSeek());
+    try std.testing.expect(f.extent == null);
+
+    // Backwards, across the fragments
+    var buf: [100]u8 = undefined;
+    var offset: usize = size - buf.len;
+    while (offset > (2 * cluster)) : (offset -= (cluster + 300)) {
+        try f.lseek(offset);
+        try std.testing.expectEqualSlices(u8, data[offset..(offset + buf.len)], try f.read(&buf));
+    }
+}
+
+test "raw sector transfers of a preallocated file agree with FatFs" {
+    try formatCard();
+    defer closeCard();
+
+    const size = 8 * fatfs.sector_size + 100;
+    const data = try randomData(std.testing.allocator, size, 41);
+    defer std.testing.allocator.free(data);
+    const buf = try std.testing.allocator.alloc(u8, size);
+    defer std.testing.allocator.free(buf);
+
+    const mode = @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write) | @intFromEnum(fatfs.file.fMode.read);
+    var f = try fatfs.file.open("SD:RAW.BIN", mode);
+    defer f.close() catch {};
+
+    try f.preallocate(size);
+    try std.testing.expect(f.extent != null);
+    try std.testing.expectEqual(size, f.size());
+
+    try f.writeRaw(0, data);
+    try std.testing.expectEqualSlices(u8, data, try f.readRaw(0, buf));
+    try f.rewind();
+    try std.testing.expectEqualSlices(u8, data, try f.read(buf));
+
+    // The sector in the file buffer is written raw: reads through FatFs see the new data
+    try f.lseek(fatfs.sector_size);
+    _ = try f.read(buf[0..10]);
+    @memset(data[fatfs.sector_size..(2 * fatfs.sector_size)], 0x5A);
+    try f.writeRaw(fatfs.sector_size, data[fatfs.sector_size..(2 * fatfs.sector_size)]);
+    try f.lseek(fatfs.sector_size);
+    try std.testing.expectEqualSlices(u8, data[fatfs.sector_size..(fatfs.sector_size + 100)], try f.read(buf[0..100]));
+
+    // Transfers have to start on a sector
+    try std.testing.expectError(fatfs.frError.FR_INVALID_PARAMETER, f.writeRaw(100, data[0..10]));
+}
+
+test "the application digest is kept until the flash is erased" {
+    var digest: [32]u8 = undefined;
+    var expected: [32]u8 = undefined;
+
+    try open();
+    defer close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x44} ** Ecdsa.KeyPair.seed_length);
+    const installed = try signedImage(&installed_buf, 1, 48);
+
+    @memcpy(firmware.fw[0..installed.len], installed);
+    _ = try nvm.init();
+
+    Sha256.hash(installed, &expected, .{});
+    try std.testing.expectEqualSlices(u8, &expected, try appDigest.get(installed.len, &digest));
+
+    // Changed behind the flash HAL: the stored digest is used, the flash is not hashed again
+    firmware.fw[header_size] ^= 0xFF;
+    try std.testing.expectEqualSlices(u8, &expected, try appDigest.get(installed.len, &digest));
+
+    // An erase through the update code drops it
+    var pages = std.mem.zeroes(backup.pageMap);
+    pages.bits[0] = 1 << 3;
+    try firmware.erasePages(&pages);
+
+    Sha256.hash(firmware.fw[0..installed.len], &expected, .{});
+    try std.testing.expectEqualSlices(u8, &expected, try appDigest.get(installed.len, &digest));
+
+    // So does another image header
+    firmware.fw[header_size] ^= 0xFF;
+    firmware.fw[@offsetOf(firmware.image_header, "ih_ver")] +%= 1;
+    Sha256.hash(firmware.fw[0..installed.len], &expected, .{});
+    try std.testing.expectEqualSlices(u8, &expected, try appDigest.get(installed.len, &digest));
+}
@@ -0,0 +1,376 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//! Firmware update benchmark for the host
+//!
+//! Runs the update state machine of the bootloader (`boot/app.zig`) on Linux. The flash is
+//! simulated by csrc/host/flash_sim.c on top of `flash.host_memory`, NVM3 by csrc/host/nvm3_sim.c
+//! and the SD card by a disk image (csrc/host/sdmm_image.c). The images are laid out as imgtool
+//! signs them in tasks.py, with a P-256 key made up for the run.
+//!
+//! Every scenario reports per phase the modelled flash, card and NVM3 time, the host time and the
+//! flash and card operations. The modelled times are the figures to compare, the host time only
+//! shows the CPU cost on the host.
+//!
+//! Build and run with `zig build host-update-bench [-- image]`. The image, `update-bench.img` by
+//! default, is created and formatted on every run.
+const std = @import("std");
+const fatfs = @import("fatfs.zig");
+const config = @import("config.zig");
+const nvm = @import("nvm.zig");
+const flash = @import("flash.zig");
+const app = @import("boot/app.zig");
+const firmware = @import("boot/firmware.zig");
+const c = @cImport({
+    @cInclude("ff.h");
+    @cInclude("disk_cache.h");
+    @cInclude("sdmm_image.h");
+    @cInclude("flash_sim.h");
+    @cInclude("nvm3_sim.h");
+});
+
+const Ecdsa = std.crypto.sign.ecdsa.EcdsaP256Sha256;
+
+/// Size of the disk image, formatted as FAT32
+const image_size: u64 = 256 * 1024 * 1024;
+
+/// mcuboot image layout: `--header-size 0x80 --pad-header --public-key-format full`
+const image_magic: u32 = 0x96f3b83d;
+const header_size: usize = 0x80;
+const tlv_info_magic: u16 = 0x6907;
+const tlv_pubkey: u16 = 0x02;
+const tlv_sha256: u16 = 0x10;
+const tlv_ecdsa_sig: u16 = 0x22;
+
+/// SubjectPublicKeyInfo of a P-256 key, followed by the uncompressed point
+const spki_prefix = [_]u8{ 0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00 };
+const spki_len: usize = spki_prefix.len + 65;
+
+/// Payload of the installed image and the candidates
+const payload_size: usize = 320 * 1024;
+const image_capacity: usize = header_size + payload_size + 256;
+
+/// Pages the differential update changes besides header and trailer
+const delta_pages: usize = 4;
+
+/// Erases and programs before the power is lost, the full update loses it while programming
+const power_loss_after: u32 = 100;
+
+const bench_error = error{
+    image_error,
+    mkfs_error,
+    flash_error,
+    flush_error,
+};
+
+var installed: []u8 = &.{};
+var installed_buf: [image_capacity]u8 = undefined;
+var candidate_buf: [image_capacity]u8 = undefined;
+
+var key: Ecdsa.KeyPair = undefined;
+
+fn publicKeyInfo() [spki_len]u8 {
+    var info: [spki_len]u8 = undefined;
+
+    @memcpy(info[0..spki_prefix.len], &spki_prefix);
+    @memcpy(info[spki_prefix.len..], &key.public_key.toUncompressedSec1());
+
+    return info;
+}
+
+fn writeTlv(writer: anytype, tlv_type: u16, value: []const u8) !void {
+    try writer.writeIntLittle(u16, tlv_type);
+    try writer.writeIntLittle(u16, @intCast(value.len));
+    try writer.writeAll(value);
+}
+
+/// Turn the payload in `buf` into a signed image of the given version
+fn sign(buf: []u8, minor: u8) ![]u8 {
+    var hdr = std.mem.zeroes(firmware.image_header);
+    var digest: [32]u8 = undefined;
+    var der: [Ecdsa.Signature.der_encoded_max_length]u8 = undefined;
+
+    hdr.ih_magic = image_magic;
+    hdr.ih_hdr_size = header_size;
+    hdr.ih_img_size = payload_size;
+    hdr.ih_ver.iv_minor = minor;
+
+    @memset(buf[0..header_size], 0);
+    @memcpy(buf[0..@sizeOf(firmware.image_header)], std.mem.asBytes(&hdr));
+
+    const signed = buf[0..(header_size + payload_size)];
+    std.crypto.hash.sha2.Sha256.hash(signed, &digest, .{});
+    const sig = (try key.sign(signed, null)).toDer(&der);
+
+    const tlv_len = 4 + (4 + digest.len) + (4 + spki_len) + (4 + sig.len);
+    var tlv = std.io.fixedBufferStream(buf[signed.len..]);
+    const writer = tlv.writer();
+
+    try writer.writeIntLittle(u16, tlv_info_magic);
+    try writer.writeIntLittle(u16, @intCast(tlv_len));
+    try writeTlv(writer, tlv_sha256, &digest);
+    try writeTlv(writer, tlv_pubkey, &publicKeyInfo());
+    try writeTlv(writer, tlv_ecdsa_sig, sig);
+
+    return buf[0..(signed.len + tlv_len)];
+}
+
+/// Provision the public key as the configuration carries it, base64 of the SubjectPublicKeyInfo
+fn provisionKey() void {
+    var text: [256]u8 = undefined;
+    const info = publicKeyInfo();
+
+    const encoded = std.base64.standard.Encoder.encode(&text, &info);
+    text[encoded.len] = 0;
+
+    config.c.config_set_http_sig_key(&text);
+}
+
+fn randomPayload(buf: []u8, seed: u64) void {
+    var prng = std.rand.DefaultPrng.init(seed);
+
+    prng.random().bytes(buf[header_size..(header_size + payload_size)]);
+}
+
+/// Program `installed` into a freshly erased flash and reset NVM3, as after a factory install
+fn install() !void {
+    if (0 != c.flash_sim_open(null, &flash.host_memory)) return bench_error.flash_error;
+
+    @memcpy(firmware.fw[0..installed.len], installed);
+
+    try nvm.eraseAll();
+    _ = try nvm.init();
+    try nvm.setFirmwareSize(@intCast(installed.len));
+}
+
+/// Put the candidate on the SD card
+fn store(image: []const u8) !void {
+    var f = try fatfs.file.open(config.fw_file_name, @intFromEnum(fatfs.file.fMode.create_always) | @intFromEnum(fatfs.file.fMode.write));
+    defer f.close() catch {};
+
+    _ = try f.write(image);
+}
+
+const phase_count = @typeInfo(app.update_phase).Enum.fields.len;
+
+/// Cost of a phase, summed over all its entries
+const phase_stats = struct {
+    entries: u32 = 0,
+    flash_us: u64 = 0,
+    erases: u32 = 0,
+    words: u32 = 0,
+    card_us: u64 = 0,
+    sectors_read: u32 = 0,
+    sectors_written: u32 = 0,
+    nvm_us: u64 = 0,
+    nvm_writes: u32 = 0,
+    host_us: u64 = 0,
+
+    fn add(self: *@This(), other: @This()) void {
+        inline for (@typeInfo(@This()).Struct.fields) |field| {
+            @field(self.*, field.name) += @field(other, field.name);
+        }
+    }
+};
+
+/// Counters of the simulations at the start of the current phase
+const snapshot = struct {
+    flash: c.flash_sim_stats_t,
+    card: c.sdmm_image_stats_t,
+    nvm: c.nvm3_sim_stats_t,
+    host_ns: u64,
+
+    fn take() @This() {
+        var s: @This() = undefined;
+
+        c.flash_sim_get_stats(&s.flash);
+        c.sdmm_image_get_stats(&s.card);
+        c.nvm3_sim_get_stats(&s.nvm);
+        s.host_ns = timer.read();
+
+        return s;
+    }
+};
+
+var phases = [_]phase_stats{.{}} ** phase_count;
+var current: ?app.update_phase = null;
+var last: snapshot = undefined;
+var timer: std.time.Timer = undefined;
+
+/// Charge the counters since the last call to the current phase
+fn charge() void {
+    const now = snapshot.take();
+
+    if (current) |phase| {
+        phases[@intFromEnum(phase)].add(.{
+            .flash_us = now.flash.elapsed_us - last.flash.elapsed_us,
+            .erases = now.flash.erases - last.flash.erases,
+            .words = now.flash.words_written - last.flash.words_written,
+            .card_us = now.card.elapsed_us - last.card.elapsed_us,
+            .sectors_read = now.card.sectors_read - last.card.sectors_read,
+            .sectors_written = now.card.sectors_written - last.card.sectors_written,
+            .nvm_us = now.nvm.elapsed_us - last.nvm.elapsed_us,
+            .nvm_writes = (now.nvm.writes + now.nvm.deletes) - (last.nvm.writes + last.nvm.deletes),
+            .host_us = (now.host_ns - last.host_ns) / std.time.ns_per_us,
+        });
+    }
+
+    last = now;
+}
+
+fn observe(phase: app.update_phase) void {
+    charge();
+
+    current = phase;
+    phases[@intFromEnum(phase)].entries += 1;
+}
+
+fn attempt() []const u8 {
+    defer {
+        // Dirty sectors are charged to the phase that wrote them
+        _ = c.disk_cache_flush(0);
+        charge();
+        current = null;
+    }
+
+    return if (app.firmwareUpdate()) |outcome| @tagName(outcome) else |err| @errorName(err);
+}
+
+fn printPhase(out: anytype, name: []const u8, s: phase_stats) !void {
+    try out.print("  {s:<26} {d:>7} {d:>8} {d:>6} {d:>7} {d:>7} {d:>7} {d:>7} {d:>6} {d:>6} {d:>9}\n", .{
+        name,
+        s.entries,
+        s.flash_us / std.time.us_per_ms,
+        s.erases,
+        s.words,
+        s.card_us / std.time.us_per_ms,
+        s.sectors_read,
+        s.sectors_written,
+        s.nvm_us / std.time.us_per_ms,
+        s.nvm_writes,
+        s.host_us,
+    });
+}
+
+/// Run the update from `installed` to `image`, optionally losing power once and resuming
+fn run(out: anytype, name: []const u8, image: []const u8, power_loss: u32) !void {
+    var flash_stats: c.flash_sim_stats_t = undefined;
+    var total = phase_stats{};
+
+    try install();
+    try store(image);
+    if (c.disk_cache_flush(0) != c.RES_OK) return bench_error.flush_error;
+
+    c.flash_sim_reset_stats();
+    c.sdmm_image_reset_stats();
+    c.nvm3_sim_reset_stats();
+
+    phases = [_]phase_stats{.{}} ** phase_count;
+    current = null;
+    last = snapshot.take();
+
+    try out.print("{s}\n", .{name});
+
+    c.flash_sim_power_fail_after(power_loss);
+    var outcome = attempt();
+
+    if (power_loss != 0) {
+        try out.print("  power lost: {s}, resuming\n", .{outcome});
+
+        c.flash_sim_power_cycle();
+        outcome = attempt();
+    }
+
+    try out.print("  {s:<26} {s:>7} {s:>8} {s:>6} {s:>7} {s:>7} {s:>7} {s:>7} {s:>6} {s:>6} {s:>9}\n", .{ "phase", "entries", "flash ms", "erases", "words", "card ms", "rd sect", "wr sect", "nvm ms", "nvm wr", "host us" });
+
+    for (phases, 0..) |s, i| {
+        if (s.entries == 0) continue;
+
+        try printPhase(out, @tagName(@as(app.update_phase, @enumFromInt(i))), s);
+        total.add(s);
+    }
+
+    try printPhase(out, "total", total);
+
+    c.flash_sim_get_stats(&flash_stats);
+    try out.print("  outcome: {s}, most worn page erased {d} times\n\n", .{ outcome, flash_stats.max_page_erases });
+}
+
+fn format(path: [:0]const u8) !void {
+    var work: [c.FF_MAX_SS]u8 = undefined;
+    const opt = c.MKFS_PARM{ .fmt = c.FM_FAT32, .n_fat = 0, .@"align" = 0, .n_root = 0, .au_size = 0 };
+
+    var image = try std.fs.cwd().createFile(path, .{ .truncate = true });
+    defer image.close();
+
+    // Sparse, only the written sectors take space
+    try image.setEndPos(image_size);
+
+    if (0 != c.sdmm_image_open(path.ptr, null)) return bench_error.image_error;
+
+    if (c.f_mkfs("SD:", &opt, &work, @intCast(work.len)) != c.FR_OK) return bench_error.mkfs_error;
+}
+
+pub fn main() !void {
+    const out = std.io.getStdOut().writer();
+
+    var args = std.process.args();
+    _ = args.skip();
+    const path = args.next() orelse "update-bench.img";
+
+    try format(path);
+    defer c.sdmm_image_close();
+
+    try fatfs.mount("SD");
+    defer fatfs.unmount("SD") catch {};
+
+    _ = c.nvm3_open(@ptrCast(&nvm.miso_nvm3), @ptrCast(&nvm.miso_nvm3_init));
+    defer nvm.close();
+
+    defer c.flash_sim_close();
+
+    key = try Ecdsa.KeyPair.create([_]u8{0x5a} ** Ecdsa.KeyPair.seed_length);
+    provisionKey();
+
+    timer = try std.time.Timer.start();
+    app.phase_observer = &observe;
+
+    randomPayload(&installed_buf, 1);
+    installed = try sign(&installed_buf, 1);
+
+    // Every page of the payload changes
+    randomPayload(&candidate_buf, 2);
+    try run(out, "full update", try sign(&candidate_buf, 2), 0);
+
+    // A few pages change, only those are backed up, erased and programmed
+    @memcpy(&candidate_buf, &installed_buf);
+    for (0..delta_pages) |i| {
+        candidate_buf[header_size + ((3 + (i * 17)) * firmware.flash_page_size)] ^= 0xFF;
+    }
+    const delta = try sign(&candidate_buf, 2);
+    try run(out, "differential update", delta, 0);
+
+    try run(out, "candidate installed", installed, 0);
+
+    // The signature is checked before the backup, nothing is erased
+    delta[delta.len - 1] ^= 0x01;
+    try run(out, "bad signature", delta, 0);
+
+    randomPayload(&candidate_buf, 2);
+    try run(out, "power loss + resume", try sign(&candidate_buf, 2), power_loss_after);
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//! Signature verification benchmark for the host
+//!
+//! Compares the verification of the configuration signature (`pk.verifyTrusted`) with the comb
+//! table of the trusted key in flash, with the table built in RAM and with a plain
+//! `mbedtls_pk_verify`. The flash table is csrc/host/trusted_key_table_bench.c, generated by
+//! `inv trusted-key-table` for `table_secret`. P-256 is the only curve enabled in mbedTLS.
+//!
+//! Every method verifies the same signatures and must reject them over a changed hash. The host
+//! time is only a relative figure, the target runs at 48 MHz without the 64 bit limbs.
+//!
+//! Build and run with `zig build host-verify-bench`.
+const std = @import("std");
+const pk = @import("pk.zig");
+
+const Ecdsa = std.crypto.sign.ecdsa.EcdsaP256Sha256;
+
+/// Secret of the key csrc/host/trusted_key_table_bench.c was generated for
+const table_secret = [_]u8{0x4d} ** Ecdsa.SecretKey.encoded_length;
+
+/// Secret of a key without a flash table
+const ram_secret = [_]u8{0x5a} ** Ecdsa.SecretKey.encoded_length;
+
+/// SubjectPublicKeyInfo of a P-256 key, followed by the uncompressed point
+const spki_prefix = [_]u8{ 0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00 };
+const spki_len: usize = spki_prefix.len + 65;
+
+/// Signatures verified by every method
+const signature_count = 64;
+
+const bench_error = error{
+    accepted_bad_signature,
+    rejected_good_signature,
+    no_flash_table,
+};
+
+const signed_hash = struct {
+    hash: [32]u8,
+    der: [Ecdsa.Signature.der_encoded_max_length]u8,
+    der_len: usize,
+
+    fn sig(self: *const @This()) []const u8 {
+        return self.der[0..self.der_len];
+    }
+};
+
+const method = enum {
+    pk_verify,
+    trusted_ram_table,
+    trusted_flash_table,
+};
+
+fn publicKeyInfo(key: Ecdsa.KeyPair) [spki_len]u8 {
+    var info: [spki_len]u8 = undefined;
+
+    @memcpy(info[0..spki_prefix.len], &spki_prefix);
+    @memcpy(info[spki_prefix.len..], &key.public_key.toUncompressedSec1());
+
+    return info;
+}
+
+fn signAll(key: Ecdsa.KeyPair, out: []signed_hash) !void {
+    for (out, 0..) |*entry, i| {
+        var msg: [16]u8 = undefined;
+        std.mem.writeIntLittle(u64, msg[0..8], i);
+        std.mem.writeIntLittle(u64, msg[8..16], 0x6d69736f);
+
+        std.crypto.hash.sha2.Sha256.hash(&msg, &entry.hash, .{});
+
+        const der = (try key.sign(&msg, null)).toDer(&entry.der);
+        entry.der_len = der.len;
+    }
+}
+
+fn verifyOne(m: method, ctx: *pk, entry: *const signed_hash) !void {
+    var hash = entry.hash;
+
+    switch (m) {
+        .pk_verify => try ctx.verify(&hash, entry.sig()),
+        .trusted_ram_table, .trusted_flash_table => try pk.verifyTrusted(&hash, entry.sig()),
+    }
+}
+
+/// Verify all signatures, print the host time of the first and the mean of the others
+fn run(out: anytype, m: method, key: Ecdsa.KeyPair, signatures: []const signed_hash) !void {
+    var ctx = pk.init();
+    defer ctx.free();
+
+    const info = publicKeyInfo(key);
+    try ctx.parse(&info);
+
+    if (m != .pk_verify) {
+        try ctx.setTrusted();
+
+        if ((m == .trusted_flash_table) != (pk.trustedTableSize() != 0)) return bench_error.no_flash_table;
+    }
+
+    var timer = try std.time.Timer.start();
+    var first_ns: u64 = 0;
+
+    for (signatures, 0..) |*entry, i| {
+        verifyOne(m, &ctx, entry) catch return bench_error.rejected_good_signature;
+
+        if (i == 0) first_ns = timer.lap();
+    }
+
+    const rest_ns = timer.read();
+
+    // A changed hash is rejected
+    for (signatures) |entry| {
+        var bad = entry;
+        bad.hash[7] ^= 0x10;
+
+        if (verifyOne(m, &ctx, &bad)) |_| {
+            return bench_error.accepted_bad_signature;
+        } else |_| {}
+    }
+
+    try out.print("  {s:<22} {d:>10} {d:>10} {d:>12}\n", .{
+        @tagName(m),
+        first_ns / std.time.ns_per_us,
+        rest_ns / (signatures.len - 1) / std.time.ns_per_us,
+        if (m == .trusted_flash_table) pk.trustedTableSize() else 0,
+    });
+}
+
+pub fn main() !void {
+    const out = std.io.getStdOut().writer();
+
+    const table_key = try Ecdsa.KeyPair.fromSecretKey(try Ecdsa.SecretKey.fromBytes(table_secret));
+    const ram_key = try Ecdsa.KeyPair.fromSecretKey(try Ecdsa.SecretKey.fromBytes(ram_secret));
+
+    var table_signatures: [signature_count]signed_hash = undefined;
+    var ram_signatures: [signature_count]signed_hash = undefined;
+
+    try signAll(table_key, &table_signatures);
+    try signAll(ram_key, &ram_signatures);
+
+    try out.print("P-256, {d} signatures\n", .{signature_count});
+    try out.print("  {s:<22} {s:>10} {s:>10} {s:>12}\n", .{ "method", "first us", "mean us", "flash bytes" });
+
+    try run(out, .pk_verify, table_key, &table_signatures);
+    try run(out, .trusted_ram_table, ram_key, &ram_signatures);
+    try run(out, .trusted_flash_table, table_key, &table_signatures);
+}
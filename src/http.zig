@@ -25,28 +25,54 @@ const connection = @import("connection.zig");
 const file = @import("fatfs.zig").file;
 const led = @import("leds.zig");
 const simpleConnection = @import("simpleConnection.zig");
+const nvm = @import("nvm.zig");
+const sha256 = @import("sha256.zig");
+const inflate = @import("inflate.zig");
+const mbedtls = @import("mbedtls.zig");
+const staging = @import("boot/staging.zig");
+const writeBehind = @import("writeBehind.zig");
+const storage = @import("storage.zig");
 const c = @cImport({
     @cInclude("board.h");
     @cInclude("picohttpparser.h");
+    @cInclude("miso_config.h");
 });
 
 /// Connection instance
-connection: connection.Connection(simpleConnection.SimpleLinkConnection(.tcp_ip4)),
+connection: transport,
 
 /// Array to store parsed header information
 headers: [24]c.phr_header,
 
 /// TX Buffer
-tx_buffer: [256]u8 align(@alignOf(u32)),
+tx_buffer: [384]u8 align(@alignOf(u32)),
 
 /// RX Buffer
 rx_buffer: [1536]u8 align(@alignOf(u32)),
 
+/// Bytes recieved after the end of the last body: the start of the next pipelined response
+rx_leftover: []u8,
+
 // Etag
 etag: [64]u8,
+etag_len: usize,
+
+// Last-Modified
+last_modified: [32]u8,
+last_modified_len: usize,
 
 file: file,
 
+/// Running hash of the downloaded file
+hasher: sha256,
+hash_valid: bool,
+digest: ?[32]u8,
+
+/// Decoder for deflate encoded bodies
+inflater: inflate.Inflater(config.http_inflate_window_bits, bodyReader, fileSink),
+
+const client = @This();
+
 const @"error" = error{
     rx_error,
     tx_error,
@@ -72,24 +98,115 @@ const @"error" = error{
     unexpected_status_code,
 
     range_response_parse_error,
+
+    /// The resource changed while resuming a download
+    resource_changed,
+
+    /// Content-Encoding not supported
+    unsupported_encoding,
+
+    /// File write incomplete
+    file_write_error,
 };
 
 /// HTTP Response from server
 const rx_response = struct { payload: ?[]u8, headers: []c.phr_header, status: u32 };
 
+/// CA certificates of the HTTPS servers, PEM with a terminating null character
+var ca_pem: [4096]u8 = undefined;
+
 /// Authentication callback function.
-/// Used during the connection phase for providing PSK credentials
-fn authCallback(self: *connection.mbedtls, security_mode: connection.security_mode) connection.mbedtls.auth_error!void {
-    _ = self;
-    if (security_mode == .psk) {
-        // PSK authentication
-    } else if (security_mode == .certificate_ec) {
-        // EC Certificate
+/// Used during the connection phase for providing the trusted CA certificates.
+/// The server has to present a certificate for the requested host that chains to a CA in
+/// `config.https_ca_file_name`. The device does not authenticate itself.
+fn authCallback(self: *@This(), security_mode: connection.security_mode) mbedtls.auth_error!void {
+    if (security_mode == .certificate_ec) {
+        var ca_file = storage.service.open(config.https_ca_file_name, @intFromEnum(file.fMode.read)) catch return mbedtls.auth_error.generic_error;
+        defer {
+            storage.service.close(&ca_file) catch {};
+        }
+
+        if (ca_file.size() >= ca_pem.len) return mbedtls.auth_error.generic_error;
+
+        const pem = storage.service.read(&ca_file, null, ca_pem[0..(ca_pem.len - 1)]) catch return mbedtls.auth_error.generic_error;
+        ca_pem[pem.len] = 0;
+
+        self.connection.tls.ssl.confCaChain(ca_pem[0..(pem.len + 1)]) catch return mbedtls.auth_error.generic_error;
     } else {
-        // Unsuported security mode
+        return mbedtls.auth_error.unsuported_mode;
     }
 }
 
+/// Connection selected by the URI scheme: plain TCP for http, TLS for https
+///
+/// The TLS context keeps the session of the last handshake. Every reconnect, e.g. after the server
+/// answered `Connection: close`, resumes that session instead of running a full handshake.
+const transport = struct {
+    plain: connection.Connection(simpleConnection.SimpleLinkConnection(.tcp_ip4)),
+    tls: if (config.enable_https) connection.Connection(mbedtls.TlsContext(client, simpleConnection.SimpleLinkConnection(.tls_ip4), .certificate_ec)) else void,
+
+    /// The open connection uses TLS
+    secure: bool,
+
+    fn init(self: *@This(), parent: *client) void {
+        self.secure = false;
+        self.plain.init();
+
+        if (config.enable_https) {
+            self.tls.init();
+            self.tls.ssl = @TypeOf(self.tls.ssl).create(parent, authCallback, null, null);
+        }
+    }
+
+    pub fn open(self: *@This(), uri: std.Uri, local_port: ?u16) !void {
+        const scheme = connection.schemes.match(uri.scheme) orelse return @"error".connection_error;
+        var target = uri;
+
+        self.secure = scheme.isSecure();
+        if (target.port == null) {
+            target.port = if (self.secure) 443 else 80;
+        }
+
+        if (config.enable_https and self.secure) {
+            try self.tls.open(target, local_port);
+        } else if (!self.secure) {
+            try self.plain.open(target, local_port);
+        } else {
+            return @"error".connection_error;
+        }
+    }
+    pub fn close(self: *@This()) !void {
+        return if (config.enable_https and self.secure) self.tls.close() else self.plain.close();
+    }
+    pub fn send(self: *@This(), buffer: []const u8) !usize {
+        return if (config.enable_https and self.secure) self.tls.send(buffer) else self.plain.send(buffer);
+    }
+    pub fn recieve(self: *@This(), buffer: []u8) ![]u8 {
+        return if (config.enable_https and self.secure) self.tls.recieve(buffer) else self.plain.recieve(buffer);
+    }
+    pub fn waitRx(self: *@This(), timeout_s: u32) !bool {
+        return if (config.enable_https and self.secure) self.tls.waitRx(timeout_s) else self.plain.waitRx(timeout_s);
+    }
+    pub fn waitTx(self: *@This(), timeout_s: u32) !bool {
+        return if (config.enable_https and self.secure) self.tls.waitTx(timeout_s) else self.plain.waitTx(timeout_s);
+    }
+
+    /// Largest amount of body data a single read returns
+    /// With TLS this is the record payload allowed by the negotiated maximum fragment length.
+    fn maxReadSize(self: *@This(), rx_len: usize) usize {
+        if (config.enable_https and self.secure) {
+            const payload = self.tls.ssl.maxRecordPayload();
+            if (payload != 0) return @min(payload, rx_len);
+        }
+        return rx_len;
+    }
+
+    /// Number of completed TLS handshakes
+    fn handshakes(self: *@This()) u32 {
+        return if (config.enable_https) self.tls.ssl.handshakes else 0;
+    }
+};
+
 /// Structure representing a parsed Content-Range response header.
 const rangeResponse = struct {
     /// Start position of the range
@@ -160,13 +277,22 @@ const parsedResponse = struct {
     /// Optional etag
     etag: ?[]const u8,
 
+    /// Optional Last-Modified
+    last_modified: ?[]const u8,
+
+    /// Body uses the chunked transfer coding
+    chunked: bool,
+
+    /// Content-Encoding of the body
+    content_encoding: contentEncoding,
+
     /// Function to process the HTTP response headers.
     /// The function will parse the headers from rx response and store the values in the structure.
     /// The function will return the HTTP status code.
     fn processHeaders(self: *@This(), rx: rx_response) !u32 {
 
         // Set default values
-        self.* = .{ .payload = rx.payload, .status_code = rx.status, .content_type = null, .content_length = null, .range = null, .accept_ranges = null, .etag = null, .keep_alive = null };
+        self.* = .{ .payload = rx.payload, .status_code = rx.status, .content_type = null, .content_length = null, .range = null, .accept_ranges = null, .etag = null, .last_modified = null, .keep_alive = null, .chunked = false, .content_encoding = .identity };
 
         // Process specific headers based on their type.
         for (rx.headers) |header| {
@@ -188,6 +314,16 @@ const parsedResponse = struct {
                         // Convert ETag information into slice
                         self.etag = header.value[0..header.value_len];
                     },
+                    .lastModified => {
+                        self.last_modified = header.value[0..header.value_len];
+                    },
+                    .transferEncoding => {
+                        // "chunked" is always the last transfer coding
+                        self.chunked = std.mem.endsWith(u8, header.value[0..header.value_len], "chunked");
+                    },
+                    .contentEncoding => {
+                        self.content_encoding = try contentEncoding.match(header);
+                    },
                     .connection => {
                         // Determine if the connection should be kept alive or closed.
                         self.keep_alive = try keepAlive.match(header);
@@ -204,6 +340,110 @@ const parsedResponse = struct {
     pub fn getEtag(self: *@This()) ?[]const u8 {
         return self.etag;
     }
+
+    /// The server closes the connection after this response
+    fn closesConnection(self: *const @This()) bool {
+        return if (self.keep_alive) |kA| (kA == .close) else false;
+    }
+
+    /// The resource can be fetched with byte range requests
+    fn rangesUsable(self: *const @This()) bool {
+        return (self.content_length != null) and !self.chunked and (self.content_encoding == .identity) and (self.accept_ranges != acceptRanges.none);
+    }
+};
+
+/// Reader for the body of a response
+/// Removes the chunked transfer coding and stops at the end of the body
+const bodyReader = struct {
+    const mode_e = enum { length, chunked, until_close };
+
+    http: *client,
+    mode: mode_e,
+    /// Remaining bytes for `.length`
+    remaining: usize,
+    /// Body bytes recieved together with the headers
+    pending: ?[]u8,
+    decoder: c.phr_chunked_decoder,
+    done: bool,
+
+    fn init(http: *client, response: *const parsedResponse, payload: ?[]u8) @This() {
+        var self: @This() = .{ .http = http, .mode = .until_close, .remaining = 0, .pending = payload, .decoder = std.mem.zeroes(c.phr_chunked_decoder), .done = false };
+
+        if (response.chunked) {
+            self.mode = .chunked;
+            self.decoder.consume_trailer = 1;
+        } else if (response.content_length) |len| {
+            self.mode = .length;
+            self.remaining = len;
+            self.done = (len == 0);
+        }
+
+        return self;
+    }
+
+    /// Next slice of the body, or null at the end of the body
+    pub fn next(self: *@This()) !?[]const u8 {
+        if (self.done) return null;
+
+        var data: []u8 = undefined;
+        if (self.pending) |payload| {
+            data = payload;
+            self.pending = null;
+        } else {
+            if (!try self.http.connection.waitRx(5)) return @"error".timeout;
+
+            data = self.http.connection.recieve(&self.http.rx_buffer) catch |err| {
+                if (self.mode != .until_close) return err;
+                // The body ends when the server closes the connection
+                self.done = true;
+                return null;
+            };
+        }
+
+        switch (self.mode) {
+            .chunked => {
+                var len: usize = data.len;
+                const ret = c.phr_decode_chunked(&self.decoder, @ptrCast(data.ptr), &len);
+                if (ret == -1) return @"error".parse_error;
+                if (ret >= 0) {
+                    // Last chunk and trailer consumed. The undecoded tail belongs to the next response.
+                    self.done = true;
+                    self.http.rx_leftover = data[len..(len + @as(usize, @intCast(ret)))];
+                }
+                return data[0..len];
+            },
+            .length => {
+                const len = @min(data.len, self.remaining);
+                self.remaining -= len;
+                self.done = (self.remaining == 0);
+                if (self.done) self.http.rx_leftover = data[len..];
+                return data[0..len];
+            },
+            .until_close => return data,
+        }
+    }
+};
+
+/// Writes decoded body data into the download file
+/// The data goes through the write-behind buffers, see `writeBehind.begin`.
+const fileSink = struct {
+    http: *client,
+    written: usize,
+    max_size: usize,
+
+    pub fn write(self: *@This(), data: []const u8) !void {
+        if ((self.written + data.len) > self.max_size) return @"error".file_size_exceeded;
+
+        try writeBehind.service.write(data);
+
+        if (self.http.hash_valid) {
+            self.http.hasher.update(@constCast(data)) catch {
+                self.http.hash_valid = false;
+            };
+        }
+
+        self.written += data.len;
+    }
 };
 
 /// Function to send an HTTP GET request to a specified URL.
@@ -211,15 +451,29 @@ pub fn sendGetRequest(self: *@This(), url: []const u8) !void {
     var uri = try std.Uri.parse(url);
 
     const request = try std.fmt.bufPrint(&self.tx_buffer, "GET {s} HTTP/1.1\r\nHost: {s}\r\n\r\n", .{ uri.path, uri.host.? });
-    try self.connection.send(@ptrCast(request), request.len);
+    _ = try self.connection.send(request);
+}
+
+/// Function to send an HTTP GET request for a whole body that may be deflate encoded.
+/// Only for `streamDownload`. A HEAD or range request with Accept-Encoding could make the server
+/// announce a compressed representation, which cannot be fetched in ranges.
+fn sendEncodedGetRequest(self: *@This(), url: []const u8) !void {
+    var uri = try std.Uri.parse(url);
+
+    const request = try std.fmt.bufPrint(&self.tx_buffer, "GET {s} HTTP/1.1\r\nHost: {s}\r\n{s}\r\n", .{ uri.path, uri.host.?, accept_encoding });
+    _ = try self.connection.send(request);
 }
 
 /// Function to send an HTTP GET request with a specific byte range.
 /// The range is specified by the 'start' and 'end' parameters.
-pub fn sendGetRangeRequest(self: *@This(), url: []const u8, start: usize, end: usize) !void {
+/// If 'if_range' is given, the server only returns the range if the resource still matches the validator.
+pub fn sendGetRangeRequest(self: *@This(), url: []const u8, start: usize, end: usize, if_range: ?[]const u8) !void {
     var uri = try std.Uri.parse(url);
 
-    const request = try std.fmt.bufPrint(&self.tx_buffer, "GET {s} HTTP/1.1\r\nHost: {s}\r\nRange: bytes={d}-{d}\r\n\r\n", .{ uri.path, uri.host.?, start, end });
+    const request = if (if_range) |validator|
+        try std.fmt.bufPrint(&self.tx_buffer, "GET {s} HTTP/1.1\r\nHost: {s}\r\nRange: bytes={d}-{d}\r\nIf-Range: {s}\r\n\r\n", .{ uri.path, uri.host.?, start, end, validator })
+    else
+        try std.fmt.bufPrint(&self.tx_buffer, "GET {s} HTTP/1.1\r\nHost: {s}\r\nRange: bytes={d}-{d}\r\n\r\n", .{ uri.path, uri.host.?, start, end });
     _ = try self.connection.send(request);
 }
 
@@ -232,6 +486,28 @@ pub fn sendHeadRequest(self: *@This(), url: []const u8) !void {
     _ = try self.connection.send(request);
 }
 
+/// Accept-Encoding request header
+const accept_encoding = if (config.http_accept_deflate) "Accept-Encoding: deflate\r\n" else "";
+
+/// Function to send a conditional HTTP HEAD request.
+/// The server answers 304 Not Modified if the resource still matches the validators.
+pub fn sendConditionalHeadRequest(self: *@This(), url: []const u8, etag: ?[]const u8, last_modified: ?[]const u8) !void {
+    var uri = try std.Uri.parse(url);
+    var stream = std.io.fixedBufferStream(&self.tx_buffer);
+    const writer = stream.writer();
+
+    try writer.print("HEAD {s} HTTP/1.1\r\nHost: {s}\r\n", .{ uri.path, uri.host.? });
+    if (etag) |val| {
+        try writer.print("If-None-Match: {s}\r\n", .{val});
+    }
+    if (last_modified) |val| {
+        try writer.print("If-Modified-Since: {s}\r\n", .{val});
+    }
+    try writer.writeAll("\r\n");
+
+    _ = try self.connection.send(stream.getWritten());
+}
+
 /// Recieve an HTTP response from the server.
 fn recieveResponse(self: *@This()) !rx_response {
     var rx_count: usize = 0;
@@ -246,14 +522,27 @@ fn recieveResponse(self: *@This()) !rx_response {
     var payload_len: usize = undefined;
     var payload: ?[]u8 = null;
 
+    if (self.rx_leftover.len != 0) {
+        // Start of this response arrived with the previous one
+        std.mem.copyForwards(u8, self.rx_buffer[0..self.rx_leftover.len], self.rx_leftover);
+        rx_count = self.rx_leftover.len;
+        self.rx_leftover = self.rx_buffer[0..0];
+
+        pret = c.phr_parse_response(&self.rx_buffer, rx_count, &minor_version, &status, &msg, &msg_len, &self.headers, &num_headers, 0);
+    }
+
     while ((pret == -2) and (rx_count < self.rx_buffer.len)) {
         if (try self.connection.waitRx(5)) {
             var rec = try self.connection.recieve(self.rx_buffer[rx_count..(self.rx_buffer.len)]);
+            if (rec.len == 0) continue; // e.g. a TLS session ticket
 
-            // returns number of bytes consumed if successful, -2 if request is partial, -1 if failed
-            pret = c.phr_parse_response(rec.ptr, rec.len, &minor_version, &status, &msg, &msg_len, &self.headers, &num_headers, prevbuflen);
             prevbuflen = rx_count;
             rx_count += rec.len;
+            num_headers = self.headers.len;
+
+            // Headers can span several reads (TLS records). Parse everything recieved so far.
+            // returns number of bytes consumed if successful, -2 if request is partial, -1 if failed
+            pret = c.phr_parse_response(&self.rx_buffer, rx_count, &minor_version, &status, &msg, &msg_len, &self.headers, &num_headers, prevbuflen);
         } else {
             // rx Timeout
         }
@@ -273,129 +562,687 @@ fn recieveResponse(self: *@This()) !rx_response {
 }
 
 /// Calculate the end position of the range request
-fn calcRequestEnd(file_size: usize, comptime block_size: usize, current_position: usize) usize {
-    var requestEnd = current_position + (block_size - 1);
+fn calcRequestEnd(file_size: usize, span: usize, current_position: usize) usize {
+    var requestEnd = current_position + (span - 1);
     return if (requestEnd > (file_size - 1)) (file_size - 1) else requestEnd;
 }
 
-/// File Download using HTTP
-pub fn filedownload(self: *@This(), url: []const u8, file_name: [*:0]const u8, comptime block_size: usize, comptime max_file_size: usize) !void {
-    var parsed_response: parsedResponse = undefined;
+/// Length of a range request
+///
+/// A whole number of reads of the open connection (TLS records for https), rounded down to the
+/// file block size. Larger ranges amortize the request and the response headers over more data.
+fn rangeSpan(self: *@This(), comptime block_size: usize) usize {
+    const span = config.http_range_reads * self.connection.maxReadSize(self.rx_buffer.len);
+    return @max(block_size, span - (span % block_size));
+}
+
+/// Download progress checkpoint stored in NVM
+///
+/// A download resumes from `offset` if the URL, target file and size still match and the validator
+/// (ETag or Last-Modified) reported by the server is unchanged.
+const downloadCheckpoint = extern struct {
+    /// Layout marker
+    magic: u32,
+    /// CRC32 of the download URL
+    url_crc: u32,
+    /// CRC32 of the target file name
+    file_crc: u32,
+    /// Number of bytes committed to the file
+    offset: u32,
+    /// Size of the resource
+    size: u32,
+    etag_len: u8,
+    last_modified_len: u8,
+    /// `hash_state` covers the bytes up to `offset`
+    hash_valid: u8,
+    reserved: u8,
+    etag: [64]u8,
+    last_modified: [32]u8,
+    /// SHA-256 context of the downloaded data
+    hash_state: [@sizeOf(std.meta.FieldType(sha256, .ctx))]u8,
+
+    const magic_value: u32 = 0x50434C44; // "DLCP"
+
+    comptime {
+        if (@sizeOf(@This()) > nvm.max_object_size) @compileError("Download checkpoint exceeds the NVM object size");
+    }
+};
+
+/// Store the validators of the current resource
+fn setValidators(self: *@This(), etag: ?[]const u8, last_modified: ?[]const u8) void {
+    self.etag_len = 0;
+    self.last_modified_len = 0;
+
+    if (etag) |val| {
+        if (val.len <= self.etag.len) {
+            @memcpy(self.etag[0..val.len], val);
+            self.etag_len = val.len;
+        }
+    }
+    if (last_modified) |val| {
+        if (val.len <= self.last_modified.len) {
+            @memcpy(self.last_modified[0..val.len], val);
+            self.last_modified_len = val.len;
+        }
+    }
+}
+
+/// Validator for the If-Range header: a strong ETag, otherwise Last-Modified
+fn rangeValidator(self: *@This()) ?[]const u8 {
+    const etag = self.etag[0..self.etag_len];
+
+    if ((etag.len != 0) and !std.mem.startsWith(u8, etag, "W/")) {
+        return etag;
+    } else if (self.last_modified_len != 0) {
+        return self.last_modified[0..self.last_modified_len];
+    } else {
+        return null;
+    }
+}
+
+/// Load the checkpoint of a previous attempt of this download.
+/// Returns the offset to resume from, or 0 if the download starts from scratch.
+fn loadCheckpoint(self: *@This(), key: nvm.app_nvm_keys, checkpoint: *downloadCheckpoint, url_crc: u32, file_crc: u32, file_size: usize) usize {
+    const data = nvm.readData(key, std.mem.asBytes(checkpoint)) catch return 0;
+
+    if ((data.len != @sizeOf(downloadCheckpoint)) or (checkpoint.magic != downloadCheckpoint.magic_value)) return 0;
+    if ((checkpoint.url_crc != url_crc) or (checkpoint.file_crc != file_crc)) return 0;
+    if ((checkpoint.size != file_size) or (checkpoint.offset > file_size)) return 0;
+    if (self.rangeValidator() == null) return 0; // Without a validator a resume could mix two versions
+
+    if (!std.mem.eql(u8, checkpoint.etag[0..checkpoint.etag_len], self.etag[0..self.etag_len])) return 0;
+    if (!std.mem.eql(u8, checkpoint.last_modified[0..checkpoint.last_modified_len], self.last_modified[0..self.last_modified_len])) return 0;
+
+    return checkpoint.offset;
+}
+
+/// Commit the file and record the download progress
+fn saveCheckpoint(self: *@This(), key: nvm.app_nvm_keys, url_crc: u32, file_crc: u32, file_size: usize) !void {
+    var checkpoint: downloadCheckpoint = std.mem.zeroes(downloadCheckpoint);
+
+    // The data must be on the card before the progress is recorded
+    try writeBehind.service.commit();
+
+    checkpoint.magic = downloadCheckpoint.magic_value;
+    checkpoint.url_crc = url_crc;
+    checkpoint.file_crc = file_crc;
+    checkpoint.offset = @intCast(writeBehind.service.position());
+    checkpoint.size = @intCast(file_size);
+    checkpoint.etag_len = @intCast(self.etag_len);
+    checkpoint.last_modified_len = @intCast(self.last_modified_len);
+    checkpoint.hash_valid = @intFromBool(self.hash_valid);
+    @memcpy(checkpoint.etag[0..self.etag_len], self.etag[0..self.etag_len]);
+    @memcpy(checkpoint.last_modified[0..self.last_modified_len], self.last_modified[0..self.last_modified_len]);
+    @memcpy(&checkpoint.hash_state, std.mem.asBytes(&self.hasher.ctx));
+
+    try nvm.writeData(key, std.mem.asBytes(&checkpoint));
+}
+
+/// Forget the download progress
+fn clearCheckpoint(self: *@This(), key: nvm.app_nvm_keys) void {
+    _ = self;
+    nvm.deleteObject(key) catch {};
+}
 
+/// Connect to the server
+fn connect(self: *@This(), uri: std.Uri) !void {
+    self.rx_leftover = self.rx_buffer[0..0];
+    try self.connection.open(uri, null);
+}
+
+/// Reconnect to the server
+fn reconnect(self: *@This(), uri: std.Uri) !void {
+    try self.connection.close();
+    try self.connect(uri);
+}
+
+/// File Download using HTTP
+///
+/// Progress is checkpointed to NVM under `checkpoint_key` every `config.http_checkpoint_interval`
+/// bytes. An interrupted download resumes from the last checkpoint as long as the resource did not
+/// change. Downloads that can be interrupted by each other need their own key.
+pub fn filedownload(self: *@This(), url: []const u8, file_name: [*:0]const u8, checkpoint_key: nvm.app_nvm_keys, comptime block_size: usize, comptime max_file_size: usize) !void {
     // Parse the URI
     var uri = try std.Uri.parse(url);
 
-    try self.connection.open(uri, null);
+    try self.connect(uri);
     defer {
         self.connection.close() catch {};
     }
 
+    self.download(url, uri, file_name, checkpoint_key, block_size, max_file_size) catch |err| {
+        if (err != @"error".resource_changed) return err;
+
+        // The resource changed under a resumed download. The partial file was dropped, start over.
+        try self.reconnect(uri);
+        try self.download(url, uri, file_name, checkpoint_key, block_size, max_file_size);
+    };
+}
+
+fn download(self: *@This(), url: []const u8, uri: std.Uri, file_name: [*:0]const u8, checkpoint_key: nvm.app_nvm_keys, comptime block_size: usize, comptime max_file_size: usize) !void {
+    var parsed_response: parsedResponse = undefined;
+    var checkpoint: downloadCheckpoint = undefined;
+
     try self.sendHeadRequest(url);
 
     if (200 != try parsed_response.processHeaders(try self.recieveResponse())) {
         return @"error".status_code_nok;
     }
 
+    self.setValidators(parsed_response.etag, parsed_response.last_modified);
+    self.digest = null;
+
+    if (parsed_response.closesConnection()) {
+        try self.reconnect(uri);
+    }
+
+    if (!parsed_response.rangesUsable()) {
+        // Chunked, compressed or not byte addressable: fetch the whole body in one request
+        return self.streamDownload(url, file_name, checkpoint_key, max_file_size);
+    }
+
     const fileSize: usize = parsed_response.content_length.?;
     if (fileSize > max_file_size) {
         return @"error".file_size_exceeded;
     }
 
-    if (parsed_response.getEtag()) |etag| {
-        @memcpy(self.etag[0..].ptr, etag);
+    const url_crc = std.hash.Crc32.hash(url);
+    const file_crc = std.hash.Crc32.hash(std.mem.span(file_name));
+    var resume_offset = self.loadCheckpoint(checkpoint_key, &checkpoint, url_crc, file_crc, fileSize);
+
+    // Open the file for writing. Keep the partial file when resuming.
+    self.file = try storage.service.open(file_name, @intFromEnum(if (resume_offset != 0) file.fMode.open_always else file.fMode.create_always) | @intFromEnum(file.fMode.write));
+    defer {
+        storage.service.close(&self.file) catch {};
+    }
+
+    if (resume_offset > self.file.size()) {
+        resume_offset = 0; // The file lost data after the checkpoint was written
+    }
+
+    // Drop whatever was written after the checkpoint
+    try storage.service.truncate(&self.file, resume_offset);
+    try storage.service.sync(&self.file); // Perfom sync to reduce chances of critical errors
+
+    // A fresh download gets a contiguous file. Its blocks then go to the card as raw sectors
+    // and the FAT is only touched here and when the file is closed.
+    if (resume_offset == 0) {
+        storage.service.preallocate(&self.file, fileSize) catch {};
     }
 
-    // Open the file for writing
-    self.file = try file.open(file_name, @intFromEnum(file.fMode.create_always) | @intFromEnum(file.fMode.write));
+    self.hasher = sha256.init();
+    defer self.hasher.free();
+
+    if (resume_offset == 0) {
+        try self.hasher.start();
+        self.hash_valid = true;
+    } else {
+        @memcpy(std.mem.asBytes(&self.hasher.ctx), &checkpoint.hash_state);
+        self.hash_valid = (checkpoint.hash_valid != 0);
+        _ = c.printf("Resuming download at %d\r\n", resume_offset);
+    }
+
+    var last_checkpoint: usize = resume_offset;
+
+    // Blocks are written behind the download and synced at the checkpoints only
+    writeBehind.service.begin(&self.file);
     defer {
-        self.file.close() catch {};
+        writeBehind.service.drain() catch {};
     }
 
-    try self.file.sync(); // Perfom sync to reduce chances of critical errors
+    while (writeBehind.service.position() < fileSize) {
+        const position = writeBehind.service.position();
 
-    while (self.file.tell() < fileSize) {
         // Calculate the end position of the request
-        const requestEnd = calcRequestEnd(fileSize, block_size, self.file.tell());
+        const requestEnd = calcRequestEnd(fileSize, self.rangeSpan(block_size), position);
 
-        try self.sendGetRangeRequest(url, self.file.tell(), requestEnd);
+        try self.sendGetRangeRequest(url, position, requestEnd, self.rangeValidator());
+
+        const status_code = try parsed_response.processHeaders(try self.recieveResponse());
 
         // We expect a HTTP code 206 Partial Content.
-        if (206 == try parsed_response.processHeaders(try self.recieveResponse())) {
+        if (206 == status_code) {
+            const range = parsed_response.range orelse return @"error".range_response_parse_error;
 
             // We compare the start position of the response with current file pointer position
             // If they do not match, we need to rewind the file a previous position
             // If the start position is smaller than the current position, we need to rewind to the start of the file in order to avoid holes and file corruption.
-            if (self.file.tell() != parsed_response.range.?.start) {
-                if (self.file.tell() > parsed_response.range.?.start) {
+            if (position != range.start) {
+                try writeBehind.service.drain();
+
+                if (position > range.start) {
                     // Rewind to a previous position.
-                    try self.file.lseek(parsed_response.range.?.start);
+                    try storage.service.seek(&self.file, range.start);
+                    self.hash_valid = false; // Data is overwritten, the running hash no longer matches
+                    writeBehind.service.begin(&self.file);
                 } else {
                     // Rewind to file start
                     // This code will effectively rewind the file and restart the transfer.
-                    try self.file.rewind();
-                    try self.file.sync();
+                    try storage.service.seek(&self.file, 0);
+                    try storage.service.sync(&self.file);
+                    try self.hasher.start();
+                    self.hash_valid = true;
+                    last_checkpoint = 0;
+                    writeBehind.service.begin(&self.file);
+
+                    // Discard the body, the connection is reused for the next request
+                    var skipped = bodyReader.init(self, &parsed_response, parsed_response.payload);
+                    while (try skipped.next()) |_| {}
                     continue;
                 }
             }
 
-            if (requestEnd != parsed_response.range.?.end) {
+            if (requestEnd != range.end) {
                 // Request end position does not match with the expected value
                 // Not so tragic...
             }
 
-            // Write the payload to the file
-            // We store the current file position.
-            // If the amount of bytes written into the file does not match with the expected length, we rewind to the previous position.
-            const current_position = self.file.tell();
-            if (parsed_response.payload.?.len != try self.file.write(parsed_response.payload.?)) {
-                // Test if the bytes written match the payload.
-                // current error handling will rewind to previous position
-                try self.file.lseek(current_position);
+            // Write the range to the file as it arrives. The body spans several reads.
+            // The next request starts after the written data, so a response shorter than requested
+            // or starting at a different position re-synchronises the transfer.
+            var body = bodyReader.init(self, &parsed_response, parsed_response.payload);
+            var sink = fileSink{ .http = self, .written = writeBehind.service.position(), .max_size = fileSize };
+
+            while (try body.next()) |data| {
+                try sink.write(data);
             }
 
-            // Move current position to the current file pointer
-            // This is probably not necessary since the current position can be calculated from the block size.
-            // However three things can happen:
-            //   1. The response length is smaller than the requested block size.
-            //   2. The write function could not write the full block.
-            //   3. The response start position is not equal to requested start position.
-            //
-            // Here the code avoids throwing a failure cases and performs a re-synchronisation of the current pointers.
-            //
-            // A case that is not taken into account is when the current position is no longer aligned with the block size.
-            // In this case, due to block misalignement the write operation might take longer than expected.
-
-            // Perform sync to reduce chances of critical errors
-            try self.file.sync();
+            // Record the progress. This is the only place the file is synced.
+            if ((writeBehind.service.position() -% last_checkpoint) >= config.http_checkpoint_interval) {
+                self.saveCheckpoint(checkpoint_key, url_crc, file_crc, fileSize) catch {};
+                last_checkpoint = writeBehind.service.position();
+            }
+        } else if ((200 == status_code) and (self.rangeValidator() != null)) {
+            // If-Range did not match: the server sends the complete new resource.
+            // Drop the partial file and the checkpoint.
+            try writeBehind.service.drain();
+            try storage.service.truncate(&self.file, 0);
+            try storage.service.sync(&self.file);
+            self.clearCheckpoint(checkpoint_key);
+
+            return @"error".resource_changed;
         } else {
             return @"error".unexpected_status_code;
         }
         if (parsed_response.keep_alive) |kA| {
             if (kA == .close) {
                 // Reconnect logic
-                try self.connection.close();
-
-                try self.connection.open(uri, null);
+                try self.reconnect(uri);
             } else {
                 //  Keep Alive
             }
         }
     }
 
-    if (self.file.tell() != fileSize) {
+    try writeBehind.service.commit();
+
+    if (writeBehind.service.position() != fileSize) {
         return @"error".file_size_mismatch;
     }
 
-    // return the etag ?
+    if (self.hash_valid) {
+        var digest: [32]u8 = undefined;
+        self.hasher.finish(&digest) catch {};
+        self.digest = digest;
+    }
+
+    self.clearCheckpoint(checkpoint_key);
+}
+
+/// Check if a resource changed since the given validators were recorded
+/// Issues a single conditional request. Returns false on 304 Not Modified.
+/// On change, the new validators are available through `eTag` and `lastModified`.
+pub fn checkModified(self: *@This(), url: []const u8, etag: ?[]const u8, last_modified: ?[]const u8) !bool {
+    var parsed_response: parsedResponse = undefined;
+
+    // Parse the URI
+    var uri = try std.Uri.parse(url);
+
+    try self.connect(uri);
+    defer {
+        self.connection.close() catch {};
+    }
+
+    try self.sendConditionalHeadRequest(url, etag, last_modified);
+
+    switch (try parsed_response.processHeaders(try self.recieveResponse())) {
+        304 => return false,
+        200 => {
+            self.setValidators(parsed_response.etag, parsed_response.last_modified);
+            return true;
+        },
+        else => return @"error".status_code_nok,
+    }
+}
+
+/// Download a file with a single GET request
+///
+/// Used when byte ranges cannot be used. The chunked transfer coding is removed and deflate encoded
+/// bodies are decompressed on the fly, so the file is written in bounded memory.
+/// Streamed downloads are not resumable.
+fn streamDownload(self: *@This(), url: []const u8, file_name: [*:0]const u8, checkpoint_key: nvm.app_nvm_keys, comptime max_file_size: usize) !void {
+    var parsed_response: parsedResponse = undefined;
+
+    try self.sendEncodedGetRequest(url);
+
+    const response = try self.recieveResponse();
+    if (200 != try parsed_response.processHeaders(response)) {
+        return @"error".status_code_nok;
+    }
+
+    self.setValidators(parsed_response.etag, parsed_response.last_modified);
+    self.clearCheckpoint(checkpoint_key);
+
+    var body = bodyReader.init(self, &parsed_response, response.payload);
+
+    try self.writeBody(&parsed_response, &body, file_name, max_file_size);
+}
+
+/// Write a response body to a file
+/// The transfer coding and deflate content coding are removed, the SHA-256 is computed inline.
+fn writeBody(self: *@This(), parsed_response: *const parsedResponse, body: *bodyReader, file_name: [*:0]const u8, max_file_size: usize) !void {
+    var sink = fileSink{ .http = self, .written = 0, .max_size = max_file_size };
+
+    self.file = try storage.service.open(file_name, @intFromEnum(file.fMode.create_always) | @intFromEnum(file.fMode.write));
+    defer {
+        storage.service.close(&self.file) catch {};
+    }
+
+    writeBehind.service.begin(&self.file);
+    defer {
+        writeBehind.service.drain() catch {};
+    }
+
+    self.hasher = sha256.init();
+    defer self.hasher.free();
+    try self.hasher.start();
+    self.hash_valid = true;
+
+    switch (parsed_response.content_encoding) {
+        .identity => {
+            while (try body.next()) |data| {
+                try sink.write(data);
+            }
+        },
+        .deflate => {
+            self.inflater.init(body, &sink);
+            try self.inflater.run();
+
+            // Keep the connection in sync if anything follows the compressed stream
+            while (try body.next()) |_| {}
+        },
+    }
+
+    try writeBehind.service.commit();
+
+    if (self.hash_valid) {
+        var digest: [32]u8 = undefined;
+        self.hasher.finish(&digest) catch {};
+        self.digest = digest;
+    }
 }
 
+/// Download a firmware image straight into the flash staging region
+///
+/// The data does not touch the SD card. `writer` erases ahead, programs whole words and hashes
+/// inline. Its progress markers let an interrupted ranged download resume as long as the resource
+/// did not change. Returns the size of the staged image.
+pub fn flashdownload(self: *@This(), url: []const u8, writer: *staging.writer) !usize {
+    var parsed_response: parsedResponse = undefined;
+
+    // Parse the URI
+    var uri = try std.Uri.parse(url);
+
+    try self.connect(uri);
+    defer {
+        self.connection.close() catch {};
+    }
+
+    try self.sendHeadRequest(url);
+
+    if (200 != try parsed_response.processHeaders(try self.recieveResponse())) {
+        return @"error".status_code_nok;
+    }
+
+    self.setValidators(parsed_response.etag, parsed_response.last_modified);
+    self.digest = null;
+
+    // Deflate is only decoded into files
+    if (parsed_response.content_encoding != .identity) return @"error".unsupported_encoding;
+    const size = parsed_response.content_length orelse return @"error".file_size_mismatch;
+
+    const validator = self.rangeValidator();
+    const ranged = parsed_response.rangesUsable() and (validator != null);
+    const image_id = std.hash.Crc32.hash(url) ^ std.hash.Crc32.hash(validator orelse "");
+
+    // Errors keep the markers, the next attempt resumes
+    const resume_offset = try writer.begin(image_id, size, ranged);
+
+    if (resume_offset != 0) {
+        _ = c.printf("Resuming staging at %d\r\n", resume_offset);
+    }
+
+    if (parsed_response.closesConnection()) {
+        try self.reconnect(uri);
+    }
+
+    if (!ranged) {
+        try self.sendGetRequest(url);
+
+        const response = try self.recieveResponse();
+        if (200 != try parsed_response.processHeaders(response)) return @"error".status_code_nok;
+        if (parsed_response.content_encoding != .identity) return @"error".unsupported_encoding;
+
+        var body = bodyReader.init(self, &parsed_response, response.payload);
+        while (try body.next()) |data| {
+            try writer.write(data);
+        }
+    }
+
+    while (ranged and (writer.position() < size)) {
+        const start = writer.position();
+        const requestEnd = calcRequestEnd(size, self.rangeSpan(staging.write_block_size), start);
+
+        try self.sendGetRangeRequest(url, start, requestEnd, validator);
+
+        const status_code = try parsed_response.processHeaders(try self.recieveResponse());
+
+        if (206 == status_code) {
+            // Flash can only be written sequentially
+            const range = parsed_response.range orelse return @"error".range_response_parse_error;
+            if (range.start != start) return @"error".range_response_parse_error;
+
+            var body = bodyReader.init(self, &parsed_response, parsed_response.payload);
+            while (try body.next()) |data| {
+                try writer.write(data);
+            }
+        } else if (200 == status_code) {
+            // If-Range did not match: the resource changed
+            writer.discard();
+            return @"error".resource_changed;
+        } else {
+            return @"error".unexpected_status_code;
+        }
+
+        if (parsed_response.closesConnection()) {
+            try self.reconnect(uri);
+        }
+    }
+
+    self.digest = try writer.finish();
+
+    return size;
+}
+
+/// A resource fetched by `fetchAll`
+pub const resource = struct {
+    url: []const u8,
+    file_name: [*:0]const u8,
+    max_size: usize,
+
+    /// Lower values are fetched first, e.g. signatures before the files they sign
+    priority: u8 = 0,
+
+    /// Checks the file as soon as it is complete, while later resources are still in flight
+    verifier: ?*const fn (file_name: [*:0]const u8) anyerror!void = null,
+
+    /// Outcome of the download and the verification
+    result: anyerror!void = {},
+
+    /// SHA-256 of the file
+    digest: ?[32]u8 = null,
+
+    fn lessThan(context: void, lhs: @This(), rhs: @This()) bool {
+        _ = context;
+        return lhs.priority < rhs.priority;
+    }
+};
+
+/// Resources share a connection if scheme, host and port match
+fn sameOrigin(a: std.Uri, b: std.Uri) bool {
+    return std.mem.eql(u8, a.scheme, b.scheme) and std.mem.eql(u8, a.host orelse "", b.host orelse "") and (a.port == b.port);
+}
+
+/// Fetch a batch of resources
+///
+/// Resources are fetched in priority order over one persistent connection per origin. Up to
+/// `config.http_pipeline_depth` GET requests are in flight, so the server streams the next file
+/// while the previous one is written and verified. If the server closes the connection, the
+/// unanswered requests are sent again on a new one.
+///
+/// The outcome of each resource is in its `result`. Returns an error only if no connection could be made.
+pub fn fetchAll(self: *@This(), resources: []resource) !void {
+    var origin: ?std.Uri = null;
+    var next_request: usize = 0;
+    var next_response: usize = 0;
+
+    // Stable: equal priorities keep their order
+    std.mem.sort(resource, resources, {}, resource.lessThan);
+
+    defer {
+        if (origin != null) self.connection.close() catch {};
+    }
+
+    while (next_response < resources.len) {
+        const res = &resources[next_response];
+
+        const uri = std.Uri.parse(res.url) catch |err| {
+            res.result = err;
+            next_response += 1;
+            next_request = @max(next_request, next_response);
+            continue;
+        };
+
+        if ((origin == null) or !sameOrigin(origin.?, uri)) {
+            if (origin != null) self.connection.close() catch {};
+            origin = null;
+
+            try self.connect(uri);
+            origin = uri;
+            next_request = next_response;
+        }
+
+        // Pipeline the following requests to the same origin
+        while ((next_request < resources.len) and ((next_request - next_response) < config.http_pipeline_depth)) {
+            const req_uri = std.Uri.parse(resources[next_request].url) catch break;
+            if (!sameOrigin(uri, req_uri)) break;
+
+            self.sendGetRequest(resources[next_request].url) catch break;
+            next_request += 1;
+        }
+
+        var keep_alive = false;
+        if (next_request > next_response) {
+            keep_alive = self.fetchResponse(res) catch |err| blk: {
+                res.result = err;
+                break :blk false;
+            };
+        } else {
+            // The request could not be sent
+            res.result = @"error".tx_error;
+        }
+
+        next_response += 1;
+
+        if (!keep_alive) {
+            // Requests after this one are answered on a new connection
+            self.connection.close() catch {};
+            origin = null;
+        }
+    }
+}
+
+/// Read the response of `res` into its file and run its verifier
+/// Returns false if the connection can not carry further responses.
+fn fetchResponse(self: *@This(), res: *resource) !bool {
+    var parsed_response: parsedResponse = undefined;
+
+    const response = try self.recieveResponse();
+    const status_code = try parsed_response.processHeaders(response);
+
+    // Without a delimited body, the response ends with the connection
+    const delimited = parsed_response.chunked or (parsed_response.content_length != null);
+    const keep_alive = delimited and !parsed_response.closesConnection();
+
+    var body = bodyReader.init(self, &parsed_response, response.payload);
+
+    if (200 != status_code) {
+        res.result = @"error".status_code_nok;
+
+        // Skip the error page
+        if (keep_alive) {
+            while (try body.next()) |_| {}
+        }
+        return keep_alive;
+    }
+
+    self.setValidators(parsed_response.etag, parsed_response.last_modified);
+    self.digest = null;
+
+    // A body that was not read completely leaves the connection out of sync
+    try self.writeBody(&parsed_response, &body, res.file_name, res.max_size);
+
+    res.digest = self.digest;
+    res.result = if (res.verifier) |verify| verify(res.file_name) else {};
+
+    return keep_alive;
+}
+
+/// ETag of the last downloaded resource
 pub fn eTag(self: *@This()) ?[]const u8 {
-    return self.etag;
+    return if (self.etag_len != 0) self.etag[0..self.etag_len] else null;
+}
+
+/// Last-Modified of the last downloaded resource
+pub fn lastModified(self: *@This()) ?[]const u8 {
+    return if (self.last_modified_len != 0) self.last_modified[0..self.last_modified_len] else null;
+}
+
+/// SHA-256 of the last downloaded file, if it could be computed while downloading
+pub fn fileDigest(self: *@This()) ?[32]u8 {
+    return self.digest;
+}
+
+/// Number of file syncs during downloads
+pub fn fileSyncs(self: *@This()) u32 {
+    _ = self;
+    return writeBehind.service.syncs;
+}
+
+/// Number of TLS handshakes performed by the HTTP client
+pub fn tlsHandshakes(self: *@This()) u32 {
+    return self.connection.handshakes();
 }
 
 pub fn create(self: *@This()) void {
+    self.etag_len = 0;
+    self.last_modified_len = 0;
+    self.digest = null;
+    self.rx_leftover = self.rx_buffer[0..0];
+
     if (config.enable_http) {
-        self.connection.init();
+        self.connection.init(self);
+        writeBehind.service.create();
     }
 }
 
@@ -409,8 +1256,10 @@ const responseHeaders = enum(usize) {
     contentEncoding,
     acceptRanges,
     etag,
+    lastModified,
+    transferEncoding,
 
-    const stringMap = std.ComptimeStringMap(@This(), .{ .{ "Content-Type", .contentType }, .{ "Content-Length", .contentLength }, .{ "Content-Range", .contentRange }, .{ "Connection", .connection }, .{ "Content-Location", .contentLocation }, .{ "Content-Encoding", .contentEncoding }, .{ "Accept-Ranges", .acceptRanges }, .{ "ETag", .etag } });
+    const stringMap = std.ComptimeStringMap(@This(), .{ .{ "Content-Type", .contentType }, .{ "Content-Length", .contentLength }, .{ "Content-Range", .contentRange }, .{ "Connection", .connection }, .{ "Content-Location", .contentLocation }, .{ "Content-Encoding", .contentEncoding }, .{ "Accept-Ranges", .acceptRanges }, .{ "ETag", .etag }, .{ "Last-Modified", .lastModified }, .{ "Transfer-Encoding", .transferEncoding } });
 
     /// Match a response header to the stringmap
     fn match(header: c.phr_header) ?@This() {
@@ -430,6 +1279,19 @@ const acceptRanges = enum(usize) {
     }
 };
 
+/// Supported content codings
+const contentEncoding = enum(usize) {
+    identity,
+    /// zlib stream (RFC 1950)
+    deflate,
+
+    const stringMap = std.ComptimeStringMap(@This(), .{ .{ "identity", .identity }, .{ "deflate", .deflate } });
+
+    fn match(header: c.phr_header) !@This() {
+        return (stringMap.get(header.value[0..(header.value_len)])) orelse @"error".unsupported_encoding;
+    }
+};
+
 const keepAlive = enum(usize) {
     keep_alive = @intFromBool(true),
     close = @intFromBool(false),
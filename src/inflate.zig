@@ -0,0 +1,364 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! Streaming zlib inflater (RFC 1950 / RFC 1951) with a bounded window
+//!
+//! Input is pulled from `Source.next()`, which returns the next slice of compressed data or null at
+//! the end of the stream. Output is pushed to `Sink.write()` in pieces of at most one window.
+//! The window size is fixed at compile time. Streams declaring a larger window in the zlib header are
+//! rejected, so the sender has to compress with a matching window (e.g. `zlib.compressobj(wbits=12)`).
+//! Huffman decoding follows the canonical decoder of zlib's `puff.c`.
+
+const std = @import("std");
+
+pub const inflate_error = error{
+    /// Invalid zlib header or preset dictionary requested
+    invalid_header,
+    /// Stream window exceeds the local window
+    window_too_large,
+    /// Reserved block type
+    invalid_block_type,
+    /// Stored block length does not match its complement
+    invalid_stored_length,
+    /// Invalid or incomplete Huffman code
+    invalid_code,
+    /// Distance too far back
+    invalid_distance,
+    /// Input ended before the end of the stream
+    unexpected_end,
+    /// Adler-32 of the output does not match
+    checksum_mismatch,
+};
+
+const max_bits = 15;
+const max_lcodes = 286;
+const max_dcodes = 30;
+const fix_lcodes = 288;
+
+const length_base = [29]u16{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const length_extra = [29]u5{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const dist_base = [30]u16{ 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const dist_extra = [30]u5{ 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/// Order of the code length code lengths
+const code_length_order = [19]u8{ 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+/// Canonical Huffman table
+fn huffman(comptime num_symbols: usize) type {
+    return struct {
+        /// Number of symbols of each code length
+        count: [max_bits + 1]u16 = undefined,
+        /// Symbols ordered by code
+        symbol: [num_symbols]u16 = undefined,
+
+        /// Build the table from code lengths.
+        /// Returns 0 for a complete code, > 0 for an incomplete code and < 0 for an over-subscribed code.
+        fn construct(self: *@This(), lengths: []const u16) i32 {
+            var offsets: [max_bits + 1]u16 = undefined;
+
+            @memset(&self.count, 0);
+            for (lengths) |len| {
+                self.count[len] += 1;
+            }
+
+            if (self.count[0] == lengths.len) return 0; // No codes
+
+            var left: i32 = 1;
+            for (1..max_bits + 1) |len| {
+                left <<= 1;
+                left -= self.count[len];
+                if (left < 0) return left;
+            }
+
+            offsets[1] = 0;
+            for (1..max_bits) |len| {
+                offsets[len + 1] = offsets[len] + self.count[len];
+            }
+
+            for (lengths, 0..) |len, symbol| {
+                if (len != 0) {
+                    self.symbol[offsets[len]] = @intCast(symbol);
+                    offsets[len] += 1;
+                }
+            }
+
+            return left;
+        }
+    };
+}
+
+pub fn Inflater(comptime window_bits: u4, comptime Source: type, comptime Sink: type) type {
+    if (window_bits < 8 or window_bits > 15) @compileError("window_bits must be between 8 and 15");
+
+    return struct {
+        const window_size: usize = @as(usize, 1) << window_bits;
+
+        source: *Source = undefined,
+        sink: *Sink = undefined,
+
+        /// Remaining input of the current source slice
+        input: []const u8 = &.{},
+        bit_buf: u32 = 0,
+        bit_cnt: u5 = 0,
+
+        /// Sliding window, also used as output buffer
+        window: [window_size]u8 = undefined,
+        window_pos: usize = 0,
+        /// Number of valid bytes in the window
+        window_fill: usize = 0,
+        /// Start of the data not yet passed to the sink
+        flush_pos: usize = 0,
+
+        checksum: std.hash.Adler32 = undefined,
+
+        lencode: huffman(fix_lcodes) = .{},
+        distcode: huffman(max_dcodes) = .{},
+        lengths: [max_lcodes + max_dcodes]u16 = undefined,
+
+        /// Prepare a new stream
+        pub fn init(self: *@This(), source: *Source, sink: *Sink) void {
+            self.source = source;
+            self.sink = sink;
+            self.input = &.{};
+            self.bit_buf = 0;
+            self.bit_cnt = 0;
+            self.window_pos = 0;
+            self.window_fill = 0;
+            self.flush_pos = 0;
+            self.checksum = std.hash.Adler32.init();
+        }
+
+        /// Decompress the complete stream
+        pub fn run(self: *@This()) !void {
+            try self.header();
+
+            var last: u32 = 0;
+            while (last == 0) {
+                last = try self.bits(1);
+
+                switch (try self.bits(2)) {
+                    0 => try self.stored(),
+                    1 => try self.fixed(),
+                    2 => try self.dynamic(),
+                    else => return inflate_error.invalid_block_type,
+                }
+            }
+
+            try self.flush();
+
+            // Adler-32 trailer, byte aligned and big endian
+            self.bit_buf = 0;
+            self.bit_cnt = 0;
+
+            var adler: u32 = 0;
+            for (0..4) |_| {
+                adler = (adler << 8) | try self.byte();
+            }
+
+            if (adler != self.checksum.final()) return inflate_error.checksum_mismatch;
+        }
+
+        fn byte(self: *@This()) !u8 {
+            while (self.input.len == 0) {
+                self.input = (try self.source.next()) orelse return inflate_error.unexpected_end;
+            }
+
+            const val = self.input[0];
+            self.input = self.input[1..];
+            return val;
+        }
+
+        /// Read `need` bits, LSB first (need <= 13)
+        fn bits(self: *@This(), need: u5) !u32 {
+            var val: u32 = self.bit_buf;
+
+            while (self.bit_cnt < need) {
+                val |= @as(u32, try self.byte()) << self.bit_cnt;
+                self.bit_cnt += 8;
+            }
+
+            self.bit_buf = val >> need;
+            self.bit_cnt -= need;
+
+            return val & ((@as(u32, 1) << need) - 1);
+        }
+
+        /// Pass the pending output to the sink
+        fn flush(self: *@This()) !void {
+            if (self.window_pos > self.flush_pos) {
+                const data = self.window[self.flush_pos..self.window_pos];
+                self.checksum.update(data);
+                try self.sink.write(data);
+            }
+            self.flush_pos = self.window_pos;
+        }
+
+        fn put(self: *@This(), val: u8) !void {
+            self.window[self.window_pos] = val;
+            self.window_pos += 1;
+
+            if (self.window_fill < window_size) self.window_fill += 1;
+
+            if (self.window_pos == window_size) {
+                try self.flush();
+                self.window_pos = 0;
+                self.flush_pos = 0;
+            }
+        }
+
+        fn header(self: *@This()) !void {
+            const cmf = try self.byte();
+            const flg = try self.byte();
+
+            if ((((@as(u16, cmf) << 8) | flg) % 31) != 0) return inflate_error.invalid_header;
+            if ((cmf & 0x0F) != 8) return inflate_error.invalid_header; // Deflate
+            if ((flg & 0x20) != 0) return inflate_error.invalid_header; // Preset dictionary
+            if ((cmf >> 4) > 7) return inflate_error.invalid_header;
+            if (((cmf >> 4) + 8) > window_bits) return inflate_error.window_too_large;
+        }
+
+        fn stored(self: *@This()) !void {
+            // Discard the remaining bits of the current byte
+            self.bit_buf = 0;
+            self.bit_cnt = 0;
+
+            var len: u16 = try self.byte();
+            len |= @as(u16, try self.byte()) << 8;
+            var nlen: u16 = try self.byte();
+            nlen |= @as(u16, try self.byte()) << 8;
+
+            if (len != ~nlen) return inflate_error.invalid_stored_length;
+
+            while (len > 0) : (len -= 1) {
+                try self.put(try self.byte());
+            }
+        }
+
+        fn decode(self: *@This(), h: anytype) !u16 {
+            var code: i32 = 0; // Bits being decoded
+            var first: i32 = 0; // First code of length len
+            var index: i32 = 0; // Index of first code of length len in symbol table
+
+            for (1..max_bits + 1) |len| {
+                code |= @intCast(try self.bits(1));
+                const count: i32 = h.count[len];
+                if ((code - count) < first) {
+                    return h.symbol[@intCast(index + (code - first))];
+                }
+                index += count;
+                first += count;
+                first <<= 1;
+                code <<= 1;
+            }
+
+            return inflate_error.invalid_code;
+        }
+
+        fn codes(self: *@This()) !void {
+            while (true) {
+                var symbol = try self.decode(&self.lencode);
+
+                if (symbol < 256) {
+                    try self.put(@intCast(symbol));
+                } else if (symbol == 256) {
+                    return; // End of block
+                } else {
+                    symbol -= 257;
+                    if (symbol >= length_base.len) return inflate_error.invalid_code;
+                    const len: usize = length_base[symbol] + try self.bits(length_extra[symbol]);
+
+                    symbol = try self.decode(&self.distcode);
+                    if (symbol >= dist_base.len) return inflate_error.invalid_code;
+                    const dist: usize = dist_base[symbol] + try self.bits(dist_extra[symbol]);
+
+                    if (dist > self.window_fill) return inflate_error.invalid_distance;
+
+                    var from = (self.window_pos + window_size - dist) % window_size;
+                    for (0..len) |_| {
+                        try self.put(self.window[from]);
+                        from = (from + 1) % window_size;
+                    }
+                }
+            }
+        }
+
+        fn fixed(self: *@This()) !void {
+            for (0..fix_lcodes) |symbol| {
+                self.lengths[symbol] = if (symbol < 144) 8 else if (symbol < 256) 9 else if (symbol < 280) 7 else 8;
+            }
+            _ = self.lencode.construct(self.lengths[0..fix_lcodes]);
+
+            @memset(self.lengths[0..max_dcodes], 5);
+            _ = self.distcode.construct(self.lengths[0..max_dcodes]);
+
+            try self.codes();
+        }
+
+        fn dynamic(self: *@This()) !void {
+            const nlen: usize = @as(usize, try self.bits(5)) + 257;
+            const ndist: usize = @as(usize, try self.bits(5)) + 1;
+            const ncode: usize = @as(usize, try self.bits(4)) + 4;
+
+            if ((nlen > max_lcodes) or (ndist > max_dcodes)) return inflate_error.invalid_code;
+
+            // Code length code
+            @memset(self.lengths[0..code_length_order.len], 0);
+            for (0..ncode) |index| {
+                self.lengths[code_length_order[index]] = @intCast(try self.bits(3));
+            }
+            if (0 != self.lencode.construct(self.lengths[0..code_length_order.len])) return inflate_error.invalid_code;
+
+            // Literal/length and distance code lengths
+            var index: usize = 0;
+            while (index < (nlen + ndist)) {
+                var symbol = try self.decode(&self.lencode);
+
+                if (symbol < 16) {
+                    self.lengths[index] = symbol;
+                    index += 1;
+                } else {
+                    var len: u16 = 0;
+                    if (symbol == 16) {
+                        if (index == 0) return inflate_error.invalid_code;
+                        len = self.lengths[index - 1];
+                        symbol = @intCast(3 + try self.bits(2));
+                    } else if (symbol == 17) {
+                        symbol = @intCast(3 + try self.bits(3));
+                    } else {
+                        symbol = @intCast(11 + try self.bits(7));
+                    }
+
+                    if ((index + symbol) > (nlen + ndist)) return inflate_error.invalid_code;
+                    @memset(self.lengths[index .. index + symbol], len);
+                    index += symbol;
+                }
+            }
+
+            if (self.lengths[256] == 0) return inflate_error.invalid_code; // No end-of-block code
+
+            var err = self.lencode.construct(self.lengths[0..nlen]);
+            if ((err < 0) or ((err > 0) and ((nlen - self.lencode.count[0]) != 1))) return inflate_error.invalid_code;
+
+            err = self.distcode.construct(self.lengths[nlen .. nlen + ndist]);
+            if ((err < 0) or ((err > 0) and ((ndist - self.distcode.count[0]) != 1))) return inflate_error.invalid_code;
+
+            try self.codes();
+        }
+    };
+}
@@ -19,14 +19,20 @@
 
 const std = @import("std");
 const connection = @import("connection.zig");
+const config = @import("config.zig");
+const freertos = @import("freertos.zig");
+const handshake_profiler = @import("handshake_profiler.zig");
 const c = @cImport({
     @cDefine("MBEDTLS_CONFIG_FILE", "\"miso_mbedtls_config.h\"");
+    @cDefine("MBEDTLS_ALLOW_PRIVATE_ACCESS", "(1)");
     @cInclude("mbedtls/ctr_drbg.h");
     @cInclude("mbedtls/timing.h");
     @cInclude("mbedtls/aes.h");
     @cInclude("mbedtls/base64.h");
     @cInclude("mbedtls/net_sockets.h");
     @cInclude("mbedtls/entropy.h");
+    @cInclude("mbedtls/ssl.h");
+    @cInclude("psa/crypto.h");
 });
 
 const ciphersuites_psk = [_]c_int{
@@ -36,7 +42,19 @@ const ciphersuites_psk = [_]c_int{
     0,
 };
 
+/// TLS 1.3 PSK suites first, TLS 1.2 PSK suites as fallback for servers without TLS 1.3
+const ciphersuites_psk_tls13 = [_]c_int{
+    c.MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+    c.MBEDTLS_TLS1_3_AES_128_CCM_SHA256,
+    c.MBEDTLS_TLS1_3_AES_128_CCM_8_SHA256,
+    c.MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+    c.MBEDTLS_TLS_PSK_WITH_AES_128_CCM_8,
+    c.MBEDTLS_TLS_PSK_WITH_AES_128_CCM,
+    0,
+};
+
 const ciphersuites_ec = [_]c_int{
+    c.MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
     c.MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8,
     c.MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM,
     0,
@@ -56,7 +74,7 @@ pub const auth_error = error{
     unsuported_mode,
 };
 
-pub const mbedtls_error = error{ psk_conf_error, generic_error, init_error, no_sec };
+pub const mbedtls_error = error{ psk_conf_error, ca_chain_error, hostname_error, handshake_error, generic_error, init_error, no_sec };
 
 pub const init_error = error{};
 
@@ -66,6 +84,18 @@ const tls_read_timeout: u32 = 5000;
 pub const mbedtls_ssl_context = c.mbedtls_ssl_context;
 pub const mbedtls_ssl_config = c.mbedtls_ssl_config;
 
+/// PSA crypto state. TLS 1.3 performs its crypto through PSA.
+var psa_crypto_ready: ?bool = null;
+
+/// Initialize PSA crypto once.
+/// If PSA can not be initialized (e.g. no entropy source), TLS 1.3 is not offered.
+fn psaCryptoReady() bool {
+    if (psa_crypto_ready == null) {
+        psa_crypto_ready = (0 == c.psa_crypto_init());
+    }
+    return psa_crypto_ready.?;
+}
+
 /// mbedTLS context
 pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: connection.security_mode) type {
     // Mbedtls context
@@ -123,6 +153,21 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
         /// DTLS CID
         cid: [c.MBEDTLS_SSL_CID_IN_LEN_MAX]u8,
 
+        /// TLS 1.3 offered in the current connection
+        tls13: bool,
+
+        /// Stored session (TLS 1.2 session or TLS 1.3 ticket) used for resumption
+        session: c.mbedtls_ssl_session,
+
+        /// Stored session is valid
+        session_valid: bool,
+
+        /// Handshake profiler
+        profiler: if (config.enable_handshake_profiler) handshake_profiler.Profiler else void,
+
+        /// Number of completed handshakes
+        handshakes: u32,
+
         /// Custom init callback
         custom_init_callback: ?custom_init_callback_fn = null,
 
@@ -131,7 +176,7 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
 
         // Default auth callback
         pub fn create(parent: *T, comptime auth_callback: credential_callback_fn, custom_init: ?custom_init_callback_fn, custom_cleanup: ?custom_cleanup_callback_fn) @This() {
-            return @This(){ .parent = parent, .conn = undefined, .auth_callback = auth_callback, .custom_init_callback = custom_init, .custom_cleanup_callback = custom_cleanup, .context = undefined, .timer = undefined, .config = undefined, .drbg = undefined, .entropy = undefined, .entropy_seed = 0x55555555, .ec = undefined, .cid = undefined };
+            return @This(){ .parent = parent, .conn = undefined, .auth_callback = auth_callback, .custom_init_callback = custom_init, .custom_cleanup_callback = custom_cleanup, .context = undefined, .timer = undefined, .config = undefined, .drbg = undefined, .entropy = undefined, .entropy_seed = 0x55555555, .ec = undefined, .cid = undefined, .tls13 = false, .session = undefined, .session_valid = false, .profiler = if (config.enable_handshake_profiler) .{} else {}, .handshakes = 0 };
         }
         /// Initialize the SSL context
         pub fn messup(self: *@This()) void {
@@ -158,7 +203,7 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
             } else {
                 // Free Own PK
                 if (mode == connection.security_mode.certificate_ec) {
-                    c.mbedtls_pk_free(&self.own_pk);
+                    c.mbedtls_pk_free(&self.ec.own_pk);
 
                     // Free Certificate Chains
                     c.mbedtls_x509_crt_free(&self.ec.own_crt);
@@ -176,7 +221,6 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
         /// Open a connection to peer
         pub fn open(self: *@This(), uri: std.Uri, local_port: ?u16) !void {
             const proto = connection.schemes.match(uri.scheme).?.getProtocol();
-            var ret: i32 = 0;
 
             try self.init(proto);
             errdefer {
@@ -188,13 +232,146 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                 self.conn.close() catch {};
             }
 
-            if (proto.isTls()) {
-                //ret = c.mbedtls_ssl_set_hostname(&self.context, @ptrCast(uri.host.?));
+            if (mode == connection.security_mode.certificate_ec) {
+                // The server certificate has to be issued for this host
+                try self.setHostname(uri.host orelse return mbedtls_error.hostname_error);
+            }
+
+            _ = try self.handshake(null);
+
+            if (mode == connection.security_mode.certificate_ec) {
+                // A connection with a certificate that does not verify is never used
+                if ((0 == c.mbedtls_ssl_is_handshake_over(&self.context)) or (0 != c.mbedtls_ssl_get_verify_result(&self.context))) {
+                    return mbedtls_error.handshake_error;
+                }
+            }
+        }
+        /// Open a connection to peer and send `early_data` with the first flight (TLS 1.3 0-RTT).
+        ///
+        /// Early data is only possible when a resumption ticket from a previous connection is stored.
+        /// If 0-RTT is not possible or the server rejects the early data, the data is sent again after the handshake (1-RTT).
+        /// Early data can be replayed by an attacker, so only pass data that is safe to be processed twice (e.g. MQTT CONNECT).
+        pub fn openWithEarlyData(self: *@This(), uri: std.Uri, local_port: ?u16, early_data: []const u8) !void {
+            const proto = connection.schemes.match(uri.scheme).?.getProtocol();
+
+            try self.init(proto);
+            errdefer {
+                _ = self.deinit();
+            }
+
+            try self.conn.open(uri, local_port);
+            errdefer {
+                self.conn.close() catch {};
+            }
+
+            const accepted = try self.handshake(early_data);
+
+            if (accepted != early_data.len) {
+                // Early data rejected, not sent or only partially sent. Continue with 1-RTT.
+                _ = try self.send(early_data[accepted..]);
+            }
+        }
+        /// Perform the handshake.
+        /// If `early_data` is provided, it is written as TLS 1.3 early data while the handshake progresses.
+        /// Returns the number of early data bytes accepted by the server.
+        /// A handshake that does not complete returns `handshake_error`.
+        fn handshake(self: *@This(), early_data: ?[]const u8) mbedtls_error!usize {
+            var ret: i32 = c.MBEDTLS_ERR_SSL_WANT_WRITE;
+            var written: usize = 0;
+
+            if (config.enable_handshake_profiler) {
+                self.profiler.start(self.context.state);
+            }
+            defer {
+                if (config.enable_handshake_profiler) {
+                    self.profiler.finish();
+                }
+            }
+
+            if (early_data) |data| {
+                if (self.tls13 and self.session_valid) {
+                    while (written < data.len) {
+                        const slice = data[written..];
+                        ret = c.mbedtls_ssl_write_early_data(&self.context, slice.ptr, slice.len);
+                        if (ret == c.MBEDTLS_ERR_SSL_WANT_WRITE) {
+                            // Wait for the socket instead of spinning, give up on early data when it stalls
+                            if (!(self.conn.waitTx(config.network_tx_timeout_s) catch false)) break;
+                        } else if (ret == c.MBEDTLS_ERR_SSL_WANT_READ) {
+                            if (!(self.conn.waitRx(tls_read_timeout / std.time.ms_per_s) catch false)) break;
+                        } else if (ret > 0) {
+                            written += @as(usize, @intCast(ret));
+                        } else {
+                            // Early data not possible (e.g. ticket does not allow it)
+                            break;
+                        }
+                    }
+                }
             }
 
             ret = c.MBEDTLS_ERR_SSL_WANT_WRITE;
             while ((ret != 0) and ((ret == c.MBEDTLS_ERR_SSL_WANT_WRITE) or (ret == c.MBEDTLS_ERR_SSL_WANT_READ))) {
-                ret = c.mbedtls_ssl_handshake(&self.context);
+                ret = self.handshakeSteps();
+            }
+
+            if (ret != 0) {
+                // Do not offer a session that failed to resume
+                self.dropSession();
+                return mbedtls_error.handshake_error;
+            }
+
+            self.handshakes +%= 1;
+
+            if (written != 0) {
+                // A server rejecting early data discards all of it
+                if (c.MBEDTLS_SSL_EARLY_DATA_STATUS_ACCEPTED != c.mbedtls_ssl_get_early_data_status(&self.context)) {
+                    written = 0;
+                }
+            }
+
+            if (!self.tls13 or (c.mbedtls_ssl_get_version_number(&self.context) == c.MBEDTLS_SSL_VERSION_TLS1_2)) {
+                // TLS 1.2 sessions can be stored right after the handshake.
+                // TLS 1.3 tickets arrive after the handshake, see `read_tls`.
+                self.saveSession();
+            }
+
+            return written;
+        }
+        /// Run handshake steps until the handshake is over or a step does not complete.
+        /// Equivalent to `mbedtls_ssl_handshake`, with each step accounted in the profiler.
+        fn handshakeSteps(self: *@This()) i32 {
+            var ret: i32 = 0;
+
+            while ((ret == 0) and (0 == c.mbedtls_ssl_is_handshake_over(&self.context))) {
+                const step_start = freertos.xTaskGetTickCount();
+
+                ret = c.mbedtls_ssl_handshake_step(&self.context);
+
+                if (config.enable_handshake_profiler) {
+                    const progressed = (ret != c.MBEDTLS_ERR_SSL_WANT_READ) and (ret != c.MBEDTLS_ERR_SSL_WANT_WRITE);
+                    self.profiler.step(self.context.state, progressed, freertos.xTaskGetTickCount() -% step_start);
+                }
+            }
+
+            return ret;
+        }
+        /// Store the negotiated session for resumption on the next open
+        fn saveSession(self: *@This()) void {
+            var session: c.mbedtls_ssl_session = undefined;
+
+            c.mbedtls_ssl_session_init(&session);
+            if (mbedtls_ok == c.mbedtls_ssl_get_session(&self.context, &session)) {
+                self.dropSession();
+                self.session = session;
+                self.session_valid = true;
+            } else {
+                c.mbedtls_ssl_session_free(&session);
+            }
+        }
+        /// Discard the stored session
+        fn dropSession(self: *@This()) void {
+            if (self.session_valid) {
+                c.mbedtls_ssl_session_free(&self.session);
+                self.session_valid = false;
             }
         }
         /// Close connection to peer
@@ -228,7 +405,13 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                 while (offset != buffer.len) {
                     const slice = buffer[offset..];
                     const num_bytes = c.mbedtls_ssl_write(&self.context, @ptrCast(slice.ptr), @intCast(slice.len));
-                    if ((c.MBEDTLS_ERR_SSL_WANT_READ == num_bytes) or (c.MBEDTLS_ERR_SSL_WANT_WRITE == num_bytes) or (c.MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS == num_bytes) or (c.MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS == num_bytes)) {
+                    if (c.MBEDTLS_ERR_SSL_WANT_WRITE == num_bytes) {
+                        // Socket applies backpressure, wait for write readiness instead of spinning
+                        if (!(self.conn.waitTx(config.network_tx_timeout_s) catch false)) {
+                            ret = -1;
+                            break;
+                        }
+                    } else if ((c.MBEDTLS_ERR_SSL_WANT_READ == num_bytes) or (c.MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS == num_bytes) or (c.MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS == num_bytes)) {
                         continue;
                     } else if (num_bytes < 0) {
                         ret = -1;
@@ -260,6 +443,12 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                 numBytes = c.mbedtls_ssl_read(&self.context, @ptrCast(buffer.ptr), @intCast(buffer.len));
             }
 
+            if (numBytes == c.MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+                // TLS 1.3 ticket for the next connection. No application data was read.
+                self.saveSession();
+                return buffer[0..0];
+            }
+
             return if (numBytes < 0) connection.connection_error.recieve_error else buffer[0..@intCast(numBytes)];
         }
         /// Send data via TLS
@@ -269,7 +458,13 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
             while (offset < buffer.len) {
                 const slice = buffer[offset..];
                 const num_bytes = c.mbedtls_ssl_write(&self.context, @ptrCast(slice.ptr), @intCast(slice.len));
-                if ((c.MBEDTLS_ERR_SSL_WANT_READ == num_bytes) or (c.MBEDTLS_ERR_SSL_WANT_WRITE == num_bytes) or (c.MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS == num_bytes) or (c.MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS == num_bytes)) {
+                if (c.MBEDTLS_ERR_SSL_WANT_WRITE == num_bytes) {
+                    // Socket applies backpressure, wait for write readiness instead of spinning
+                    if (!(self.conn.waitTx(config.network_tx_timeout_s) catch false)) {
+                        ret = num_bytes;
+                        break;
+                    }
+                } else if ((c.MBEDTLS_ERR_SSL_WANT_READ == num_bytes) or (c.MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS == num_bytes) or (c.MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS == num_bytes)) {
                     continue;
                 } else if (num_bytes >= 0) {
                     offset += @as(usize, @intCast(num_bytes));
@@ -293,18 +488,37 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
         fn send_c(ctx: ?*anyopaque, data: [*c]const u8, data_len: usize) callconv(.C) c_int {
             const self: *@This() = @as(*@This(), @ptrCast(@alignCast(ctx)));
             const len = self.conn.send_c(data[0..data_len]);
+            if (config.enable_handshake_profiler) {
+                self.profiler.sent(@intCast(len));
+            }
             return if (len == connection.EAGAIN) c.MBEDTLS_ERR_SSL_WANT_WRITE else len;
         }
         /// Recieve data callback for MbedTLS
         fn recv_c(ctx: ?*anyopaque, data: [*c]u8, data_len: usize) callconv(.C) c_int {
             const self: *@This() = @as(*@This(), @ptrCast(@alignCast(ctx)));
             const len = self.conn.recieve_c(data[0..data_len]);
+            if (config.enable_handshake_profiler) {
+                self.profiler.received(@intCast(len));
+            }
             return if (len == connection.EAGAIN) c.MBEDTLS_ERR_SSL_WANT_READ else len;
         }
 
         pub fn waitRx(self: *@This(), timeout: u32) !bool {
+            // Decrypted data left over from the last record does not show on the socket
+            if (0 != c.mbedtls_ssl_get_bytes_avail(&self.context)) return true;
+
             return self.conn.waitRx(timeout);
         }
+
+        pub fn waitTx(self: *@This(), timeout: u32) !bool {
+            return self.conn.waitTx(timeout);
+        }
+        /// Largest amount of application data a single read can return.
+        /// Reflects the negotiated maximum fragment length. Valid after the handshake.
+        pub fn maxRecordPayload(self: *@This()) usize {
+            const ret = c.mbedtls_ssl_get_max_in_record_payload(&self.context);
+            return if (ret > 0) @intCast(ret) else 0;
+        }
         /// Initialize the MbedTLS context
         pub fn init(self: *@This(), protocol: connection.proto) !void {
             var ret: i32 = mbedtls_nok;
@@ -313,6 +527,9 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                 // Running init on a non secure protocol
                 return mbedtls_error.no_sec;
 
+            // TLS 1.3 is used for PSK over TLS only
+            self.tls13 = config.enable_tls13 and (mode == connection.security_mode.psk) and protocol.isTls() and psaCryptoReady();
+
             // custom init callback
             if (self.custom_init_callback) |custom| {
                 custom(self, mode);
@@ -329,7 +546,8 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                     ret = c.mbedtls_ssl_conf_max_frag_len(&self.config, c.MBEDTLS_SSL_MAX_FRAG_LEN_1024);
                 }
                 if (ret == mbedtls_ok) {
-                    c.mbedtls_ssl_conf_authmode(&self.config, c.MBEDTLS_SSL_VERIFY_OPTIONAL); // None since using PSK
+                    // PSK authenticates both sides, certificates have to chain to a configured CA
+                    c.mbedtls_ssl_conf_authmode(&self.config, if (mode == connection.security_mode.psk) c.MBEDTLS_SSL_VERIFY_OPTIONAL else c.MBEDTLS_SSL_VERIFY_REQUIRED);
                     c.mbedtls_ssl_conf_read_timeout(&self.config, tls_read_timeout);
                     c.mbedtls_ssl_conf_rng(&self.config, c.mbedtls_ctr_drbg_random, &self.drbg);
                     //mbedtls_entropy_add_source(&entropy_context, mbedtls_entropy_f_source_ptr f_source, void *p_source, size_t threshold, MBEDTLS_ENTROPY_SOURCE_STRONG );
@@ -346,7 +564,7 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
 
                 if (ret == mbedtls_ok) {
                     switch (mode) {
-                        .psk => c.mbedtls_ssl_conf_ciphersuites(&self.config, &ciphersuites_psk[0]),
+                        .psk => c.mbedtls_ssl_conf_ciphersuites(&self.config, if (self.tls13) &ciphersuites_psk_tls13[0] else &ciphersuites_psk[0]),
                         .certificate_ec => c.mbedtls_ssl_conf_ciphersuites(&self.config, &ciphersuites_ec[0]),
                         else => {
                             // This authentication mode is not supported yet.
@@ -360,6 +578,18 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                     c.mbedtls_ssl_conf_renegotiation(&self.config, c.MBEDTLS_SSL_RENEGOTIATION_ENABLED);
                 }
 
+                if (ret == mbedtls_ok) {
+                    if (self.tls13) {
+                        // TLS 1.3 with external PSK or resumption PSK (tickets), 0-RTT early data enabled
+                        c.mbedtls_ssl_conf_max_tls_version(&self.config, c.MBEDTLS_SSL_VERSION_TLS1_3);
+                        c.mbedtls_ssl_conf_tls13_key_exchange_modes(&self.config, c.MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK_ALL);
+                        c.mbedtls_ssl_conf_session_tickets(&self.config, c.MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+                        c.mbedtls_ssl_conf_early_data(&self.config, c.MBEDTLS_SSL_EARLY_DATA_ENABLED);
+                    } else {
+                        c.mbedtls_ssl_conf_max_tls_version(&self.config, c.MBEDTLS_SSL_VERSION_TLS1_2);
+                    }
+                }
+
                 if (protocol.isDtls()) {
                     if (ret == mbedtls_ok) {
                         ret = c.mbedtls_ssl_conf_cid(&self.config, self.cid.len, c.MBEDTLS_SSL_UNEXPECTED_CID_FAIL);
@@ -375,6 +605,13 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
                     ret = c.mbedtls_ssl_setup(&self.context, &self.config);
                 }
 
+                if ((ret == mbedtls_ok) and self.session_valid) {
+                    // Offer the stored session for resumption
+                    if (mbedtls_ok != c.mbedtls_ssl_set_session(&self.context, &self.session)) {
+                        self.dropSession();
+                    }
+                }
+
                 if (protocol.isDtls()) {
                     if (ret == mbedtls_ok) {
                         @memset(&self.cid, 0);
@@ -410,6 +647,26 @@ pub fn TlsContext(comptime T: type, comptime connType: type, comptime mode: conn
         pub fn confPsk(self: *@This(), psk: []u8, psk_id: [*:0]u8) !void {
             return if (mbedtls_ok != c.mbedtls_ssl_conf_psk(&self.config, psk.ptr, psk.len, &psk_id[0], c.strlen(psk_id))) mbedtls_error.psk_conf_error else {};
         }
+        /// Trust the CA certificates in `pem`, including the terminating null character
+        pub fn confCaChain(self: *@This(), pem: []const u8) !void {
+            if (mode != connection.security_mode.certificate_ec) @compileError("CA chains are used in certificate mode only");
+
+            if (mbedtls_ok != c.mbedtls_x509_crt_parse(&self.ec.peer_crt, pem.ptr, pem.len)) return mbedtls_error.ca_chain_error;
+
+            c.mbedtls_ssl_conf_ca_chain(&self.config, &self.ec.peer_crt, null);
+        }
+        /// Name checked against the server certificate and sent as SNI
+        fn setHostname(self: *@This(), host: []const u8) !void {
+            var name: [254]u8 = undefined;
+
+            if (host.len >= name.len) return mbedtls_error.hostname_error;
+
+            @memcpy(name[0..host.len], host);
+            name[host.len] = 0;
+
+            // mbedTLS keeps a copy
+            if (mbedtls_ok != c.mbedtls_ssl_set_hostname(&self.context, &name)) return mbedtls_error.hostname_error;
+        }
     };
 }
 
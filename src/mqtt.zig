@@ -840,9 +840,19 @@ pub fn connect(self: *@This(), uri: std.Uri) !void {
         self.connection.close() catch {};
     }
 
-    try self.connection.open(uri, null);
+    if (config.enable_tls13) {
+        // Send CONNECT with the first TLS flight (0-RTT) when resuming a TLS 1.3 session.
+        // CONNECT with clean session is safe to be replayed.
+        _ = try self.packet.prepareConnectPacket(self.device_id[0..c.strlen(self.device_id)], null, null);
 
-    _ = try self.packet.prepareConnectPacket(self.device_id[0..c.strlen(self.device_id)], null, null);
+        const connect_packet = self.packet.txQueue.receive(&txBuffer, 0) orelse return mqtt_error.dequeue_failed;
+
+        try self.connection.openWithEarlyData(uri, null, connect_packet);
+    } else {
+        try self.connection.open(uri, null);
+
+        _ = try self.packet.prepareConnectPacket(self.device_id[0..c.strlen(self.device_id)], null, null);
+    }
 
     try self.processSendQueue();
 
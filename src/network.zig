@@ -24,6 +24,7 @@ const config = @import("config.zig");
 const system = @import("system.zig");
 const mqtt = @import("mqtt.zig");
 const http = @import("http.zig");
+const dns = @import("dns.zig");
 pub const lwm2m = @import("lwm2m.zig");
 
 const c = @cImport({
@@ -84,6 +85,9 @@ pub fn start() void {
     // Create the SimpleLink Spawn task
     simpleLinkSpawnTask.init() catch unreachable;
 
+    // Create the DNS resolver
+    dns.service.create();
+
     // Create the LWM2M service
     lwm2m.service.create();
 
@@ -20,7 +20,7 @@ const std = @import("std");
 const c = @cImport({
     @cInclude("board.h");
     @cInclude("nvm3.h");
-    @cInclude("nvm3_hal_flash.h");
+    @cInclude("flash_hal.h");
     @cInclude("string.h");
 });
 
@@ -101,6 +101,24 @@ pub const app_nvm_keys = enum(u20) {
 
     firmware_size,
 
+    /// Progress of an interrupted HTTP download
+    download_checkpoint,
+
+    /// Last-Modified of the last accepted firmware (ETag is in `firmware_etag`)
+    firmware_last_modified,
+
+    /// Progress of the image in the flash staging region
+    staging_marker,
+
+    /// Progress of the firmware update in the bootloader
+    update_journal,
+
+    /// Cached SHA-256 of the installed application
+    app_digest,
+
+    /// Progress of an interrupted delta download, kept apart from the full image download
+    delta_checkpoint,
+
     max_key = 0x0FFFF,
 
     fn toInt(self: @This()) u32 {
@@ -128,7 +146,7 @@ const ret = enum(u32) {
 };
 
 //const page_size_alignment: usize = 4096;
-const max_object_size: usize = 256;
+pub const max_object_size: usize = 256;
 const cache_len: usize = 48;
 
 /// Silabs NVM3 handle
@@ -142,7 +160,7 @@ const nvm_size_in_bytes: usize = 16 * 4096;
 const nvm_initial_address: c.nvm3_HalPtr_t = @ptrFromInt(0x000F0000); // 1024*1024 - 16*4096
 
 /// NVM3 initial configuration
-pub export const miso_nvm3_init: c.nvm3_Init_t = .{ .nvmAdr = nvm_initial_address, .nvmSize = nvm_size_in_bytes, .cachePtr = &cache, .cacheEntryCount = cache.len, .maxObjectSize = max_object_size, .repackHeadroom = 0, .halHandle = &c.nvm3_halFlashHandle };
+pub export const miso_nvm3_init: c.nvm3_Init_t = .{ .nvmAdr = nvm_initial_address, .nvmSize = nvm_size_in_bytes, .cachePtr = &cache, .cacheEntryCount = cache.len, .maxObjectSize = max_object_size, .repackHeadroom = 0, .halHandle = &c.flash_hal_nvm3_handle };
 
 /// NVM3 cache
 var cache: [cache_len]c.nvm3_CacheEntry_t align(@alignOf(u32)) = undefined;
@@ -246,6 +264,11 @@ pub fn writeDataCString(key: app_nvm_keys, value: [*c]const u8) !void {
     try ret.check(c.nvm3_writeData(&miso_nvm3, key.toInt(), value, len));
 }
 
+/// Delete an object from NVM
+pub fn deleteObject(key: app_nvm_keys) !void {
+    try ret.check(c.nvm3_deleteObject(&miso_nvm3, key.toInt()));
+}
+
 /// Write a 32-Bit counter value
 fn writeCounter(key: app_nvm_keys, value: u32) !void {
     try ret.check(c.nvm3_writeCounter(&miso_nvm3, key.toInt(), value));
@@ -296,6 +319,13 @@ pub inline fn isUpdateRequested() !bool {
     return (try readCounter(.update_request)) != 0;
 }
 
+/// Forget the validators of the accepted firmware, so the next check downloads it again
+/// Used by the bootloader when an accepted image is not installed.
+pub fn clearFirmwareValidators() void {
+    deleteObject(.firmware_etag) catch {};
+    deleteObject(.firmware_last_modified) catch {};
+}
+
 pub inline fn setFirmwareSize(size: u32) !void {
     try writeCounter(.firmware_size, size);
 }
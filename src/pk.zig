@@ -21,12 +21,16 @@ const std = @import("std");
 const freertos = @import("freertos.zig");
 const c = @cImport({
     @cDefine("MBEDTLS_CONFIG_FILE", "\"miso_mbedtls_config.h\"");
+    @cDefine("MBEDTLS_ALLOW_PRIVATE_ACCESS", "(1)");
     @cInclude("board.h");
+    @cInclude("mbedtls/asn1.h");
+    @cInclude("mbedtls/bignum.h");
     @cInclude("mbedtls/sha256.h");
     @cInclude("mbedtls/ecp.h");
     @cInclude("mbedtls/ecdsa.h");
     @cInclude("mbedtls/pem.h");
     @cInclude("mbedtls/x509_crt.h");
+    @cInclude("trusted_key_table.h");
 });
 
 ctx: c.mbedtls_pk_context,
@@ -34,6 +38,8 @@ ctx: c.mbedtls_pk_context,
 pub const pk_error = error{
     parse_key_error,
     verify_error,
+    unsupported_key,
+    trusted_key_error,
 };
 
 pub fn init() @This() {
@@ -59,3 +65,176 @@ pub fn verify(self: *@This(), hash: []u8, sig: []const u8) !void {
 pub fn free(self: *@This()) void {
     c.mbedtls_pk_free(&self.ctx);
 }
+
+/// Trusted verification key with a fixed-point comb table.
+///
+/// A regular ECDSA verification computes `u1*G + u2*Q`. The `u1*G` half uses the static
+/// generator table of mbedTLS, but the comb table for the public key `Q` is rebuilt on every
+/// verification. Here `Q` is installed as base point of a private copy of the curve group, so the
+/// comb multiplication of mbedTLS treats it like the generator. The table comes from flash when the
+/// build links one for this key (trusted_key_table.h). Otherwise mbedTLS builds it in RAM on the
+/// first verification and keeps it in the group.
+const trusted = struct {
+    /// Standard curve group (static generator table)
+    var grp: c.mbedtls_ecp_group = undefined;
+    /// Curve group with the trusted key as base point
+    var key_grp: c.mbedtls_ecp_group = undefined;
+    /// Groups are loaded
+    var loaded: bool = false;
+
+    fn unload() void {
+        if (loaded) {
+            // G of the key group is not owned by the statically loaded group
+            c.mbedtls_ecp_point_free(&key_grp.G);
+            c.mbedtls_ecp_group_free(&key_grp);
+            c.mbedtls_ecp_group_free(&grp);
+            loaded = false;
+        }
+    }
+};
+
+/// Install the parsed public key as trusted key for `verifyTrusted`.
+/// Installing the same key again keeps the comb table.
+pub fn setTrusted(self: *@This()) !void {
+    if (c.mbedtls_pk_get_type(&self.ctx) != c.MBEDTLS_PK_ECKEY) {
+        trusted.unload(); // Never keep verifying with a stale key
+        return pk_error.unsupported_key;
+    }
+
+    const keypair: *c.mbedtls_ecp_keypair = @ptrCast(@alignCast(self.ctx.pk_ctx));
+
+    if (trusted.loaded) {
+        if ((trusted.grp.id == keypair.grp.id) and (0 == c.mbedtls_ecp_point_cmp(&trusted.key_grp.G, &keypair.Q))) {
+            return; // Same key, keep the table
+        }
+        trusted.unload();
+    }
+
+    c.mbedtls_ecp_group_init(&trusted.grp);
+    c.mbedtls_ecp_group_init(&trusted.key_grp);
+    errdefer {
+        c.mbedtls_ecp_group_free(&trusted.key_grp);
+        c.mbedtls_ecp_group_free(&trusted.grp);
+    }
+
+    if (0 != c.mbedtls_ecp_group_load(&trusted.grp, keypair.grp.id)) return pk_error.trusted_key_error;
+    if (0 != c.mbedtls_ecp_group_load(&trusted.key_grp, keypair.grp.id)) return pk_error.trusted_key_error;
+
+    // The loaded base point references static constants. Replace it instead of overwriting it.
+    c.mbedtls_ecp_point_init(&trusted.key_grp.G);
+    errdefer c.mbedtls_ecp_point_free(&trusted.key_grp.G);
+
+    if (0 != c.mbedtls_ecp_copy(&trusted.key_grp.G, &keypair.Q)) return pk_error.trusted_key_error;
+
+    if (flashTable(&trusted.key_grp)) |table| {
+        // T_size 0 marks a static table for mbedTLS: used as is, never freed
+        trusted.key_grp.T = @constCast(table);
+        trusted.key_grp.T_size = 0;
+    } else {
+        // Drop the static generator table. The table for the new base point is built on first use.
+        trusted.key_grp.T = null;
+        trusted.key_grp.T_size = 0;
+    }
+
+    trusted.loaded = true;
+}
+
+/// The comb table linked into flash, if it belongs to the base point of `key_grp`
+fn flashTable(key_grp: *c.mbedtls_ecp_group) ?[*]const c.mbedtls_ecp_point {
+    const linked: ?[*]const c.mbedtls_ecp_point = c.trusted_key_table;
+    const table = linked orelse return null;
+
+    // mbedTLS uses a window of 5 bits below 384 bits for a static base point table, 6 above.
+    // See ecp_pick_window(). The table has 2^(window - 1) entries.
+    const table_len: usize = if (key_grp.nbits >= 384) 32 else 16;
+
+    if (c.trusted_key_grp_id != key_grp.id) return null;
+    if (c.trusted_key_table_len != table_len) return null;
+
+    // The first entry is the key itself
+    if (0 != c.mbedtls_mpi_cmp_mpi(&table[0].X, &key_grp.G.X)) return null;
+    if (0 != c.mbedtls_mpi_cmp_mpi(&table[0].Y, &key_grp.G.Y)) return null;
+
+    return table;
+}
+
+/// Flash taken by the comb table of the trusted key, 0 if its table is built in RAM
+pub fn trustedTableSize() usize {
+    if (!trusted.loaded or (trusted.key_grp.T == null) or (trusted.key_grp.T_size != 0)) return 0;
+
+    return c.trusted_key_table_size;
+}
+
+/// Verify a DER encoded ECDSA signature over `hash` using the trusted key.
+///
+/// mbedTLS has no verification entry point that takes a table for `Q`. The steps are those of
+/// `mbedtls_ecdsa_verify()`, with `u2*Q` computed in the key group.
+pub fn verifyTrusted(hash: []const u8, sig: []const u8) !void {
+    if (!trusted.loaded) return pk_error.trusted_key_error;
+
+    var r: c.mbedtls_mpi = undefined;
+    var s: c.mbedtls_mpi = undefined;
+    var e: c.mbedtls_mpi = undefined;
+    var s_inv: c.mbedtls_mpi = undefined;
+    var u1: c.mbedtls_mpi = undefined;
+    var u2: c.mbedtls_mpi = undefined;
+    var zero: c.mbedtls_mpi = undefined;
+    var one: c.mbedtls_mpi = undefined;
+    var v: c.mbedtls_mpi = undefined;
+    var R: c.mbedtls_ecp_point = undefined;
+    var R2: c.mbedtls_ecp_point = undefined;
+
+    const mpis = [_]*c.mbedtls_mpi{ &r, &s, &e, &s_inv, &u1, &u2, &zero, &one, &v };
+    for (mpis) |mpi| c.mbedtls_mpi_init(mpi);
+    defer for (mpis) |mpi| c.mbedtls_mpi_free(mpi);
+
+    c.mbedtls_ecp_point_init(&R);
+    defer c.mbedtls_ecp_point_free(&R);
+    c.mbedtls_ecp_point_init(&R2);
+    defer c.mbedtls_ecp_point_free(&R2);
+
+    const grp = &trusted.grp;
+
+    // Parse the signature: SEQUENCE { r INTEGER, s INTEGER }
+    var p: [*c]u8 = @constCast(sig.ptr);
+    const end: [*c]u8 = p + sig.len;
+    var len: usize = 0;
+
+    if (0 != c.mbedtls_asn1_get_tag(&p, end, &len, c.MBEDTLS_ASN1_CONSTRUCTED | c.MBEDTLS_ASN1_SEQUENCE)) return pk_error.verify_error;
+    if ((p + len) != end) return pk_error.verify_error;
+    if (0 != c.mbedtls_asn1_get_mpi(&p, end, &r)) return pk_error.verify_error;
+    if (0 != c.mbedtls_asn1_get_mpi(&p, end, &s)) return pk_error.verify_error;
+
+    // 1 <= r, s < N
+    if ((c.mbedtls_mpi_cmp_int(&r, 1) < 0) or (c.mbedtls_mpi_cmp_mpi(&r, &grp.N) >= 0)) return pk_error.verify_error;
+    if ((c.mbedtls_mpi_cmp_int(&s, 1) < 0) or (c.mbedtls_mpi_cmp_mpi(&s, &grp.N) >= 0)) return pk_error.verify_error;
+
+    // e = leftmost nbits of the hash
+    const hash_len = @min(hash.len, (grp.nbits + 7) / 8);
+    if (0 != c.mbedtls_mpi_read_binary(&e, hash.ptr, hash_len)) return pk_error.verify_error;
+    if ((hash_len * 8) > grp.nbits) {
+        if (0 != c.mbedtls_mpi_shift_r(&e, hash_len * 8 - grp.nbits)) return pk_error.verify_error;
+    }
+
+    // u1 = e / s mod N, u2 = r / s mod N
+    if (0 != c.mbedtls_mpi_inv_mod(&s_inv, &s, &grp.N)) return pk_error.verify_error;
+    if (0 != c.mbedtls_mpi_mul_mpi(&u1, &e, &s_inv)) return pk_error.verify_error;
+    if (0 != c.mbedtls_mpi_mod_mpi(&u1, &u1, &grp.N)) return pk_error.verify_error;
+    if (0 != c.mbedtls_mpi_mul_mpi(&u2, &r, &s_inv)) return pk_error.verify_error;
+    if (0 != c.mbedtls_mpi_mod_mpi(&u2, &u2, &grp.N)) return pk_error.verify_error;
+
+    if (0 != c.mbedtls_mpi_lset(&zero, 0)) return pk_error.verify_error;
+    if (0 != c.mbedtls_mpi_lset(&one, 1)) return pk_error.verify_error;
+
+    // R2 = u2 * Q, using the cached comb table of the key group
+    if (0 != c.mbedtls_ecp_muladd(&trusted.key_grp, &R2, &u2, &trusted.key_grp.G, &zero, &trusted.key_grp.G)) return pk_error.verify_error;
+
+    // R = u1 * G + R2, using the static generator table
+    if (0 != c.mbedtls_ecp_muladd(grp, &R, &u1, &grp.G, &one, &R2)) return pk_error.verify_error;
+
+    if (0 != c.mbedtls_ecp_is_zero(&R)) return pk_error.verify_error;
+
+    // v = x(R) mod N, signature is valid if v == r
+    if (0 != c.mbedtls_mpi_mod_mpi(&v, &R.X, &grp.N)) return pk_error.verify_error;
+    if (0 != c.mbedtls_mpi_cmp_mpi(&v, &r)) return pk_error.verify_error;
+}
@@ -25,6 +25,8 @@ const c = @cImport({
 });
 
 const connection = @import("connection.zig");
+const config = @import("config.zig");
+const dns = @import("dns.zig");
 
 const conn_error = connection.connection_error;
 // SimpleLink Wrapper
@@ -160,14 +162,9 @@ pub fn SimpleLinkConnection(comptime proto: connection.proto) type {
             const host = uri.host.?;
             const port = uri.port.?; // If port is not provided, hang!
 
-            // Resolve the ip address using DNS
-            var host_ip: u32 = 0;
-            const dns = c.sl_NetAppDnsGetHostByName(@as([*c]i8, @ptrCast(@constCast(host.ptr))), @intCast(host.len), &host_ip, @intCast(@intFromEnum(settings.fam)));
-            if (dns >= 0) {
-                self.peer = ipv4Peer.create(host_ip, port);
-            } else {
-                return conn_error.dns;
-            }
+            // Resolve the ip address using the DNS cache
+            const host_ip = dns.service.resolve(host, config.dns_timeout_ms) catch return conn_error.dns;
+            self.peer = ipv4Peer.create(host_ip, port);
 
             // Get Socket
             try self.socket();
@@ -191,7 +188,11 @@ pub fn SimpleLinkConnection(comptime proto: connection.proto) type {
                 _ = c.sl_Bind(self.sd, @ptrCast(self.local.getAddrPtr()), @intCast(self.local.getLen()));
             }
 
-            try self.connect();
+            self.connect() catch |err| {
+                // The cached address may be outdated
+                dns.service.invalidate(host);
+                return err;
+            };
 
             // Register with the connection manager
         }
@@ -253,8 +254,14 @@ pub fn SimpleLinkConnection(comptime proto: connection.proto) type {
         pub const recieve_c = if (proto.isTcp()) recieve_tcp else recieve_udp;
 
         /// Send
+        /// Waits for write readiness while the socket applies backpressure
         pub fn send(self: *@This(), data: []const u8) !usize {
-            const ret = self.send_c(data);
+            var ret = self.send_c(data);
+
+            while (ret == connection.EAGAIN) {
+                if (!(try self.waitTx(config.network_tx_timeout_s))) return conn_error.send_error;
+                ret = self.send_c(data);
+            }
 
             return if (ret <= 0) conn_error.send_error else @intCast(ret);
         }
@@ -286,6 +293,11 @@ pub fn SimpleLinkConnection(comptime proto: connection.proto) type {
             return connection.network_mediator_wait_rx(self.sd, timeout_s);
         }
 
+        /// Wait for the socket to accept data
+        pub fn waitTx(self: *@This(), timeout_s: u32) !bool {
+            return connection.network_mediator_wait_tx(self.sd, timeout_s);
+        }
+
         pub fn getProto(self: *@This()) connection.proto {
             _ = self;
             return proto;
@@ -0,0 +1,398 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! Storage service
+//!
+//! Tasks used to access the SD card themselves. The FatFs volume lock serialized them, so a network
+//! task could stall for the whole duration of another task's SD transfer.
+//!
+//! File and directory requests are now queued to the storage task. Completion is signaled with a
+//! callback in the storage task or by waking the submitting task. Requests on the file accessed
+//! last are served first, so interleaved users still get long sequential runs. Requests on the
+//! same file are always served in submission order.
+//!
+//! The HTTP client and the configuration handling go through this service. The bootloader has no
+//! storage task and calls FatFs itself, as do `config.calculateFileHash` and the delta patcher.
+
+const std = @import("std");
+const freertos = @import("freertos.zig");
+const config = @import("config.zig");
+const fatfs = @import("fatfs.zig");
+const sha256 = @import("sha256.zig");
+
+pub const storage_error = error{
+    /// The queue stayed full
+    queue_full,
+    /// The request did not complete in time
+    timeout,
+    /// The SD card accepted less data than written
+    write_incomplete,
+};
+
+const queue_depth = config.storage_queue_depth;
+
+comptime {
+    if ((queue_depth == 0) or (queue_depth > 255)) @compileError("Storage queue depth out of range");
+}
+
+/// Path and mode of an `open`
+pub const open_args = struct {
+    path: [*:0]const u8,
+    mode: u8,
+};
+
+/// Old and new name of a `rename`
+pub const rename_args = struct {
+    from: [*:0]const u8,
+    to: [*:0]const u8,
+};
+
+/// Operation and its buffer
+pub const operation = union(enum) {
+    /// Open the file of the request
+    open: open_args,
+    /// Close the file
+    close: void,
+    /// Move the file position to the offset of the request
+    seek: void,
+    /// Cut the file at the offset of the request
+    truncate: void,
+    /// Allocate contiguous space for the given size
+    preallocate: usize,
+    /// Rename a file or directory, the request has no file
+    rename: rename_args,
+    /// Delete a file or directory, the request has no file
+    unlink: [*:0]const u8,
+    /// Read into the buffer
+    read: []u8,
+    /// Write the data
+    write: []const u8,
+    /// Flush the file
+    sync: void,
+    /// SHA-256 of the file from the offset to its end
+    hash: *[32]u8,
+};
+
+/// Storage request, owned by the submitter until it completes
+pub const request = struct {
+    file: ?*fatfs.file,
+    op: operation,
+    /// File position, null for the current position
+    offset: ?usize,
+    /// Called in the storage task on completion. Without one, `wait` blocks the submitter.
+    callback: ?*const fn (*request) void = null,
+    context: ?*anyopaque = null,
+
+    /// Bytes transferred or hashed, or the error
+    result: anyerror!usize = 0,
+
+    submitted: freertos.TickType_t = 0,
+    done: freertos.StaticBinarySemaphore() = .{},
+
+    pub fn init(file: ?*fatfs.file, op: operation, offset: ?usize) @This() {
+        return .{ .file = file, .op = op, .offset = offset };
+    }
+
+    /// Wait for a request submitted without a callback
+    pub fn wait(self: *@This(), timeout_ms: ?u32) !usize {
+        _ = self.done.take(timeout_ms) catch return storage_error.timeout;
+        return self.result;
+    }
+};
+
+/// Queue and latency statistics
+pub const statistics = struct {
+    /// Requests queued or in progress
+    depth: u32,
+    /// Highest depth seen
+    max_depth: u32,
+    /// Completed requests
+    completed: u32,
+    /// Sum of the submission-to-completion times in ticks, see `ticksToMs`
+    latency_total: u32,
+    /// Longest submission-to-completion time in ticks, see `ticksToMs`
+    latency_max: u32,
+
+    /// Convert one of the latencies to milliseconds
+    pub fn ticksToMs(ticks: u32) u32 {
+        return ticks * freertos.portTICK_PERIOD_MS;
+    }
+};
+
+task: freertos.StaticTask(@This(), config.rtos_stack_depth_storage, "storage", run),
+queue: freertos.StaticQueue(*request, queue_depth),
+
+/// Requests taken from the queue, in submission order
+pending: [queue_depth]*request,
+pending_len: usize,
+
+/// File of the last request served
+last_file: ?*fatfs.file,
+/// Requests served in a row on `last_file`
+run_len: u32,
+
+/// Hash input buffer
+block: [config.storage_hash_block_size]u8 align(@alignOf(u32)),
+
+stats: statistics,
+
+/// Queue a request. Waits up to `timeout_ms` for room in the queue.
+pub fn submit(self: *@This(), req: *request, timeout_ms: ?u32) !void {
+    if (req.callback == null) {
+        try req.done.create();
+    }
+
+    req.submitted = freertos.xTaskGetTickCount();
+
+    const depth = @atomicRmw(u32, &self.stats.depth, .Add, 1, .Monotonic) + 1;
+    _ = @atomicRmw(u32, &self.stats.max_depth, .Max, depth, .Monotonic);
+
+    self.queue.send(&req, timeout_ms) catch {
+        _ = @atomicRmw(u32, &self.stats.depth, .Sub, 1, .Monotonic);
+        return storage_error.queue_full;
+    };
+}
+
+/// Queue a request and wait for it
+pub fn execute(self: *@This(), req: *request) !usize {
+    req.callback = null;
+    try self.submit(req, null);
+    return req.wait(null);
+}
+
+/// Run one operation in the storage task and wait for it
+fn call(self: *@This(), file: ?*fatfs.file, op: operation, offset: ?usize) !usize {
+    var req = request.init(file, op, offset);
+    return self.execute(&req);
+}
+
+/// Open a file in the storage task
+pub fn open(self: *@This(), path: [*:0]const u8, mode: u8) !fatfs.file {
+    var file: fatfs.file = undefined;
+
+    _ = try self.call(&file, .{ .open = .{ .path = path, .mode = mode } }, null);
+
+    return file;
+}
+
+/// Close a file in the storage task
+pub fn close(self: *@This(), file: *fatfs.file) !void {
+    _ = try self.call(file, .close, null);
+}
+
+/// Read from the current position, or from `offset`
+pub fn read(self: *@This(), file: *fatfs.file, offset: ?usize, buf: []u8) ![]u8 {
+    return buf[0..try self.call(file, .{ .read = buf }, offset)];
+}
+
+/// Move the file position
+pub fn seek(self: *@This(), file: *fatfs.file, offset: usize) !void {
+    _ = try self.call(file, .seek, offset);
+}
+
+/// Cut the file at `offset`
+pub fn truncate(self: *@This(), file: *fatfs.file, offset: usize) !void {
+    _ = try self.call(file, .truncate, offset);
+}
+
+/// Flush the file
+pub fn sync(self: *@This(), file: *fatfs.file) !void {
+    _ = try self.call(file, .sync, null);
+}
+
+/// Allocate contiguous space, see `fatfs.file.preallocate`
+pub fn preallocate(self: *@This(), file: *fatfs.file, len: usize) !void {
+    _ = try self.call(file, .{ .preallocate = len }, null);
+}
+
+/// Rename a file in the storage task
+pub fn rename(self: *@This(), from: [*:0]const u8, to: [*:0]const u8) !void {
+    _ = try self.call(null, .{ .rename = .{ .from = from, .to = to } }, null);
+}
+
+/// Delete a file in the storage task
+pub fn unlink(self: *@This(), path: [*:0]const u8) !void {
+    _ = try self.call(null, .{ .unlink = path }, null);
+}
+
+/// Hash a file in the storage task
+pub fn hashFile(self: *@This(), path: [*:0]const u8, digest: *[32]u8) ![]u8 {
+    var file = try self.open(path, @intFromEnum(fatfs.file.fMode.read));
+    defer self.close(&file) catch {};
+
+    _ = try self.call(&file, .{ .hash = digest }, 0);
+
+    return digest[0..];
+}
+
+/// Copy of the statistics
+pub fn getStatistics(self: *const @This()) statistics {
+    return self.stats;
+}
+
+/// Next request to serve: the oldest one on the file accessed last, otherwise the oldest one.
+/// Taking the oldest request of a file keeps the requests of every file in order.
+/// A run on one file ends after `config.storage_max_run` requests or once the oldest request waited
+/// `config.storage_max_wait_ms`, so a steady stream on one file does not starve the others.
+fn next(self: *@This()) *request {
+    var idx: usize = 0;
+
+    const oldest_age_ms = (freertos.xTaskGetTickCount() -% self.pending[0].submitted) * freertos.portTICK_PERIOD_MS;
+    const keep_run = (self.run_len < config.storage_max_run) and (oldest_age_ms < config.storage_max_wait_ms);
+
+    if (if (keep_run) self.last_file else null) |last| {
+        for (self.pending[0..self.pending_len], 0..) |req, i| {
+            if (req.file == @as(?*fatfs.file, last)) {
+                idx = i;
+                break;
+            }
+        }
+    }
+
+    const req = self.pending[idx];
+
+    std.mem.copyForwards(*request, self.pending[idx .. self.pending_len - 1], self.pending[idx + 1 .. self.pending_len]);
+    self.pending_len -= 1;
+
+    return req;
+}
+
+fn seekTo(file: *fatfs.file, offset: ?usize) !void {
+    if (offset) |pos| {
+        if (file.tell() != pos) try file.lseek(pos);
+    }
+}
+
+fn readAt(file: *fatfs.file, offset: ?usize, buf: []u8) !usize {
+    if (offset) |pos| {
+        if ((file.extent != null) and ((pos % fatfs.sector_size) == 0)) {
+            return (try file.readRaw(pos, buf)).len;
+        }
+    }
+
+    try seekTo(file, offset);
+    return (try file.read(buf)).len;
+}
+
+/// Preallocated files take aligned writes as raw sectors
+fn writeAt(file: *fatfs.file, offset: ?usize, data: []const u8) !usize {
+    if (offset) |pos| {
+        if ((file.extent != null) and ((pos % fatfs.sector_size) == 0)) {
+            try file.writeRaw(pos, data);
+            return data.len;
+        }
+    }
+
+    try seekTo(file, offset);
+    if (data.len != try file.write(data)) return storage_error.write_incomplete;
+
+    return data.len;
+}
+
+fn hash(self: *@This(), file: *fatfs.file, offset: ?usize, digest: *[32]u8) !usize {
+    var hasher = sha256.init();
+    defer hasher.free();
+
+    try hasher.start();
+    try seekTo(file, offset);
+
+    var len: usize = 0;
+    while (try file.readEof(&self.block)) |data| {
+        try hasher.update(data);
+        len += data.len;
+    }
+
+    try hasher.finish(digest);
+
+    return len;
+}
+
+fn serve(self: *@This(), req: *request) anyerror!usize {
+    switch (req.op) {
+        .rename => |args| try fatfs.dir.rename(args.from, args.to),
+        .unlink => |path| try fatfs.dir.unlink(path),
+        else => {
+            const file = req.file.?;
+
+            switch (req.op) {
+                .open => |args| file.* = try fatfs.file.open(args.path, args.mode),
+                .close => try file.close(),
+                .seek => try seekTo(file, req.offset),
+                .truncate => {
+                    try seekTo(file, req.offset);
+                    try file.truncate();
+                },
+                .preallocate => |len| try file.preallocate(len),
+                .read => |buf| return readAt(file, req.offset, buf),
+                .write => |data| return writeAt(file, req.offset, data),
+                .sync => try file.sync(),
+                .hash => |digest| return self.hash(file, req.offset, digest),
+                .rename, .unlink => unreachable,
+            }
+        },
+    }
+
+    return 0;
+}
+
+fn run(self: *@This()) noreturn {
+    while (true) {
+        // Wait for work, then collect whatever else is queued
+        if (self.pending_len == 0) {
+            self.pending[0] = self.queue.recieve(null) orelse continue;
+            self.pending_len = 1;
+        }
+        while (self.pending_len < self.pending.len) {
+            self.pending[self.pending_len] = self.queue.recieve(0) orelse break;
+            self.pending_len += 1;
+        }
+
+        const req = self.next();
+
+        req.result = self.serve(req);
+
+        self.run_len = if (self.last_file == req.file) self.run_len + 1 else 1;
+        self.last_file = req.file;
+
+        const latency = freertos.xTaskGetTickCount() -% req.submitted;
+        self.stats.latency_total +%= latency;
+        self.stats.latency_max = @max(self.stats.latency_max, latency);
+        self.stats.completed +%= 1;
+        _ = @atomicRmw(u32, &self.stats.depth, .Sub, 1, .Monotonic);
+
+        // The request belongs to the submitter again after this
+        if (req.callback) |callback| {
+            callback(req);
+        } else {
+            req.done.give() catch {};
+        }
+    }
+}
+
+pub fn create(self: *@This()) void {
+    self.pending_len = 0;
+    self.last_file = null;
+    self.run_len = 0;
+    self.stats = std.mem.zeroes(statistics);
+
+    self.queue.create() catch unreachable;
+    self.task.create(self, config.rtos_prio_storage) catch unreachable;
+}
+
+pub var service: @This() = undefined;
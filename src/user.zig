@@ -39,6 +39,9 @@ const board = @import("microzig").board;
 const system = @import("system.zig");
 const firmware = @import("boot/firmware.zig");
 const ntp = @import("ntp.zig");
+const delta = @import("delta.zig");
+const staging = @import("boot/staging.zig");
+const storage = @import("storage.zig");
 
 const state = enum(usize) {
     verify_config = 0,
@@ -160,25 +163,46 @@ fn myUserTaskFunction(self: *@This()) noreturn {
 
                 _ = c.printf("NTP Sync: %d\r\n", system.time.now());
                 self.ntpTimer.changePeriod(nextSyncTime, null) catch unreachable;
-                self.state = .perform_firmware_download;
+                self.state = .get_config;
             } else |_| {
                 self.task.delayTask(16000); // wait for 16
                 self.state = .start_ntp_time; // unnecessary
             }
+        } else if (self.state == .get_config) {
+            if (config.enable_http and (config.getConfigUri().len != 0)) {
+                _ = c.printf("Fetching configuration\r\n");
+
+                fetchConfig();
+            }
+
+            self.state = .perform_firmware_download;
         } else if (self.state == .perform_firmware_download) {
             if (config.enable_http) {
                 _ = c.printf("Performing firmware download\r\n");
 
-                if (downloadAndVerify()) |_| {
-                    // Happy path
+                if (downloadAndVerify()) |updated| {
+                    if (updated) {
+                        // Happy path
+
+                        // A staged image is verified in flash, hand it to the bootloader
+                        if (staging.enabled) nvm.setUpdateRequest() catch {};
+
+                        //nvm.setUpdateRequest() catch unreachable;
+
+                        _ = c.printf("Firmware download complete, TLS handshakes: %d, file syncs: %d\r\n", http.service.tlsHandshakes(), http.service.fileSyncs());
 
-                    //nvm.setUpdateRequest() catch unreachable;
+                        const cache = fatfs.cacheStatistics();
+                        _ = c.printf("Sector cache hits: %d, read-ahead: %d, misses: %d, SD transactions: %d\r\n", cache.hits, cache.read_ahead, cache.misses, cache.transactions);
 
-                    _ = c.printf("Firmware download complete\r\n");
+                        const io = storage.service.getStatistics();
+                        _ = c.printf("Storage requests: %d, max queue depth: %d, max latency: %d ms\r\n", io.completed, io.max_depth, storage.statistics.ticksToMs(io.latency_max));
 
-                    self.task.delayTask(1000);
+                        self.task.delayTask(1000);
 
-                    // reset
+                        // reset
+                    } else {
+                        _ = c.printf("Firmware not modified\r\n");
+                    }
                 } else |err| {
                     if (err == firmware.firmware_error.firmware_already_in_system) {
                         _ = c.printf("Firmware already in system\n\r");
@@ -235,16 +259,152 @@ fn myUserTaskFunction(self: *@This()) noreturn {
     }
 }
 
+fn verifyConfig(path: [*:0]const u8) anyerror!void {
+    try config.verify_config_candidate(path, config.config_sig_new_file_name);
+}
+
+/// Replace the live configuration with the verified download and load it
+fn installConfig() !void {
+    storage.service.unlink(config.config_file_name) catch {};
+    storage.service.unlink(config.config_sig_file_name) catch {};
+
+    try storage.service.rename(config.config_sig_new_file_name, config.config_sig_file_name);
+    try storage.service.rename(config.config_new_file_name, config.config_file_name);
+
+    try config.open_config_file(config.config_file_name);
+}
+
+/// Fetch the configuration set from the config URI
+/// The signature is fetched first, so the configuration is verified as soon as it arrives. Both are
+/// downloaded to temporary files and only replace the live files once the signature checks out
+/// against the provisioned public key (CONFIG.PUB), which is never downloaded.
+fn fetchConfig() void {
+    var uri_buffer: [2][160]u8 = undefined;
+    const base = std.mem.trimRight(u8, config.getConfigUri(), "/");
+
+    // Server side names are the live file names without the drive
+    var resources = [_]http.resource{
+        .{ .url = std.fmt.bufPrint(&uri_buffer[0], "{s}/{s}", .{ base, config.config_file_name[3..] }) catch return, .file_name = config.config_new_file_name, .max_size = config.config_max_file_size, .priority = 1, .verifier = verifyConfig },
+        .{ .url = std.fmt.bufPrint(&uri_buffer[1], "{s}/{s}", .{ base, config.config_sig_file_name[3..] }) catch return, .file_name = config.config_sig_new_file_name, .max_size = config.file_block_size },
+    };
+
+    defer {
+        storage.service.unlink(config.config_new_file_name) catch {};
+        storage.service.unlink(config.config_sig_new_file_name) catch {};
+    }
+
+    http.service.fetchAll(&resources) catch |err| {
+        _ = c.printf("Configuration fetch failed: %s\r\n", @errorName(err).ptr);
+        return;
+    };
+
+    for (resources) |res| {
+        res.result catch |err| {
+            _ = c.printf("%s: %s\r\n", res.file_name, @errorName(err).ptr);
+            return;
+        };
+    }
+
+    installConfig() catch |err| {
+        _ = c.printf("Configuration install failed: %s\r\n", @errorName(err).ptr);
+    };
+}
+
+/// Store the validators of the accepted firmware image
+/// The bootloader clears them if it does not install the image, so the next check downloads it again.
+fn storeFirmwareValidators(etag: []const u8, last_modified: []const u8) void {
+    nvm.writeData(.firmware_etag, etag) catch {};
+    nvm.writeData(.firmware_last_modified, last_modified) catch {};
+}
+
+/// Reconstruct the firmware image from a delta against the running image
+/// Returns false if no usable delta is available
+fn downloadDelta() bool {
+    var uri_buffer: [256]u8 = undefined;
+
+    const delta_uri = std.fmt.bufPrint(&uri_buffer, "{s}{s}", .{ config.getHttpFwUri(), config.fw_delta_uri_suffix }) catch return false;
+
+    http.service.filedownload(delta_uri, config.fw_delta_file_name, .delta_checkpoint, config.file_block_size, config.fw_delta_max_size) catch return false;
+
+    // The delta rewrites the target of the full download, its progress no longer applies
+    nvm.deleteObject(.download_checkpoint) catch {};
+
+    const size = delta.apply(config.fw_delta_file_name, config.fw_file_name) catch |err| {
+        _ = c.printf("Delta not applicable: %s\r\n", @errorName(err).ptr);
+        return false;
+    };
+
+    _ = c.printf("Delta applied, image size %d\r\n", size);
+
+    return true;
+}
+
+/// Download and verify the firmware image
+/// Returns false if the server reports the accepted image as unchanged
 fn downloadAndVerify() !bool {
-    // Download the firmware
-    try http.service.filedownload(config.getHttpFwUri(), config.fw_file_name, config.file_block_size, 1024 * 1024);
+    var etag_buffer: [64]u8 = undefined;
+    var last_modified_buffer: [32]u8 = undefined;
+
+    const etag = nvm.readData(.firmware_etag, &etag_buffer) catch null;
+    const last_modified = nvm.readData(.firmware_last_modified, &last_modified_buffer) catch null;
+
+    const has_etag = (etag != null) and (etag.?.len != 0);
+    const has_last_modified = (last_modified != null) and (last_modified.?.len != 0);
+
+    // One conditional request. No SD writes or hashing if the image is unchanged.
+    if (!try http.service.checkModified(config.getHttpFwUri(), if (has_etag) etag else null, if (has_last_modified) last_modified else null)) {
+        return false;
+    }
 
-    try firmware.checkFirmwareImage(config.fw_file_name);
+    // Validators of the image on the server
+    var new_etag_buffer: [64]u8 = undefined;
+    var new_last_modified_buffer: [32]u8 = undefined;
+    const new_etag = copyValidator(&new_etag_buffer, http.service.eTag());
+    const new_last_modified = copyValidator(&new_last_modified_buffer, http.service.lastModified());
+
+    if (staging.enabled) {
+        // Straight into the staging region, the bootloader validates and installs it
+        const len = try http.service.flashdownload(config.getHttpFwUri(), &staging.image);
+
+        firmware.verifyStagedFirmware(len) catch |err| {
+            // Nothing to install
+            staging.clear();
+            if (err == firmware.firmware_error.firmware_already_in_system) storeFirmwareValidators(new_etag, new_last_modified);
+            return err;
+        };
+
+        storeFirmwareValidators(new_etag, new_last_modified);
+
+        return true;
+    }
+
+    // Prefer a delta against the running image, fall back to the full image
+    if (!(config.enable_delta_update and downloadDelta())) {
+        try http.service.filedownload(config.getHttpFwUri(), config.fw_file_name, .download_checkpoint, config.file_block_size, 1024 * 1024);
+    }
+
+    firmware.checkFirmwareImage(config.fw_file_name) catch |err| {
+        // An image identical to the running one is accepted as well
+        if (err == firmware.firmware_error.firmware_already_in_system) storeFirmwareValidators(new_etag, new_last_modified);
+        return err;
+    };
+
+    storeFirmwareValidators(new_etag, new_last_modified);
 
     return true;
 }
 
+fn copyValidator(buffer: []u8, value: ?[]const u8) []const u8 {
+    const val = value orelse return buffer[0..0];
+    const len = @min(val.len, buffer.len);
+    @memcpy(buffer[0..len], val[0..len]);
+    return buffer[0..len];
+}
+
 pub fn create(self: *@This()) void {
+    // SD card access of all tasks goes through the storage service
+    storage.service.create();
+
     self.state = state.verify_config;
     self.task.create(self, config.rtos_prio_user_task) catch unreachable;
     self.timer.create(2000, true, self) catch unreachable;
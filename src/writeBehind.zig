@@ -0,0 +1,183 @@
+// Copyright (c) 2023-2024 Francisco Llobet-Blandino and the "Miso Project".
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+//! Write-behind file sink
+//!
+//! Downloads used to call `f_write` and `f_sync` for every 512 byte block, so every block updated
+//! the FAT and the directory entry and the download ran at the pace of the SD card.
+//!
+//! Data is now collected in sector-aligned buffers and written by the storage task while the
+//! next buffer is filled from the network. The file is only synced at `commit`, which the
+//! downloads call when they record their progress.
+//!
+//! Buffers of a preallocated file go straight to its sectors, see `storage.writeAt`.
+
+const std = @import("std");
+const freertos = @import("freertos.zig");
+const config = @import("config.zig");
+const fatfs = @import("fatfs.zig");
+const storage = @import("storage.zig");
+
+const sector_size: usize = 512;
+const buffer_count = config.write_behind_buffers;
+
+comptime {
+    if ((config.write_behind_buffer_size % sector_size) != 0) @compileError("Write-behind buffers must be a multiple of the sector size");
+    if ((buffer_count < 2) or (buffer_count > 255)) @compileError("Write-behind needs at least two buffers");
+}
+
+/// Buffers not owned by the storage task
+free: freertos.Semaphore,
+free_buffer: freertos.StaticSemaphore_t,
+
+buffers: [buffer_count][config.write_behind_buffer_size]u8 align(@alignOf(u32)),
+/// Write requests of the buffers
+requests: [buffer_count]storage.request,
+
+/// Destination file
+file: *fatfs.file,
+
+/// Buffer being filled, if `holding`
+current: u8,
+holding: bool,
+fill: usize,
+
+/// File position of the start of the current buffer
+offset: usize,
+
+/// First error of the storage task
+err: ?anyerror,
+
+/// Statistics
+writes: u32,
+syncs: u32,
+
+/// Completion of a buffer write, runs in the storage task
+fn written(req: *storage.request) void {
+    const self: *@This() = @ptrCast(@alignCast(req.context));
+
+    if (req.result) |_| {} else |e| {
+        if (self.err == null) self.err = e;
+    }
+    self.writes +%= 1;
+
+    self.free.give() catch {};
+}
+
+fn acquire(self: *@This()) void {
+    _ = self.free.take(null) catch unreachable;
+    self.fill = 0;
+    self.holding = true;
+}
+
+fn submit(self: *@This()) !void {
+    const req = &self.requests[self.current];
+
+    // Buffers of one file are served in order
+    req.* = storage.request.init(self.file, .{ .write = self.buffers[self.current][0..self.fill] }, self.offset);
+    req.callback = written;
+    req.context = self;
+    try storage.service.submit(req, null);
+
+    self.offset += self.fill;
+    self.current = @intCast((self.current + 1) % buffer_count);
+    self.holding = false;
+}
+
+/// Bytes fitting into the current buffer. Buffers end on sector boundaries of the file,
+/// so FatFs writes whole sectors straight from the buffer.
+inline fn limit(self: *const @This()) usize {
+    return config.write_behind_buffer_size - (self.offset % sector_size);
+}
+
+/// Start writing to `file` at its current position
+pub fn begin(self: *@This(), file: *fatfs.file) void {
+    self.file = file;
+    self.offset = file.tell();
+    self.err = null;
+}
+
+/// Queue data for writing
+pub fn write(self: *@This(), data: []const u8) !void {
+    if (self.err) |e| return e;
+
+    var rem = data;
+    while (rem.len != 0) {
+        if (!self.holding) self.acquire();
+
+        const len = @min(rem.len, self.limit() - self.fill);
+        @memcpy(self.buffers[self.current][self.fill .. self.fill + len], rem[0..len]);
+        self.fill += len;
+        rem = rem[len..];
+
+        if (self.fill == self.limit()) {
+            try self.submit();
+        }
+    }
+}
+
+/// Position in the file after all queued data
+pub fn position(self: *const @This()) usize {
+    return self.offset + (if (self.holding) self.fill else 0);
+}
+
+/// Wait until all queued data is in the file
+/// Returns the first write error since `begin`.
+pub fn drain(self: *@This()) !void {
+    if (self.holding) {
+        if (self.fill != 0) {
+            try self.submit();
+        } else {
+            self.free.give() catch {};
+            self.holding = false;
+        }
+    }
+
+    // All buffers are free once the writer is idle
+    for (0..buffer_count) |_| {
+        _ = self.free.take(null) catch unreachable;
+    }
+    for (0..buffer_count) |_| {
+        self.free.give() catch {};
+    }
+
+    if (self.err) |e| return e;
+}
+
+/// Write all queued data and sync the file
+pub fn commit(self: *@This()) !void {
+    var req = storage.request.init(self.file, .sync, null);
+
+    try self.drain();
+    _ = try storage.service.execute(&req);
+    self.syncs +%= 1;
+}
+
+pub fn create(self: *@This()) void {
+    self.holding = false;
+    self.current = 0;
+    self.offset = 0;
+    self.err = null;
+    self.writes = 0;
+    self.syncs = 0;
+
+    self.free = freertos.Semaphore.createCountingSemaphoreStatic(buffer_count, buffer_count, &self.free_buffer) catch unreachable;
+}
+
+pub var service: @This() = undefined;
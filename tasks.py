@@ -66,4 +66,186 @@ def format_c_code(c):
 @task
 def format_zig_code(c):
     """Format Zig code."""
-    c.run("zig fmt --ast-check --color off .")
\ No newline at end of file
+    c.run("zig fmt --ast-check --color off .")
+
+
+def _delta_literal(old, new, start, end, shift):
+    """Encode a literal run as ADD against the shifted base image when it mostly matches, else INSERT."""
+    import struct
+
+    data = new[start:end]
+    base = start - shift
+    if 0 <= base and base + len(data) <= len(old):
+        diff = bytes((b - old[base + i]) & 0xFF for i, b in enumerate(data))
+        if diff.count(0) * 2 >= len(diff):
+            return struct.pack("<BII", 0x02, base, len(diff)) + diff
+    return struct.pack("<BI", 0x03, len(data)) + data
+
+
+@task(help={"old": "Signed image running on the device", "new": "Signed image to install", "out": "Patch file"})
+def make_delta(c, old, new, out):
+    """Create a firmware delta for FW.DLT."""
+    import hashlib
+    import struct
+
+    block = 16
+    old_data = Path(old).read_bytes()
+    new_data = Path(new).read_bytes()
+
+    index = {}
+    for offset in range(0, len(old_data) - block + 1):
+        index.setdefault(old_data[offset : offset + block], offset)
+
+    patch = bytearray(b"MDLT" + bytes([1, 0, 0, 0]))
+    patch += struct.pack("<II", len(old_data), len(new_data))
+    patch += hashlib.sha256(old_data).digest()
+
+    pos = 0
+    literal = 0
+    shift = 0
+    while pos < len(new_data):
+        match = index.get(new_data[pos : pos + block])
+        if match is None:
+            pos += 1
+            continue
+        length = block
+        while pos + length < len(new_data) and match + length < len(old_data) and new_data[pos + length] == old_data[match + length]:
+            length += 1
+        if literal < pos:
+            patch += _delta_literal(old_data, new_data, literal, pos, shift)
+        patch += struct.pack("<BII", 0x01, match, length)
+        shift = pos - match
+        pos += length
+        literal = pos
+    if literal < len(new_data):
+        patch += _delta_literal(old_data, new_data, literal, len(new_data), shift)
+    patch += bytes([0x00])
+
+    Path(out).write_bytes(patch)
+    print(f"{out}: {len(patch)} bytes for a {len(new_data)} byte image")
+
+
+@task(help={"image": "Signed image", "out": "Compressed image, copied to the SD card as FW.BIN", "window_bits": "Deflate window (2^n bytes), at most fw_inflate_window_bits"})
+def compress_fw(c, image, out, window_bits=12):
+    """Create a compressed firmware image for the bootloader."""
+    import struct
+    import zlib
+
+    data = Path(image).read_bytes()
+
+    compressor = zlib.compressobj(level=9, method=zlib.DEFLATED, wbits=int(window_bits))
+    stream = compressor.compress(data) + compressor.flush()
+
+    container = b"MFWZ" + struct.pack("<I", len(data)) + stream
+
+    Path(out).write_bytes(container)
+    print(f"{out}: {len(container)} bytes for a {len(data)} byte image ({100.0 * len(container) / len(data):.1f} %)")
+
+
+# NIST P-256, the only curve enabled in csrc/config/miso_mbedtls_config.h
+_P256_P = 0xFFFFFFFF00000001000000000000000000000000FFFFFFFFFFFFFFFFFFFFFFFF
+_P256_A = _P256_P - 3
+_P256_B = 0x5AC635D8AA3A93E7B3EBBD55769886BC651D06B0CC53B0F63BCE3C3E27D2604B
+_P256_NBITS = 256
+_P256_SPKI_PREFIX = bytes.fromhex("3059301306072a8648ce3d020106082a8648ce3d030107034200")
+
+
+def _p256_add(p, q):
+    """Affine point addition, None is the point at infinity."""
+    if p is None:
+        return q
+    if q is None:
+        return p
+    if p[0] == q[0]:
+        if (p[1] + q[1]) % _P256_P == 0:
+            return None
+        slope = (3 * p[0] * p[0] + _P256_A) * pow(2 * p[1], -1, _P256_P)
+    else:
+        slope = (q[1] - p[1]) * pow(q[0] - p[0], -1, _P256_P)
+    x = (slope * slope - p[0] - q[0]) % _P256_P
+    return (x, (slope * (p[0] - x) - p[1]) % _P256_P)
+
+
+def _p256_public_point(path):
+    """Read the uncompressed point of a P-256 public key, PEM or DER SubjectPublicKeyInfo."""
+    import base64
+
+    data = Path(path).read_bytes()
+    if data.lstrip().startswith(b"-----BEGIN PUBLIC KEY-----"):
+        body = b"".join(line for line in data.splitlines() if line and not line.startswith(b"-----"))
+        data = base64.b64decode(body)
+    if len(data) != len(_P256_SPKI_PREFIX) + 65 or not data.startswith(_P256_SPKI_PREFIX) or data[-65] != 0x04:
+        raise ValueError(f"{path}: not an uncompressed P-256 public key")
+    point = (int.from_bytes(data[-64:-32], "big"), int.from_bytes(data[-32:], "big"))
+    if (point[1] ** 2 - point[0] ** 3 - _P256_A * point[0] - _P256_B) % _P256_P != 0:
+        raise ValueError(f"{path}: point is not on the curve")
+    return point
+
+
+def _c_limbs(value):
+    """Little endian limbs in the TRUSTED_KEY_LIMB pairs of the generated table."""
+    words = [(value >> (32 * i)) & 0xFFFFFFFF for i in range(_P256_NBITS // 32)]
+    return ", ".join(f"TRUSTED_KEY_LIMB(0x{words[i]:08X}, 0x{words[i + 1]:08X})" for i in range(0, len(words), 2))
+
+
+@task(help={"key": "Public key trusted by pk.verifyTrusted (CONFIG.PUB)", "out": "Generated C source"})
+def trusted_key_table(c, key=str(PUB_KEY), out=str(KEY_DIR / "trusted_key_table.c")):
+    """Create the flash comb table of the trusted key, build with -Dtrusted_key_table=<out>."""
+    # mbedTLS uses a static base point table with a window of one more than its default:
+    # w = 5 below 384 bits, so T[i] = P + i_1 2^d P + ... + i_4 2^(4d) P for i < 2^(w - 1)
+    window = 5
+    comb_d = (_P256_NBITS + window - 1) // window
+
+    point = _p256_public_point(key)
+
+    # teeth[k] = 2^(k d) P
+    teeth = [point]
+    for _ in range(window - 1):
+        tooth = teeth[-1]
+        for _ in range(comb_d):
+            tooth = _p256_add(tooth, tooth)
+        teeth.append(tooth)
+
+    table = []
+    for i in range(1 << (window - 1)):
+        entry = point
+        for k in range(1, window):
+            if i & (1 << (k - 1)):
+                entry = _p256_add(entry, teeth[k])
+        table.append(entry)
+
+    lines = [
+        f"/* Generated by `inv trusted-key-table --key {Path(key).name}`, do not edit. */",
+        "",
+        "#include <trusted_key_table.h>",
+        "",
+        "#if defined(MBEDTLS_HAVE_INT64)",
+        "#define TRUSTED_KEY_LIMB(lo, hi) (((mbedtls_mpi_uint) (hi) << 32) | (lo))",
+        "#else",
+        "#define TRUSTED_KEY_LIMB(lo, hi) (lo), (hi)",
+        "#endif",
+        "",
+        "#define TRUSTED_KEY_MPI(limbs) { .s = 1, .n = sizeof(limbs) / sizeof(mbedtls_mpi_uint), .p = (mbedtls_mpi_uint *) (limbs) }",
+        "",
+        "static const mbedtls_mpi_uint one[] = { 1 };",
+        "",
+    ]
+    for i, (x, y) in enumerate(table):
+        lines.append(f"static const mbedtls_mpi_uint T_{i}_X[] = {{ {_c_limbs(x)} }};")
+        lines.append(f"static const mbedtls_mpi_uint T_{i}_Y[] = {{ {_c_limbs(y)} }};")
+    lines += ["", "static const mbedtls_ecp_point table[] = {"]
+    for i in range(len(table)):
+        lines.append(f"    {{ TRUSTED_KEY_MPI(T_{i}_X), TRUSTED_KEY_MPI(T_{i}_Y), TRUSTED_KEY_MPI(one) }},")
+    lines += [
+        "};",
+        "",
+        "const mbedtls_ecp_group_id trusted_key_grp_id = MBEDTLS_ECP_DP_SECP256R1;",
+        "const mbedtls_ecp_point *const trusted_key_table = table;",
+        "const size_t trusted_key_table_len = sizeof(table) / sizeof(table[0]);",
+        "const size_t trusted_key_table_size = sizeof(table) + sizeof(one) + 2 * (sizeof(table) / sizeof(table[0])) * sizeof(T_0_X);",
+        "",
+    ]
+
+    Path(out).parent.mkdir(parents=True, exist_ok=True)
+    Path(out).write_text("\n".join(lines))
+    print(f"{out}: {len(table)} points for the key {point[0]:064x}")